@@ -0,0 +1,106 @@
+// Measures compiler throughput on synthetic programs from `gen.mjs`, using
+// phase timings reported by `u --stats=json`. Prints JSON with tokens/s,
+// lines/s and MB/s of each phase, medians over all runs.
+//
+// usage: node bench/compile.mjs [u binary] [scale] [runs]
+
+import { spawnSync } from 'child_process';
+import { mkdtempSync, rmSync, writeFileSync } from 'fs';
+import { tmpdir } from 'os';
+import { join } from 'path';
+import { generators } from './gen.mjs';
+
+// bump when layout of the output changes
+const FORMAT_VERSION = 1;
+
+// sizes at scale 1, deep nesting is limited by stack of recursive parser
+const sizes = {
+    functions: 5000,
+    nesting: 2000,
+    expressions: 20000,
+    strings: 20000,
+    signatures: 3000,
+    externs: 5000,
+};
+
+const [compiler = './u', scale = '1', count = '3'] = process.argv.slice(2);
+const runs = Number(count);
+
+function median(values) {
+    const sorted = [...values].sort((a, b) => a - b);
+    return sorted[Math.floor(sorted.length / 2)];
+}
+
+function compileStats(file) {
+    const res = spawnSync(compiler, ['--stats=json', file, '-o', '/dev/null']);
+    if (res.status !== 0) {
+        throw new Error(`${file}: ${res.stderr.toString()}`);
+    }
+    return JSON.parse(res.stdout.toString());
+}
+
+// parse phase includes lexing, codegen includes decisions
+function phaseTimes(stats) {
+    const codegen = Object.entries(stats.phases)
+        .filter(([name]) => name.startsWith('codegen_'))
+        .reduce((sum, [, p]) => sum + p.ns, 0);
+    return {
+        lex: stats.phases.lex.ns,
+        parse: stats.phases.parse.ns,
+        decisions: stats.phases.decisions.ns,
+        codegen,
+        total: stats.phases.parse.ns + codegen,
+    };
+}
+
+function rate(amount, ns) {
+    return ns > 0 ? +(amount / (ns / 1e9)).toFixed(0) : null;
+}
+
+const dir = mkdtempSync(join(tmpdir(), 'nou-bench-'));
+const benchmarks = {};
+try {
+    for (const [name, generate] of Object.entries(generators)) {
+        const source = generate(Math.round(sizes[name] * Number(scale)));
+        const file = join(dir, `${name}.u`);
+        writeFileSync(file, source);
+
+        const samples = [];
+        let stats;
+        for (let i = 0; i < runs; i++) {
+            stats = compileStats(file);
+            samples.push(phaseTimes(stats));
+        }
+
+        const lines = source.split('\n').length;
+        const bytes = Buffer.byteLength(source);
+        const phases = {};
+        for (const phase of Object.keys(samples[0])) {
+            const ns = median(samples.map(s => s[phase]));
+            phases[phase] = {
+                ms: +(ns / 1e6).toFixed(3),
+                tokens_per_s: rate(stats.tokens, ns),
+                lines_per_s: rate(lines, ns),
+                mb_per_s: ns > 0 ? +(bytes / 1e6 / (ns / 1e9)).toFixed(2) : null,
+            };
+        }
+
+        benchmarks[name] = {
+            lines,
+            bytes,
+            tokens: stats.tokens,
+            emitted_bytes: stats.emitted_bytes,
+            allocated_bytes: stats.allocated_bytes,
+            phases,
+        };
+    }
+} finally {
+    rmSync(dir, { recursive: true, force: true });
+}
+
+console.log(JSON.stringify({
+    format: FORMAT_VERSION,
+    compiler,
+    runs,
+    benchmarks,
+}, null, 2));
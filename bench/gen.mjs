@@ -0,0 +1,110 @@
+// Generators of large synthetic NoU programs, each stressing one axis of the
+// compiler. `size` scales the program roughly linearly.
+//
+// usage: node bench/gen.mjs <generator> <size>
+
+import { pathToFileURL } from 'url';
+
+// thousands of small functions calling each other, named `fn_<i>` so none
+// of them is a type keyword like `f32`
+function functions(size) {
+    let out = 'export fn_0;\n\n';
+    for (let i = 0; i < size; i++) {
+        out += `fn_${i} := fn a: i32, b: i32 -> i32 {\n`;
+        out += '    x := i32 a * 2 + b;\n';
+        if (i + 1 < size) {
+            out += `    if (x % 7 == 0)\n        return fn_${i + 1}(x, b);\n`;
+        }
+        out += '    return x;\n};\n\n';
+    }
+    return out;
+}
+
+// one function with blocks nested `size` deep
+function nesting(size) {
+    let out = 'export f;\n\nf := fn -> i32 {\n    n := i32 0;\n';
+    out += '{\n'.repeat(size);
+    out += 'n = n + 1;\n';
+    out += '}\n'.repeat(size);
+    out += '    return n;\n};\n';
+    return out;
+}
+
+// one return of an expression with `size` operands
+function expressions(size) {
+    const ops = ['+', '-', '*', '%'];
+    let out = 'export f;\n\nf := fn a: i32, b: i32 -> i32 {\n    return a';
+    for (let i = 0; i < size; i++) {
+        const operand = i % 3 == 0 ? `(b + ${i})` : i % 2 ? 'a' : `${i + 1}`;
+        out += ` ${ops[i % ops.length]}`;
+        out += i % 16 == 15 ? '\n        ' : ' ';
+        out += operand;
+    }
+    out += ';\n};\n';
+    return out;
+}
+
+// functions declaring many distinct string literals
+function strings(size) {
+    let out = 'export s0;\n\n';
+    const per_function = 32;
+    for (let f = 0; f * per_function < size; f++) {
+        out += `s${f} := fn -> [u8] {\n`;
+        const count = Math.min(per_function, size - f * per_function);
+        for (let i = 0; i < count; i++) {
+            const n = f * per_function + i;
+            out += `    v${i} := [u8] "string literal number ${n}\\n";\n`;
+        }
+        out += '    return v0;\n};\n\n';
+    }
+    return out;
+}
+
+// functions which all have different signatures
+function signatures(size) {
+    const types = ['i32', 'u32', 'u8', 'bool', '[u8]'];
+    let out = 'export g0;\n\n';
+    for (let i = 0; i < size; i++) {
+        // digits of `i` in base of type count pick parameter types
+        const params = [];
+        for (let n = i + 1; n > 0; n = Math.floor((n - 1) / types.length)) {
+            params.push(`p${params.length}: ${types[(n - 1) % types.length]}`);
+        }
+        out += `g${i} := fn ${params.join(', ')} -> i32 {\n`;
+        out += `    return ${i};\n};\n\n`;
+    }
+    return out;
+}
+
+// many extern functions, all called from one function
+function externs(size) {
+    let out = 'export f;\n\n';
+    for (let i = 0; i < size; i++) {
+        out += `extern e${i} := fn x: i32 -> i32;\n`;
+    }
+    out += '\nf := fn -> i32 {\n    x := i32 0;\n';
+    for (let i = 0; i < size; i++) {
+        out += `    x = e${i}(x);\n`;
+    }
+    out += '    return x;\n};\n';
+    return out;
+}
+
+export const generators = {
+    functions,
+    nesting,
+    expressions,
+    strings,
+    signatures,
+    externs,
+};
+
+if (import.meta.url === pathToFileURL(process.argv[1]).href) {
+    const [name, size = '1000'] = process.argv.slice(2);
+    if (!generators[name]) {
+        console.error(`usage: node bench/gen.mjs <${
+            Object.keys(generators).join('|')}> <size>`);
+        process.exit(1);
+    }
+    process.stdout.write(generators[name](Number(size)));
+}
@@ -0,0 +1,139 @@
+// Measures speed of code generated from kernels in `kernels.u`. Each
+// configuration is a compiler binary optionally followed by its flags, when
+// two are given, kernels are compared side by side.
+//
+// usage: node bench/runtime.mjs ['./u [flags]'] ['./other-u [flags]']
+
+import { spawnSync } from 'child_process';
+import { mkdtempSync, readFileSync, rmSync } from 'fs';
+import { tmpdir } from 'os';
+import { join } from 'path';
+import { performance } from 'perf_hooks';
+
+// bump when layout of the output changes
+const FORMAT_VERSION = 1;
+
+const WARMUP_MS = 200;
+const SAMPLE_MS = 50;
+const SAMPLES = 10;
+
+const kernelsFile = new URL('kernels.u', import.meta.url).pathname;
+const configs = process.argv.length > 2 ? process.argv.slice(2) : ['./u'];
+
+const text = 'the quick brown fox jumps over the lazy dog. ';
+
+function compile(config, out) {
+    const [compiler, ...flags] = config.split(' ').filter(s => s);
+    const res = spawnSync(compiler, [...flags, kernelsFile, '-o', out]);
+    if (res.status !== 0) {
+        throw new Error(`${config}: ${res.stderr.toString()}`);
+    }
+    return readFileSync(out);
+}
+
+// size of code section, section ids and sizes are LEB128 encoded
+function codeSize(wasm) {
+    function leb(state) {
+        let result = 0, shift = 0, byte;
+        do {
+            byte = wasm[state.offset++];
+            result |= (byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        return result;
+    }
+
+    const state = { offset: 8 };
+    while (state.offset < wasm.length) {
+        const id = wasm[state.offset++];
+        const size = leb(state);
+        if (id === 10) return size;
+        state.offset += size;
+    }
+    return 0;
+}
+
+function slice(exports, str) {
+    const s = exports.buffer(str.length);
+    const ptr = Number(s & 0xffffffffn);
+    new Uint8Array(exports.u_memory.buffer, ptr, str.length)
+        .set(new TextEncoder().encode(str));
+    return s;
+}
+
+function kernels(exports) {
+    const input = text.repeat(Math.ceil(1000 / text.length)).slice(0, 1000);
+    const a = slice(exports, input);
+    const b = slice(exports, input);
+    return {
+        fib: () => exports.fib(20),
+        format_int: () => exports.format_int(1234567890),
+        alloc_free: () => exports.alloc_free(2000),
+        alloc_free_builtin: () => exports.alloc_free_builtin(2000),
+        count_byte: () => exports.count_byte(a, 32),
+        count_byte_builtin: () => exports.count_byte_builtin(a, 32),
+        hash: () => exports.hash(a),
+        equal: () => exports.equal(a, b),
+    };
+}
+
+// runs `op` in batches, returns median of ns per call
+function measure(op) {
+    let batch = 1;
+    const warmupEnd = performance.now() + WARMUP_MS;
+    while (performance.now() < warmupEnd) {
+        const start = performance.now();
+        for (let i = 0; i < batch; i++) op();
+        if (performance.now() - start < SAMPLE_MS / 10) batch *= 2;
+    }
+
+    const samples = [];
+    while (samples.length < SAMPLES) {
+        const start = performance.now();
+        let calls = 0;
+        while (performance.now() - start < SAMPLE_MS) {
+            for (let i = 0; i < batch; i++) op();
+            calls += batch;
+        }
+        samples.push((performance.now() - start) * 1e6 / calls);
+    }
+    samples.sort((a, b) => a - b);
+    return +samples[Math.floor(SAMPLES / 2)].toFixed(1);
+}
+
+const dir = mkdtempSync(join(tmpdir(), 'nou-runtime-'));
+const results = [];
+try {
+    for (const [i, config] of configs.entries()) {
+        const wasm = compile(config, join(dir, `${i}.wasm`));
+        const { instance } = await WebAssembly.instantiate(wasm, { env: {} });
+        const times = {};
+        for (const [name, op] of Object.entries(kernels(instance.exports))) {
+            times[name] = measure(op);
+        }
+        results.push({
+            config,
+            wasm_bytes: wasm.length,
+            code_bytes: codeSize(wasm),
+            times,
+        });
+    }
+} finally {
+    rmSync(dir, { recursive: true, force: true });
+}
+
+const table = {};
+for (const name of Object.keys(results[0].times)) {
+    table[name] = { ns_per_op: results.map(r => r.times[name]) };
+    if (results.length === 2) {
+        table[name].ratio =
+            +(results[1].times[name] / results[0].times[name]).toFixed(3);
+    }
+}
+
+console.log(JSON.stringify({
+    format: FORMAT_VERSION,
+    configs: results.map(({ config, wasm_bytes, code_bytes }) =>
+        ({ config, wasm_bytes, code_bytes })),
+    kernels: table,
+}, null, 2));
@@ -0,0 +1,93 @@
+// Compares latency of compiling a file with a fresh `u` process per request
+// against sending the same requests to one `u --serve` process.
+//
+// usage: node bench/serve.mjs [u binary] [input.u] [requests]
+
+import { spawn, spawnSync } from 'child_process';
+import { readFileSync } from 'fs';
+import { performance } from 'perf_hooks';
+
+const [compiler = './u', input = 'tests/test.u', count = '200'] =
+    process.argv.slice(2);
+const requests = Number(count);
+const source = readFileSync(input);
+
+function summary(times) {
+    times.sort((a, b) => a - b);
+    const mean = times.reduce((a, b) => a + b, 0) / times.length;
+    return {
+        mean_ms: +mean.toFixed(3),
+        p50_ms: +times[Math.floor(times.length * 0.5)].toFixed(3),
+        p99_ms: +times[Math.floor(times.length * 0.99)].toFixed(3),
+    };
+}
+
+function benchCold() {
+    const times = [];
+    for (let i = 0; i < requests; i++) {
+        const start = performance.now();
+        const res = spawnSync(compiler, [input, '-o', '/dev/null']);
+        times.push(performance.now() - start);
+        if (res.status !== 0) throw new Error(res.stderr.toString());
+    }
+    return summary(times);
+}
+
+// reads replies framed as `<status> <wasm size> <diagnostics size>\n...`
+function replyReader(stream) {
+    let buffer = Buffer.alloc(0);
+    let waiting = null;
+
+    function tryReply() {
+        const newline = buffer.indexOf('\n');
+        if (!waiting || newline < 0) return;
+        const [status, wasm, diag] = buffer.subarray(0, newline).toString()
+            .split(' ');
+        const end = newline + 1 + Number(wasm) + Number(diag);
+        if (buffer.length < end) return;
+        buffer = buffer.subarray(end);
+        const resolve = waiting;
+        waiting = null;
+        resolve(status);
+    }
+
+    stream.on('data', chunk => {
+        buffer = Buffer.concat([buffer, chunk]);
+        tryReply();
+    });
+
+    return () => new Promise(resolve => {
+        waiting = resolve;
+        tryReply();
+    });
+}
+
+async function benchServe() {
+    const server = spawn(compiler, ['--serve'], {
+        stdio: ['pipe', 'pipe', 'inherit'],
+    });
+    const nextReply = replyReader(server.stdout);
+    const header = Buffer.from(`source ${source.length}\n`);
+
+    const times = [];
+    for (let i = 0; i < requests; i++) {
+        const start = performance.now();
+        server.stdin.write(Buffer.concat([header, source]));
+        const status = await nextReply();
+        times.push(performance.now() - start);
+        if (status !== 'ok') throw new Error(`request failed: ${status}`);
+    }
+
+    server.stdin.end();
+    return summary(times);
+}
+
+const cold = benchCold();
+const serve = await benchServe();
+console.log(JSON.stringify({
+    input,
+    requests,
+    cold,
+    serve,
+    speedup: +(cold.mean_ms / serve.mean_ms).toFixed(1),
+}, null, 4));
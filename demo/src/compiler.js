@@ -1,85 +1,90 @@
-import { WASI, File, OpenFile, PreopenDirectory } from "@bjorn3/browser_wasi_shim";
+import { WASI, File, OpenFile } from "@bjorn3/browser_wasi_shim";
+
+// flags of nou_compile, see src/reactor.c
+const FLAGS = {
+    "-l": 1 << 0,
+    "-t": 1 << 1,
+    "-v": 1 << 2,
+};
 
 export class Compiler {
     constructor() {
         this.wasi = null;
         this.module = null;
-        this.stdout = null;
-        this.stdin = null;
+        this.instance = null;
         this.stderr = null;
-        this.input_file = null;
-        this.output_file = null;
-        this.default_args = ["u", "main.u"];
+        this.output = "";
+        this.errors = "";
     }
 
     async init(moduleUrl) {
-        const env = [];
-        this.input_file = new File([]);
-        this.output_file = new File([]);
+        this.module = await WebAssembly.compile(await (await fetch(moduleUrl)).arrayBuffer());
+        await this.instantiate();
+    }
+
+    // reactor is instantiated once and reused, unless a fatal error exits it
+    async instantiate() {
+        this.stderr = new File([]);
         const fds = [
-            null,
-            null,
-            null,
-            new PreopenDirectory(".", {
-                "main.u": this.input_file,
-                "a.out": this.output_file,
-            }),
+            new OpenFile(new File([])),
+            new OpenFile(new File([])),
+            new OpenFile(this.stderr),
         ];
-
-        this.wasi = new WASI(this.default_args, env, fds);
-
-        this.module = await WebAssembly.compile(await (await fetch(moduleUrl)).arrayBuffer());
+        this.wasi = new WASI(["u"], [], fds);
+        this.instance = await WebAssembly.instantiate(this.module, {
+            "wasi_snapshot_preview1": this.wasi.wasiImport,
+        });
+        this.wasi.initialize(this.instance);
     }
 
     getOutput() {
-        const decoder = new TextDecoder();
-        const message_stdout = decoder.decode(this.stdout.data);
-        return message_stdout;
+        return this.output;
     }
 
     getErrors() {
-        const decoder = new TextDecoder();
-        const message_stderr = decoder.decode(this.stderr.data);
-        return message_stderr;
+        return this.errors;
     }
 
-    resetStdio() {
-        this.stdin = new File();
-        this.stdout = new File();
-        this.stderr = new File();
-        this.wasi.fds[0] = new OpenFile(this.stdin);
-        this.wasi.fds[1] = new OpenFile(this.stdout);
-        this.wasi.fds[2] = new OpenFile(this.stderr);
+    readMemory(ptr, size) {
+        return new Uint8Array(this.instance.exports.memory.buffer, ptr, size).slice();
+    }
+
+    readString(ptr, size) {
+        return new TextDecoder().decode(this.readMemory(ptr, size));
     }
 
     /** @type {(source_code: string, extra_args: string[])} **/
     async compile(source_code, extra_args) {
-        try {
-            if (extra_args) {
-                this.wasi.args = [...this.default_args, ...extra_args];
-            } else {
-                this.wasi.args = [...this.default_args];
-            }
-            const encoder = new TextEncoder();
-            const encoded_source = encoder.encode(source_code);
-            this.input_file.data = encoded_source;
-
-            this.resetStdio();
+        let flags = 0;
+        for (const arg of extra_args ?? []) {
+            flags |= FLAGS[arg] ?? 0;
+        }
 
-            const instance = await WebAssembly.instantiate(this.module, {
-                "wasi_snapshot_preview1": this.wasi.wasiImport,
-            });
+        if (!this.instance) {
+            await this.instantiate();
+        }
+        const exports = this.instance.exports;
 
-            console.log("Running", this.wasi.args);
-            this.wasi.start(instance);
+        try {
+            const source = new TextEncoder().encode(source_code);
+            const ptr = exports.nou_source_buffer(source.length);
+            new Uint8Array(exports.memory.buffer, ptr, source.length).set(source);
 
-            console.info("stdout:\n" + this.getOutput());
+            const ok = exports.nou_compile(ptr, source.length, flags);
 
-            console.info("stderr:\n" + this.getErrors());
+            this.output = this.readString(exports.nou_listing(), exports.nou_listing_size());
+            this.errors = this.readString(exports.nou_diagnostics(), exports.nou_diagnostics_size());
 
-            return this.output_file.data;
+            if (!ok) {
+                return null;
+            }
+            return this.readMemory(exports.nou_output(), exports.nou_output_size());
         } catch {
-            console.error("Error occured during compilation:\n", "stderr:\n", this.getErrors(), "stdout:\n", this.getOutput());
+            // compiler exited, errors were written to stderr before that
+            this.output = "";
+            this.errors = new TextDecoder().decode(this.stderr.data);
+            this.instance = null;
+            console.error("Error occured during compilation:\n", this.errors);
             return null;
         }
     }
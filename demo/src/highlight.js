@@ -6,7 +6,7 @@ export function highlightCode(text) {
     }
 
     // numbers
-    text = text.replace(/(?<!\w)([0-9]+([ui][0-9]+)?)/g, hi("nu"));
+    text = text.replace(/(?<!\w)([0-9]+(\.[0-9]+)?([uif][0-9]+)?)/g, hi("nu"));
     
     // strings
     text = text.replace(/("[^"]*")/g, hi("st"));
@@ -16,8 +16,13 @@ export function highlightCode(text) {
     text = text.replace(/(?<!\w)(extern)(?!\w)/g, hi("kw"));
     text = text.replace(/(?<!\w)(fn)(?!\w)/g, hi("kw"));
     text = text.replace(/(?<!\w)(return)(?!\w)/g, hi("kw"));
+    text = text.replace(/(?<!\w)(struct)(?!\w)/g, hi("kw"));
+    text = text.replace(/(?<!\w)(soa)(?!\w)/g, hi("kw"));
     text = text.replace(/(?<!\w)(if)(?!\w)/g, hi("kw"));
+    text = text.replace(/(?<!\w)(then)(?!\w)/g, hi("kw"));
     text = text.replace(/(?<!\w)(else)(?!\w)/g, hi("kw"));
+    text = text.replace(/(?<!\w)(switch)(?!\w)/g, hi("kw"));
+    text = text.replace(/(?<!\w)(case)(?!\w)/g, hi("kw"));
 
     // types
     text = text.replace(/(\[)/g, hi("ty"));
@@ -25,7 +30,12 @@ export function highlightCode(text) {
     text = text.replace(/(?<!\w)(u8)(?!\w)/g, hi("ty"));
     text = text.replace(/(?<!\w)(i32)(?!\w)/g, hi("ty"));
     text = text.replace(/(?<!\w)(u32)(?!\w)/g, hi("ty"));
+    text = text.replace(/(?<!\w)(i64)(?!\w)/g, hi("ty"));
+    text = text.replace(/(?<!\w)(u64)(?!\w)/g, hi("ty"));
+    text = text.replace(/(?<!\w)(f32)(?!\w)/g, hi("ty"));
+    text = text.replace(/(?<!\w)(f64)(?!\w)/g, hi("ty"));
     text = text.replace(/(?<!\w)(bool)(?!\w)/g, hi("ty"));
+    text = text.replace(/(?<!\w)(v128)(?!\w)/g, hi("ty"));
 
     // boolean
     text = text.replace(/(?<!\w)(true)(?!\w)/g, hi("bo"));
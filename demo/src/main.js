@@ -8,7 +8,7 @@ import { Runner } from './runner';
 async function main() {
     const compiler = new Compiler();
 
-    await compiler.init("u.wasm");
+    await compiler.init("u_reactor.wasm");
 
     const editor = setupCodeEditor(document.querySelector('#code-editor'));
 
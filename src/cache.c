@@ -0,0 +1,675 @@
+#include "cache.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "codegen.h"
+
+#define CACHE_MAGIC "NOUC"
+#define CACHE_FORMAT_VERSION 8
+
+// key
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t cache_key(const char* source, size_t size, ParseOptions options) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const char* version = NOU_VERSION;
+    uint8_t format = CACHE_FORMAT_VERSION;
+    uint8_t lazy = options.lazy;
+    hash = fnv1a(hash, version, strlen(version) + 1);
+    hash = fnv1a(hash, &format, 1);
+    hash = fnv1a(hash, &lazy, 1);
+    hash = fnv1a(hash, source, size);
+    return hash;
+}
+
+// writing
+//
+// all numbers are stored as LEB128, indices are relative to module lists, so
+// format doesn't depend on where things were allocated
+
+static void write_u64(ByteBuffer* bb, uint64_t x) {
+    do {
+        uint8_t byte = x & 0x7F;
+        x >>= 7;
+        if (x) byte |= 0x80;
+        da_append(*bb, byte);
+    } while (x);
+}
+
+static void write_bytes(ByteBuffer* bb, const char* bytes, size_t len) {
+    write_u64(bb, len);
+    for (size_t i = 0; i < len; i++) {
+        da_append(*bb, bytes[i]);
+    }
+}
+
+static void write_name(ByteBuffer* bb, const char* name) {
+    write_bytes(bb, name, strlen(name));
+}
+
+static void write_value_type(ByteBuffer* bb, ValueType vt) {
+    write_u64(bb, vt.kind);
+    switch (vt.kind) {
+        case VT_NIL:
+        case VT_BOOL:
+        case VT_V128:
+            break;
+        case VT_INT:
+            write_u64(bb, vt.props.i.bits);
+            write_u64(bb, vt.props.i.unsign);
+            break;
+        case VT_FLOAT:
+            write_u64(bb, vt.props.f.bits);
+            break;
+        case VT_SLICE:
+            write_value_type(bb, *vt.props.inner_type);
+            break;
+        case VT_STRUCT:
+            write_u64(bb, vt.props.struct_index);
+            break;
+        case VT_FUNCTION:
+            write_u64(bb, vt.props.function_type);
+            break;
+        case VT_ARRAY:
+            write_u64(bb, vt.props.array.len);
+            write_value_type(bb, *vt.props.array.inner_type);
+            break;
+    }
+}
+
+static void write_expression(ByteBuffer* bb, Expression* ex) {
+    write_u64(bb, ex->count);
+    for (size_t i = 0; i < ex->count; i++) {
+        Expr* e = &ex->items[i];
+        write_u64(bb, e->kind);
+        switch (e->kind) {
+            case EK_INT_CONST:
+                write_u64(bb, e->props.i.value);
+                write_u64(bb, e->props.i.bits);
+                write_u64(bb, e->props.i.unsign);
+                break;
+            case EK_FLOAT_CONST: {
+                uint64_t value;
+                memcpy(&value, &e->props.f.value, sizeof(value));
+                write_u64(bb, value);
+                write_u64(bb, e->props.f.bits);
+            } break;
+            case EK_BOOL_CONST:
+                write_u64(bb, e->props.boolean);
+                break;
+            case EK_STRING_CONST:
+                write_u64(bb, e->props.str_index);
+                break;
+            case EK_VAR:
+                write_name(bb, e->props.var);
+                break;
+            case EK_OPERATOR:
+                write_u64(bb, e->props.op);
+                break;
+            case EK_FUNC_CALL:
+                write_name(bb, e->props.func);
+                break;
+            case EK_FIELD_ACCESS:
+                write_name(bb, e->props.field_name);
+                break;
+            case EK_CASTING:
+                write_value_type(bb, e->props.cast_target);
+                break;
+            case EK_SUBSLICE:
+                write_u64(bb, e->props.to_end);
+                break;
+            case EK_CONDITIONAL:
+                for (size_t j = 0; j < 3; j++) {
+                    write_expression(bb, &e->props.arms[j]);
+                }
+                break;
+        }
+    }
+}
+
+static void write_statement(ByteBuffer* bb, Statement* st) {
+    write_u64(bb, st->kind);
+    switch (st->kind) {
+        case SK_EMPTY:
+            break;
+        case SK_BLOCK:
+            write_u64(bb, st->block.scope);
+            write_u64(bb, st->block.count);
+            for (size_t i = 0; i < st->block.count; i++) {
+                write_statement(bb, &st->block.items[i]);
+            }
+            break;
+        case SK_RETURN:
+            write_expression(bb, &st->ret.expr);
+            break;
+        case SK_IF:
+            write_expression(bb, &st->ifs.cond_expr);
+            write_statement(bb, st->ifs.positive_branch);
+            write_u64(bb, st->ifs.negative_branch != NULL);
+            if (st->ifs.negative_branch)
+                write_statement(bb, st->ifs.negative_branch);
+            break;
+        case SK_EXPRESSION:
+            write_expression(bb, &st->expr.expr);
+            break;
+        case SK_SWITCH:
+            write_expression(bb, &st->switchs.expr);
+            write_u64(bb, st->switchs.cases.count);
+            for (size_t i = 0; i < st->switchs.cases.count; i++) {
+                SwitchCase* c = &st->switchs.cases.items[i];
+                write_u64(bb, c->value);
+                write_u64(bb, c->bits);
+                write_u64(bb, c->unsign);
+                write_u64(bb, c->branch);
+            }
+            write_u64(bb, st->switchs.branches.count);
+            for (size_t i = 0; i < st->switchs.branches.count; i++) {
+                write_statement(bb, &st->switchs.branches.items[i]);
+            }
+            write_u64(bb, st->switchs.default_branch != NULL);
+            if (st->switchs.default_branch)
+                write_statement(bb, st->switchs.default_branch);
+            break;
+    }
+}
+
+static void write_functions(ByteBuffer* bb, Functions* functions) {
+    write_u64(bb, functions->count);
+    for (size_t i = 0; i < functions->count; i++) {
+        Function* f = &functions->items[i];
+        write_u64(bb, f->param_scope);
+        write_value_type(bb, f->return_type);
+        write_u64(bb, f->function_type);
+        if (f->lazy) {  // bodies skipped in lazy mode are never parsed
+            write_statement(bb, &(Statement){.kind = SK_EMPTY});
+        } else {
+            write_statement(bb, &f->content);
+        }
+    }
+}
+
+static void write_module(ByteBuffer* bb, Module* mod) {
+    for (size_t i = 0; i < 4; i++) da_append(*bb, CACHE_MAGIC[i]);
+    write_u64(bb, CACHE_FORMAT_VERSION);
+
+    write_u64(bb, mod->exports.count);
+    for (size_t i = 0; i < mod->exports.count; i++) {
+        write_name(bb, mod->exports.items[i].decl_name);
+    }
+
+    write_u64(bb, mod->string_constants.count);
+    for (size_t i = 0; i < mod->string_constants.count; i++) {
+        StringConstant* s = &mod->string_constants.items[i];
+        write_bytes(bb, s->chars, s->len);
+    }
+
+    // count of function types goes first, value types refer to them
+    write_u64(bb, mod->function_types.count);
+
+    write_u64(bb, mod->structs.count);
+    for (size_t i = 0; i < mod->structs.count; i++) {
+        StructType* s = &mod->structs.items[i];
+        write_name(bb, s->name);
+        write_u64(bb, s->soa);
+        write_u64(bb, s->count);
+        for (size_t j = 0; j < s->count; j++) {
+            write_name(bb, s->items[j].name);
+            write_value_type(bb, s->items[j].vt);
+        }
+    }
+
+    write_u64(bb, mod->scopes.count);
+    for (size_t i = 0; i < mod->scopes.count; i++) {
+        DeclScope* s = &mod->scopes.items[i];
+        write_u64(bb, s->parent);
+        write_u64(bb, s->param_scope);
+        write_u64(bb, s->count);
+        for (size_t j = 0; j < s->count; j++) {
+            Decl* d = &s->items[j];
+            write_name(bb, d->name);
+            write_u64(bb, d->kind);
+            switch (d->kind) {
+                case DK_FUNCTION:
+                case DK_EXTERN_FUNCTION:
+                    write_u64(bb, d->value.func_index);
+                    break;
+                case DK_PARAM:
+                case DK_VARIABLE:
+                    write_value_type(bb, d->value.vt);
+                    break;
+                case DK_STRUCT:
+                    write_u64(bb, d->value.struct_index);
+                    break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < mod->function_types.count; i++) {
+        write_u64(bb, mod->function_types.items[i].param_scope);
+        write_value_type(bb, mod->function_types.items[i].return_type);
+    }
+
+    write_functions(bb, &mod->extern_functions);
+    write_functions(bb, &mod->functions);
+
+    // checksum catches corruption which still decodes to a valid module
+    uint64_t sum = fnv1a(0xcbf29ce484222325ULL, bb->items, bb->count);
+    for (size_t i = 0; i < 8; i++) da_append(*bb, (sum >> (i * 8)) & 0xFF);
+}
+
+// reading
+//
+// reader never trusts the file, any inconsistency marks it as failed and
+// the cache entry is ignored
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+    bool failed;
+    Module* mod;
+    size_t structs;  // count of structs, read before any type
+    size_t function_types;  // likewise
+} CacheReader;
+
+static uint64_t read_u64(CacheReader* r) {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->offset >= r->size) break;
+        uint8_t byte = r->data[r->offset++];
+        x |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return x;
+    }
+    r->failed = true;
+    return 0;
+}
+
+// reads count of items, each of which takes at least one byte
+static size_t read_count(CacheReader* r) {
+    uint64_t count = read_u64(r);
+    if (count > r->size - r->offset) {
+        r->failed = true;
+        return 0;
+    }
+    return count;
+}
+
+static size_t read_index(CacheReader* r, size_t limit) {
+    uint64_t index = read_u64(r);
+    if (index >= limit) {
+        r->failed = true;
+        return 0;
+    }
+    return index;
+}
+
+static char* read_bytes(CacheReader* r, size_t* out_len) {
+    size_t len = read_count(r);
+    char* bytes = malloc(len + 1);
+    assert(bytes);
+    memcpy(bytes, r->data + r->offset, len);
+    bytes[len] = '\0';
+    r->offset += len;
+    if (out_len) *out_len = len;
+    return bytes;
+}
+
+static char* read_name(CacheReader* r) { return read_bytes(r, NULL); }
+
+static ValueType read_value_type(CacheReader* r) {
+    ValueType vt = {.kind = read_u64(r)};
+    switch (vt.kind) {
+        case VT_NIL:
+        case VT_BOOL:
+        case VT_V128:
+            break;
+        case VT_INT:
+            vt.props.i.bits = read_u64(r);
+            vt.props.i.unsign = read_u64(r);
+            break;
+        case VT_FLOAT:
+            vt.props.f.bits = read_u64(r);
+            break;
+        case VT_SLICE:
+            vt.props.inner_type = malloc(sizeof(ValueType));
+            assert(vt.props.inner_type);
+            da_append(r->mod->inner_types, vt.props.inner_type);
+            *vt.props.inner_type = read_value_type(r);
+            break;
+        case VT_STRUCT:
+            vt.props.struct_index = read_index(r, r->structs);
+            break;
+        case VT_FUNCTION:
+            vt.props.function_type = read_index(r, r->function_types);
+            break;
+        case VT_ARRAY:
+            vt.props.array.len = read_u64(r);
+            vt.props.array.inner_type = malloc(sizeof(ValueType));
+            assert(vt.props.array.inner_type);
+            da_append(r->mod->inner_types, vt.props.array.inner_type);
+            *vt.props.array.inner_type = read_value_type(r);
+            break;
+        default:
+            r->failed = true;
+            vt.kind = VT_NIL;
+    }
+    return vt;
+}
+
+static Expression read_expression(CacheReader* r, Module* mod) {
+    Expression ex = {0};
+    size_t count = read_count(r);
+    for (size_t i = 0; i < count && !r->failed; i++) {
+        Expr e = {.kind = read_u64(r)};
+        switch (e.kind) {
+            case EK_INT_CONST:
+                e.props.i.value = read_u64(r);
+                e.props.i.bits = read_u64(r);
+                e.props.i.unsign = read_u64(r);
+                break;
+            case EK_FLOAT_CONST: {
+                uint64_t value = read_u64(r);
+                memcpy(&e.props.f.value, &value, sizeof(value));
+                e.props.f.bits = read_u64(r);
+            } break;
+            case EK_BOOL_CONST:
+                e.props.boolean = read_u64(r);
+                break;
+            case EK_STRING_CONST:
+                e.props.str_index =
+                    read_index(r, mod->string_constants.count);
+                break;
+            case EK_VAR:
+                e.props.var = read_name(r);
+                break;
+            case EK_OPERATOR:
+                e.props.op = read_u64(r);
+                break;
+            case EK_FUNC_CALL:
+                e.props.func = read_name(r);
+                break;
+            case EK_FIELD_ACCESS:
+                e.props.field_name = read_name(r);
+                break;
+            case EK_CASTING:
+                e.props.cast_target = read_value_type(r);
+                break;
+            case EK_SUBSLICE:
+                e.props.to_end = read_u64(r);
+                break;
+            case EK_CONDITIONAL:
+                e.props.arms = calloc(3, sizeof(Expression));
+                assert(e.props.arms);
+                for (size_t j = 0; j < 3; j++) {
+                    e.props.arms[j] = read_expression(r, mod);
+                }
+                break;
+            default:
+                r->failed = true;
+        }
+        da_append(ex, e);
+    }
+    return ex;
+}
+
+static Statement read_statement(CacheReader* r, Module* mod) {
+    Statement st = {.kind = read_u64(r)};
+    switch (st.kind) {
+        case SK_EMPTY:
+            break;
+        case SK_BLOCK: {
+            st.block.scope = read_index(r, mod->scopes.count);
+            size_t count = read_count(r);
+            for (size_t i = 0; i < count && !r->failed; i++) {
+                da_append(st.block, read_statement(r, mod));
+            }
+        } break;
+        case SK_RETURN:
+            st.ret.expr = read_expression(r, mod);
+            break;
+        case SK_IF:
+            st.ifs.cond_expr = read_expression(r, mod);
+            st.ifs.positive_branch = malloc(sizeof(Statement));
+            assert(st.ifs.positive_branch);
+            *st.ifs.positive_branch = read_statement(r, mod);
+            if (read_u64(r)) {
+                st.ifs.negative_branch = malloc(sizeof(Statement));
+                assert(st.ifs.negative_branch);
+                *st.ifs.negative_branch = read_statement(r, mod);
+            }
+            break;
+        case SK_EXPRESSION:
+            st.expr.expr = read_expression(r, mod);
+            break;
+        case SK_SWITCH: {
+            st.switchs.expr = read_expression(r, mod);
+            size_t cases = read_count(r);
+            for (size_t i = 0; i < cases && !r->failed; i++) {
+                SwitchCase c = {0};
+                c.value = read_u64(r);
+                c.bits = read_u64(r);
+                c.unsign = read_u64(r);
+                c.branch = read_u64(r);
+                da_append(st.switchs.cases, c);
+            }
+            size_t branches = read_count(r);
+            for (size_t i = 0; i < branches && !r->failed; i++) {
+                da_append(st.switchs.branches, read_statement(r, mod));
+            }
+            for (size_t i = 0; i < cases && !r->failed; i++) {
+                if (st.switchs.cases.items[i].branch >= branches)
+                    r->failed = true;
+            }
+            if (read_u64(r)) {
+                st.switchs.default_branch = malloc(sizeof(Statement));
+                assert(st.switchs.default_branch);
+                *st.switchs.default_branch = read_statement(r, mod);
+            }
+        } break;
+        default:
+            r->failed = true;
+            st.kind = SK_EMPTY;
+    }
+    return st;
+}
+
+static void read_functions(CacheReader* r, Module* mod, Functions* out) {
+    size_t count = read_count(r);
+    for (size_t i = 0; i < count && !r->failed; i++) {
+        Function f = {0};
+        f.param_scope = read_index(r, mod->scopes.count);
+        f.return_type = read_value_type(r);
+        f.function_type = read_index(r, mod->function_types.count);
+        f.content = read_statement(r, mod);
+        da_append(*out, f);
+    }
+}
+
+static bool read_module(CacheReader* r, Module* mod) {
+    if (r->size < 4 || memcmp(r->data, CACHE_MAGIC, 4) != 0) return false;
+    r->offset = 4;
+    if (read_u64(r) != CACHE_FORMAT_VERSION) return false;
+
+    size_t exports = read_count(r);
+    for (size_t i = 0; i < exports && !r->failed; i++) {
+        da_append(mod->exports, (Export){.decl_name = read_name(r)});
+    }
+
+    size_t strings = read_count(r);
+    for (size_t i = 0; i < strings && !r->failed; i++) {
+        StringConstant s = {0};
+        s.chars = read_bytes(r, &s.len);
+        da_append(mod->string_constants, s);
+    }
+
+    r->function_types = read_count(r);
+
+    r->structs = read_count(r);
+    for (size_t i = 0; i < r->structs && !r->failed; i++) {
+        StructType s = {0};
+        s.name = read_name(r);
+        s.soa = read_u64(r);
+        size_t fields = read_count(r);
+        for (size_t j = 0; j < fields && !r->failed; j++) {
+            StructField field = {0};
+            field.name = read_name(r);
+            field.vt = read_value_type(r);
+            da_append(s, field);
+        }
+        da_append(mod->structs, s);
+    }
+
+    size_t scopes = read_count(r);
+    for (size_t i = 0; i < scopes && !r->failed; i++) {
+        DeclScope s = {0};
+        s.parent = read_index(r, scopes);
+        s.param_scope = read_u64(r);
+        size_t decls = read_count(r);
+        for (size_t j = 0; j < decls && !r->failed; j++) {
+            Decl d = {0};
+            d.name = read_name(r);
+            d.kind = read_u64(r);
+            switch (d.kind) {
+                case DK_FUNCTION:
+                case DK_EXTERN_FUNCTION:
+                    d.value.func_index = read_u64(r);
+                    break;
+                case DK_PARAM:
+                case DK_VARIABLE:
+                    d.value.vt = read_value_type(r);
+                    break;
+                case DK_STRUCT:
+                    d.value.struct_index = read_index(r, r->structs);
+                    break;
+                default:
+                    r->failed = true;
+            }
+            da_append(s, d);
+        }
+        da_append(mod->scopes, s);
+    }
+
+    for (size_t i = 0; i < r->function_types && !r->failed; i++) {
+        FunctionType ft = {0};
+        ft.param_scope = read_index(r, mod->scopes.count);
+        ft.return_type = read_value_type(r);
+        da_append(mod->function_types, ft);
+    }
+
+    read_functions(r, mod, &mod->extern_functions);
+    read_functions(r, mod, &mod->functions);
+
+    for (size_t i = 0; i < mod->scopes.count && !r->failed; i++) {
+        DeclScope* s = &mod->scopes.items[i];
+        for (size_t j = 0; j < s->count; j++) {
+            Decl* d = &s->items[j];
+            if ((d->kind == DK_FUNCTION &&
+                 d->value.func_index >= mod->functions.count) ||
+                (d->kind == DK_EXTERN_FUNCTION &&
+                 d->value.func_index >= mod->extern_functions.count))
+                r->failed = true;
+        }
+    }
+
+    return !r->failed && r->offset == r->size;
+}
+
+// files
+
+static char* cache_path(const char* dir, uint64_t key, const char* suffix) {
+    size_t len = strlen(dir) + 32;
+    char* path = malloc(len);
+    assert(path);
+    snprintf(path, len, "%s/%016llx%s", dir, (unsigned long long)key, suffix);
+    return path;
+}
+
+bool cache_load_module(const char* dir, uint64_t key, Module* out) {
+    char* path = cache_path(dir, key, ".num");
+    FILE* file = fopen(path, "rb");
+    free(path);
+    if (!file) return false;
+
+    ByteBuffer bb = {0};
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        for (size_t i = 0; i < n; i++) da_append(bb, chunk[i]);
+    }
+    fclose(file);
+
+    bool ok = bb.count >= 8;
+    if (ok) {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < 8; i++)
+            sum |= (uint64_t)bb.items[bb.count - 8 + i] << (i * 8);
+        ok = sum == fnv1a(0xcbf29ce484222325ULL, bb.items, bb.count - 8);
+    }
+
+    Module mod = {0};
+    CacheReader r = {
+        .data = bb.items,
+        .size = ok ? bb.count - 8 : 0,
+        .mod = &mod,
+    };
+    ok = ok && read_module(&r, &mod);
+    free(bb.items);
+
+    if (!ok) {
+        module_free(&mod);
+        fprintf(stderr, "WARN: Ignoring corrupted cache entry %016llx\n",
+                (unsigned long long)key);
+        return false;
+    }
+
+    *out = mod;
+    return true;
+}
+
+bool cache_store_module(const char* dir, uint64_t key, Module* mod) {
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create cache dir `%s`: %s\n", dir,
+                strerror(errno));
+        return false;
+    }
+
+    ByteBuffer bb = {0};
+    write_module(&bb, mod);
+
+    // written to a temporary file first, so concurrent compilations never
+    // see a partial entry
+    char* path = cache_path(dir, key, ".num");
+    char* tmp_path = cache_path(dir, key, ".tmp");
+    bool ok = false;
+    FILE* file = fopen(tmp_path, "wb");
+    if (file) {
+        ok = fwrite(bb.items, 1, bb.count, file) == bb.count;
+        ok = fclose(file) == 0 && ok;
+        ok = ok && rename(tmp_path, path) == 0;
+        if (!ok) unlink(tmp_path);
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to write cache entry `%s`: %s\n", path,
+                strerror(errno));
+    }
+
+    free(bb.items);
+    free(path);
+    free(tmp_path);
+    return ok;
+}
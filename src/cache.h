@@ -0,0 +1,24 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parse.h"
+
+// parsed modules are cached in `<cache dir>/<key>.num`, key is a hash of
+// the source, parse options and compiler version
+
+// Makefile sets it to hash of compiler sources, other builds share cached
+// modules as long as CACHE_FORMAT_VERSION matches
+#ifndef NOU_VERSION
+#define NOU_VERSION "dev"
+#endif
+
+uint64_t cache_key(const char* source, size_t size, ParseOptions options);
+
+bool cache_load_module(const char* dir, uint64_t key, Module* out);
+bool cache_store_module(const char* dir, uint64_t key, Module* mod);
+
+#endif
@@ -1,11 +1,15 @@
 #include "codegen.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "diag.h"
+#include "stats.h"
+
 typedef enum {
     SID_CUSTOM,
     SID_TYPE,
@@ -24,8 +28,15 @@ typedef enum {
 
 typedef enum {
     GLOBAL_STACK_PTR,
+    GLOBAL_HEAP_BASE,
+    GLOBAL_STACK_END,
+    GLOBAL_HEAP_TOP,  // only with allocator
 } BuiltinGlobals;
 
+#define DEFAULT_STACK_SIZE (64 * 1024)
+#define DEFAULT_PAGES 2
+#define MAX_PAGES 65536  // 4 GiB, all of memory addressed by i32
+
 typedef struct {
     SectionId id;
     ByteBuffer content;
@@ -36,31 +47,48 @@ typedef struct {
     ByteBuffer content;
 } Vec;
 
-typedef struct {
-    ByteBuffer output_buffer;
-} Generator;
-
 typedef struct ExprDecision {
     bool take_reference;
     ValueType left_type;
     ValueType right_type;
     size_t dependency;
+    uint8_t lane;  // lane immediate of SIMD intrinsics
+    uint32_t offset;  // of struct field, in memarg of its store
+    bool fold_offset;  // offset of field is left to the store
+    bool soa_item;  // item of soa slice, leaves slice and index on stack
+    struct ExprDecisions* arms;  // of conditional, owned
 } ExprDecision;
 
-typedef struct {
+typedef struct ExprDecisions {
     da_list(ExprDecision);
 } ExprDecisions;
 
-static Decl* find_global_decl(Module* mod, const char* name) {
-    DeclScope* s = &mod->scopes.items[0];
-
-    for (size_t i = 0; i < s->count; i++) {
-        if (strcmp(name, s->items[i].name) == 0) {
-            return &s->items[i];
+static void free_expression_decisions(ExprDecisions* decisions) {
+    for (size_t i = 0; i < decisions->count; i++) {
+        ExprDecisions* arms = decisions->items[i].arms;
+        if (!arms) continue;
+        for (size_t j = 0; j < 3; j++) {
+            free_expression_decisions(&arms[j]);
         }
+        free(arms);
     }
+    free(decisions->items);
+}
 
-    return NULL;
+static ValueType u8_type = {
+    .kind = VT_INT,
+    .props.i.bits = 8,
+    .props.i.unsign = true,
+};
+
+static ValueType u32_type = {
+    .kind = VT_INT,
+    .props.i.bits = 32,
+    .props.i.unsign = true,
+};
+
+static Decl* find_global_decl(Module* mod, const char* name) {
+    return scope_find_decl(&mod->scopes.items[0], name);
 }
 
 static void bb_append_bytes(ByteBuffer* bb, uint8_t* bytes, size_t count) {
@@ -83,6 +111,18 @@ static void bb_append_leb128_u(ByteBuffer* bb, uint64_t x) {
     da_append(*bb, 0);
 }
 
+static void bb_append_leb128_s(ByteBuffer* bb, int64_t x) {
+    while (true) {
+        uint8_t byte = (x & 0x7F);
+        x >>= 7;  // arithmetic shift keeps the sign
+        if ((x == 0 && !(byte & 0x40)) || (x == -1 && (byte & 0x40))) {
+            da_append(*bb, byte);
+            return;
+        }
+        da_append(*bb, byte | 0x80);
+    }
+}
+
 static void bb_append_name(ByteBuffer* bb, char* name) {
     size_t len = strlen(name);
     bb_append_leb128_u(bb, len);
@@ -110,13 +150,17 @@ static void vec_append_elem(Vec* v, ByteBuffer* elem) {
 ByteBuffer codegen_value_type(Module* mod, ValueType vt) {
     switch (vt.kind) {
         case VT_NIL:
-            fprintf(stderr, "Nil value type should not be codegenned\n");
-            exit(1);
+            fprintf(diag_out(), "Nil value type should not be codegenned\n");
+            diag_fail();
             break;
         case VT_INT: {
-            assert(vt.props.i.bits <= 32);
             ByteBuffer bb = {0};
-            da_append(bb, 0x7F);
+            da_append(bb, vt.props.i.bits <= 32 ? 0x7F : 0x7E);
+            return bb;
+        } break;
+        case VT_FLOAT: {
+            ByteBuffer bb = {0};
+            da_append(bb, vt.props.f.bits == 32 ? 0x7D : 0x7C);
             return bb;
         } break;
         case VT_BOOL: {  // bool internally gets codegenned as i32
@@ -129,9 +173,30 @@ ByteBuffer codegen_value_type(Module* mod, ValueType vt) {
             da_append(bb, 0x7E);
             return bb;
         } break;
+        case VT_V128: {
+            ByteBuffer bb = {0};
+            da_append(bb, 0x7B);
+            return bb;
+        } break;
+        case VT_FUNCTION: {  // slot in table
+            ByteBuffer bb = {0};
+            da_append(bb, 0x7F);
+            return bb;
+        } break;
+        case VT_ARRAY:
+            fprintf(diag_out(), "Arrays can only be local variables!\n");
+            diag_fail();
+            break;
+        case VT_STRUCT:
+            fprintf(diag_out(),
+                    "Structs can only be local variables or items of "
+                    "slices!\n");
+            diag_fail();
+            break;
     }
 
     assert(false && "Unreachable");
+    return (ByteBuffer){0};
 }
 
 size_t get_size_of_value_type(Module* mod, ValueType vt) {
@@ -140,12 +205,317 @@ size_t get_size_of_value_type(Module* mod, ValueType vt) {
             return 0;
         case VT_INT:
             return (vt.props.i.bits + 7) / 8;
+        case VT_FLOAT:
+            return vt.props.f.bits / 8;
         case VT_BOOL:
             return 1;
             break;
         case VT_SLICE:
             return 8;
             break;
+        case VT_V128:
+            return 16;
+        case VT_FUNCTION:
+            return 4;
+        case VT_ARRAY:
+            return vt.props.array.len *
+                   get_size_of_value_type(mod, *vt.props.array.inner_type);
+        case VT_STRUCT:
+            return mod->structs.items[vt.props.struct_index].size;
+    }
+
+    assert(false && "Unreachable");
+    return 0;
+}
+
+static size_t align_to(size_t x, size_t align) {
+    return (x + align - 1) / align * align;
+}
+
+static size_t align16(size_t x) { return align_to(x, 16); }
+
+static size_t get_align_of_value_type(Module* mod, ValueType vt) {
+    switch (vt.kind) {
+        case VT_ARRAY:
+            return get_align_of_value_type(mod, *vt.props.array.inner_type);
+        case VT_STRUCT:
+            return mod->structs.items[vt.props.struct_index].align;
+        case VT_NIL:
+            return 1;
+        default:
+            return get_size_of_value_type(mod, vt);
+    }
+}
+
+// offset of value in frame, which starts 16 byte aligned
+static size_t align_frame_offset(Module* mod, size_t offset, ValueType vt) {
+    if (vt.kind == VT_ARRAY) vt = *vt.props.array.inner_type;
+    if (vt.kind == VT_STRUCT)
+        return align_to(offset, get_align_of_value_type(mod, vt));
+    return vt.kind == VT_V128 ? align16(offset) : offset;
+}
+
+// fields of structs are aligned to their size, fields of soa structs follow
+// each other, so in a slice each starts after `len` items of the previous
+// ones
+static void compute_struct_layouts(Module* mod) {
+    for (size_t i = 0; i < mod->structs.count; i++) {
+        StructType* s = &mod->structs.items[i];
+        s->size = 0;
+        s->align = 1;
+        for (size_t j = 0; j < s->count; j++) {
+            StructField* field = &s->items[j];
+            // structs only contain structs declared before them
+            if (field->vt.kind == VT_STRUCT &&
+                field->vt.props.struct_index >= i) {
+                fprintf(diag_out(), "Struct `%s` can't contain itself!\n",
+                        s->name);
+                diag_fail();
+            }
+            size_t align = get_align_of_value_type(mod, field->vt);
+            if (!s->soa) s->size = align_to(s->size, align);
+            if (align > s->align) s->align = align;
+            field->offset = s->size;
+            s->size += get_size_of_value_type(mod, field->vt);
+        }
+        if (!s->soa) s->size = align_to(s->size, s->align);
+    }
+}
+
+static bool is_soa_slice(Module* mod, ValueType vt) {
+    if (vt.kind != VT_SLICE || vt.props.inner_type->kind != VT_STRUCT)
+        return false;
+    return mod->structs.items[vt.props.inner_type->props.struct_index].soa;
+}
+
+// builtins, functions provided by runtime which is emitted into module when
+// they are called, declarations with the same name shadow them
+
+typedef enum {
+    // implemented by runtime functions
+    BUILTIN_ALLOC,
+    BUILTIN_FREE,
+    BUILTIN_FIND,
+    BUILTIN_EQUAL,
+    BUILTIN_SUM,
+    BUILTIN_COUNT_BYTE,
+    // lowered to instructions at the call site
+    BUILTIN_COPY,
+    BUILTIN_FILL,
+    BUILTIN_ZERO,
+    BUILTIN_COUNT,
+} Builtin;
+
+#define RUNTIME_BUILTINS (BUILTIN_COUNT_BYTE + 1)
+
+// slice param without inner type accepts slices of any type
+typedef struct {
+    const char* name;
+    size_t arity;
+    ValueType params[3];
+    ValueType return_type;
+} BuiltinSignature;
+
+static BuiltinSignature builtins[BUILTIN_COUNT] = {
+    [BUILTIN_ALLOC] =
+        {
+            .name = "alloc",
+            .arity = 1,
+            .params = {{.kind = VT_INT, .props.i = {.bits = 32, .unsign = 1}}},
+            .return_type = {.kind = VT_SLICE, .props.inner_type = &u8_type},
+        },
+    [BUILTIN_FREE] =
+        {
+            .name = "free",
+            .arity = 1,
+            .params = {{.kind = VT_SLICE, .props.inner_type = &u8_type}},
+            .return_type = {.kind = VT_NIL},
+        },
+    [BUILTIN_FIND] =
+        {
+            .name = "find",
+            .arity = 2,
+            .params = {{.kind = VT_SLICE, .props.inner_type = &u8_type},
+                       {.kind = VT_INT, .props.i = {.bits = 8, .unsign = 1}}},
+            .return_type = {.kind = VT_INT,
+                            .props.i = {.bits = 32, .unsign = 1}},
+        },
+    [BUILTIN_EQUAL] =
+        {
+            .name = "equal",
+            .arity = 2,
+            .params = {{.kind = VT_SLICE, .props.inner_type = &u8_type},
+                       {.kind = VT_SLICE, .props.inner_type = &u8_type}},
+            .return_type = {.kind = VT_BOOL},
+        },
+    [BUILTIN_SUM] =
+        {
+            .name = "sum",
+            .arity = 1,
+            .params = {{.kind = VT_SLICE, .props.inner_type = &u32_type}},
+            .return_type = {.kind = VT_INT,
+                            .props.i = {.bits = 32, .unsign = 1}},
+        },
+    [BUILTIN_COUNT_BYTE] =
+        {
+            .name = "count",
+            .arity = 2,
+            .params = {{.kind = VT_SLICE, .props.inner_type = &u8_type},
+                       {.kind = VT_INT, .props.i = {.bits = 8, .unsign = 1}}},
+            .return_type = {.kind = VT_INT,
+                            .props.i = {.bits = 32, .unsign = 1}},
+        },
+    [BUILTIN_COPY] =
+        {
+            .name = "copy",
+            .arity = 2,
+            .params = {{.kind = VT_SLICE}, {.kind = VT_SLICE}},
+            .return_type = {.kind = VT_NIL},
+        },
+    [BUILTIN_FILL] =
+        {
+            .name = "fill",
+            .arity = 2,
+            .params = {{.kind = VT_SLICE, .props.inner_type = &u8_type},
+                       {.kind = VT_INT, .props.i = {.bits = 8, .unsign = 1}}},
+            .return_type = {.kind = VT_NIL},
+        },
+    [BUILTIN_ZERO] =
+        {
+            .name = "zero",
+            .arity = 1,
+            .params = {{.kind = VT_SLICE}},
+            .return_type = {.kind = VT_NIL},
+        },
+};
+
+static bool builtin_accepts(ValueType param, ValueType arg) {
+    if (param.kind == VT_SLICE && !param.props.inner_type)
+        return arg.kind == VT_SLICE;
+    return compare_value_types(param, arg);
+}
+
+static bool builtin_args_match(BuiltinSignature* sig, ValueType* args) {
+    for (size_t j = 0; j < sig->arity; j++) {
+        if (!builtin_accepts(sig->params[j], args[j])) return false;
+    }
+    return true;
+}
+
+static bool find_builtin(const char* name, Builtin* out) {
+    for (Builtin b = 0; b < BUILTIN_COUNT; b++) {
+        if (strcmp(builtins[b].name, name) == 0) {
+            if (out) *out = b;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool builtin_used(Module* mod, Builtin b) {
+    return mod->used_builtins & (1u << b);
+}
+
+static bool uses_allocator(Module* mod) {
+    return builtin_used(mod, BUILTIN_ALLOC) || builtin_used(mod, BUILTIN_FREE);
+}
+
+// runtime functions of called builtins follow functions of the module, their
+// types follow its function types
+static size_t builtin_rank(Module* mod, Builtin b) {
+    size_t rank = 0;
+    for (Builtin other = 0; other < b; other++) {
+        if (builtin_used(mod, other)) rank++;
+    }
+    return rank;
+}
+
+static size_t builtin_fn_index(Module* mod, Builtin b) {
+    return mod->extern_functions.count + mod->functions.count +
+           builtin_rank(mod, b);
+}
+
+static size_t builtin_type_index(Module* mod, Builtin b) {
+    return mod->function_types.count + builtin_rank(mod, b);
+}
+
+// SIMD intrinsics, shadowed by declarations like builtins, each is lowered
+// to one instruction, lanes are named by the intrinsic
+
+typedef enum {
+    INTRINSIC_PLAIN,    // instruction follows arguments
+    INTRINSIC_EXTRACT,  // (v, lane), lane is an immediate
+    INTRINSIC_REPLACE,  // (v, lane, x), lane is an immediate
+    INTRINSIC_LOAD,     // (s, offset), loads from s.ptr + offset
+    INTRINSIC_STORE,    // (s, offset, v), stores to s.ptr + offset
+} IntrinsicKind;
+
+typedef struct {
+    BuiltinSignature sig;
+    IntrinsicKind kind;
+    uint32_t opcode;  // follows SIMD prefix
+    uint8_t lanes;    // for lane immediates
+} Intrinsic;
+
+#define T_V128 {.kind = VT_V128}
+#define T_BOOL {.kind = VT_BOOL}
+#define T_U8 {.kind = VT_INT, .props.i = {.bits = 8, .unsign = 1}}
+#define T_I32 {.kind = VT_INT, .props.i = {.bits = 32}}
+#define T_U32 {.kind = VT_INT, .props.i = {.bits = 32, .unsign = 1}}
+#define T_U8_SLICE {.kind = VT_SLICE, .props.inner_type = &u8_type}
+#define V128_BINARY(name, op) \
+    {{name, 2, {T_V128, T_V128}, T_V128}, INTRINSIC_PLAIN, op}
+
+static Intrinsic intrinsics[] = {
+    {{"i8x16_splat", 1, {T_U8}, T_V128}, INTRINSIC_PLAIN, 0x0F},
+    {{"i32x4_splat", 1, {T_I32}, T_V128}, INTRINSIC_PLAIN, 0x11},
+    {{"i8x16_extract_lane", 2, {T_V128, T_I32}, T_U8},
+     INTRINSIC_EXTRACT, 0x16, 16},
+    {{"i32x4_extract_lane", 2, {T_V128, T_I32}, T_I32},
+     INTRINSIC_EXTRACT, 0x1B, 4},
+    {{"i8x16_replace_lane", 3, {T_V128, T_I32, T_U8}, T_V128},
+     INTRINSIC_REPLACE, 0x17, 16},
+    {{"i32x4_replace_lane", 3, {T_V128, T_I32, T_I32}, T_V128},
+     INTRINSIC_REPLACE, 0x1C, 4},
+    V128_BINARY("i8x16_add", 0x6E),
+    V128_BINARY("i8x16_sub", 0x71),
+    V128_BINARY("i32x4_add", 0xAE),
+    V128_BINARY("i32x4_sub", 0xB1),
+    V128_BINARY("i32x4_mul", 0xB5),
+    V128_BINARY("i8x16_eq", 0x23),
+    V128_BINARY("i8x16_lt_u", 0x26),
+    V128_BINARY("i8x16_gt_u", 0x28),
+    V128_BINARY("i32x4_eq", 0x37),
+    V128_BINARY("i32x4_lt_s", 0x39),
+    V128_BINARY("i32x4_gt_s", 0x3B),
+    // picks bytes of first vector by indices in the second one
+    V128_BINARY("i8x16_swizzle", 0x0E),
+    V128_BINARY("v128_and", 0x4E),
+    V128_BINARY("v128_or", 0x50),
+    V128_BINARY("v128_xor", 0x51),
+    {{"v128_not", 1, {T_V128}, T_V128}, INTRINSIC_PLAIN, 0x4D},
+    {{"v128_any_true", 1, {T_V128}, T_BOOL}, INTRINSIC_PLAIN, 0x53},
+    {{"i8x16_bitmask", 1, {T_V128}, T_U32}, INTRINSIC_PLAIN, 0x64},
+    {{"i32x4_bitmask", 1, {T_V128}, T_U32}, INTRINSIC_PLAIN, 0xA4},
+    {{"v128_load", 2, {T_U8_SLICE, T_U32}, T_V128}, INTRINSIC_LOAD, 0x00},
+    {{"v128_store", 3, {T_U8_SLICE, T_U32, T_V128}, {.kind = VT_NIL}},
+     INTRINSIC_STORE, 0x0B},
+};
+
+static Intrinsic* find_intrinsic(const char* name) {
+    for (size_t i = 0; i < sizeof(intrinsics) / sizeof(*intrinsics); i++) {
+        if (strcmp(intrinsics[i].sig.name, name) == 0) return &intrinsics[i];
+    }
+    return NULL;
+}
+
+static void bb_append_simd_op(ByteBuffer* bb, uint32_t opcode) {
+    da_append(*bb, 0xFD);  // SIMD prefix
+    if (opcode < 0x80) {
+        da_append(*bb, opcode);
+    } else {
+        da_append(*bb, (opcode & 0x7F) | 0x80);
+        da_append(*bb, opcode >> 7);
     }
 }
 
@@ -161,17 +531,31 @@ bool find_local_var(Module* mod, size_t scope, char* name, size_t* out_index,
             return true;
     }
 
+    // without variables, scope adds nothing to index of variables declared
+    // after it, so it doesn't have to be scanned
+    Decl* found = scope_find_decl(s, name);
+    if (!found && (!out_index || (s->index.indexed == s->count &&
+                                  s->index.variables == 0))) {
+        return false;
+    }
+
     size_t param_index = 0;
     for (size_t i = 0; i < s->count; i++) {
         Decl* decl = &s->items[i];
-        if (strcmp(decl->name, name) == 0) {
+        if (decl == found) {
             if (decl->kind == DK_PARAM && out_index) *out_index = param_index;
+            if (decl->kind == DK_VARIABLE && out_index)
+                *out_index =
+                    align_frame_offset(mod, *out_index, decl->value.vt);
             if (out_decl) *out_decl = decl;
             return true;
         }
         if (decl->kind == DK_PARAM) param_index++;
-        if (out_index && decl->kind == DK_VARIABLE)
-            *out_index += get_size_of_value_type(mod, decl->value.vt);
+        if (out_index && decl->kind == DK_VARIABLE) {
+            *out_index =
+                align_frame_offset(mod, *out_index, decl->value.vt) +
+                get_size_of_value_type(mod, decl->value.vt);
+        }
     }
 
     return false;
@@ -184,26 +568,35 @@ bool find_local_fn(Module* mod, size_t scope, char* name, size_t* out_index) {
         if (find_local_fn(mod, s->parent, name, out_index)) return true;
     }
 
-    for (size_t i = 0; i < s->count; i++) {
-        Decl* decl = &s->items[i];
-        if (strcmp(decl->name, name) == 0) {
-            if (decl->kind == DK_FUNCTION) {
-                if (out_index)
-                    *out_index =
-                        decl->value.func_index + mod->extern_functions.count;
-                return true;
-            }
-            if (decl->kind == DK_EXTERN_FUNCTION) {
-                if (out_index) *out_index = decl->value.func_index;
-                return true;
-            }
-            return false;
-        }
+    Decl* decl = scope_find_decl(s, name);
+    if (!decl) return false;
+    if (decl->kind == DK_FUNCTION) {
+        if (out_index)
+            *out_index = decl->value.func_index + mod->extern_functions.count;
+        return true;
+    }
+    if (decl->kind == DK_EXTERN_FUNCTION) {
+        if (out_index) *out_index = decl->value.func_index;
+        return true;
     }
-
     return false;
 }
 
+static Function* decl_function(Module* mod, Decl* decl) {
+    if (decl->kind == DK_EXTERN_FUNCTION)
+        return &mod->extern_functions.items[decl->value.func_index];
+    assert(decl->kind == DK_FUNCTION);
+    return &mod->functions.items[decl->value.func_index];
+}
+
+// param or variable holding function value, calls of which are indirect
+static Decl* find_function_value(Module* mod, size_t scope, char* name) {
+    Decl* decl = find_decl(mod, scope, name);
+    if (!decl || (decl->kind != DK_PARAM && decl->kind != DK_VARIABLE))
+        return NULL;
+    return decl->value.vt.kind == VT_FUNCTION ? decl : NULL;
+}
+
 bool calc_local_frame_size(Module* mod, size_t scope, size_t* out_size) {
     if (out_size) *out_size = 0;
     DeclScope* s = &mod->scopes.items[scope];
@@ -218,9 +611,9 @@ bool calc_local_frame_size(Module* mod, size_t scope, size_t* out_size) {
 
     for (size_t i = 0; i < s->count; i++) {
         Decl* decl = &s->items[i];
-        if (decl->kind == DK_VARIABLE) {
-            if (out_size)
-                *out_size += get_size_of_value_type(mod, decl->value.vt);
+        if (decl->kind == DK_VARIABLE && out_size) {
+            *out_size = align_frame_offset(mod, *out_size, decl->value.vt) +
+                        get_size_of_value_type(mod, decl->value.vt);
         }
     }
 
@@ -257,6 +650,24 @@ bool find_temp_i64_index(Module* mod, size_t scope, size_t* out_index) {
     return false;
 }
 
+bool find_temp2_i64_index(Module* mod, size_t scope, size_t* out_index) {
+    if (find_temp_i64_index(mod, scope, out_index)) {
+        if (out_index) *out_index += 1;  // asserts that it follows temp_i64
+        return true;
+    }
+    return false;
+}
+
+// only in modules which use v128
+bool find_temp_v128_index(Module* mod, size_t scope, size_t* out_index) {
+    if (!mod->uses_v128) return false;
+    if (find_temp2_i64_index(mod, scope, out_index)) {
+        if (out_index) *out_index += 1;  // asserts that it follows temp2_i64
+        return true;
+    }
+    return false;
+}
+
 void bb_append_applying_bitmask_i32(ByteBuffer* bb, int bits) {
     if (bits < 32) {
         da_append(*bb, 0x41);  // opcode for i32.const
@@ -265,12 +676,79 @@ void bb_append_applying_bitmask_i32(ByteBuffer* bb, int bits) {
     }
 }
 
-bool get_string_constant_offset(Module* mod, size_t index, size_t* offset) {
-    if (index > mod->string_constants.count) return false;
-    if (offset) *offset = 0;
-    for (size_t i = 0; i < index; i++) {
-        if (offset) *offset += mod->string_constants.items[i].len;
+// wasm number types, in order of their columns in the opcode tables
+typedef enum {
+    NUM_I32,
+    NUM_I64,
+    NUM_F32,
+    NUM_F64,
+} NumType;
+
+static bool is_numeric(ValueType vt) {
+    return vt.kind == VT_INT || vt.kind == VT_FLOAT;
+}
+
+static NumType num_type(ValueType vt) {
+    if (vt.kind == VT_FLOAT) return vt.props.f.bits == 32 ? NUM_F32 : NUM_F64;
+    return vt.props.i.bits <= 32 ? NUM_I32 : NUM_I64;
+}
+
+// signed variants for ints, unsigned division and remainder follow them
+static const uint8_t binary_opcodes[][4] = {
+    [OP_ADDITION] = {0x6A, 0x7C, 0x92, 0xA0},
+    [OP_SUBTRACTION] = {0x6B, 0x7D, 0x93, 0xA1},
+    [OP_MULTIPLICATION] = {0x6C, 0x7E, 0x94, 0xA2},
+    [OP_DIVISION] = {0x6D, 0x7F, 0x95, 0xA3},
+    [OP_REMAINDER] = {0x6F, 0x81, 0x00, 0x00},  // no float remainder
+    [OP_EQUALITY] = {0x46, 0x51, 0x5B, 0x61},
+};
+
+static void bb_append_binary_op(ByteBuffer* bb, OperatorKind op,
+                                ValueType vt) {
+    NumType t = num_type(vt);
+    uint8_t opcode = binary_opcodes[op][t];
+    assert(opcode && "Operator is not defined for the type");
+    if ((op == OP_DIVISION || op == OP_REMAINDER) && vt.kind == VT_INT &&
+        vt.props.i.unsign)
+        opcode++;
+    da_append(*bb, opcode);
+    if (op != OP_EQUALITY && t == NUM_I32)
+        bb_append_applying_bitmask_i32(bb, vt.props.i.bits);
+}
+
+static void bb_append_cast(ByteBuffer* bb, ValueType from, ValueType to) {
+    NumType f = num_type(from), t = num_type(to);
+    bool from_unsign = from.kind == VT_INT && from.props.i.unsign;
+    bool to_unsign = to.kind == VT_INT && to.props.i.unsign;
+
+    if (f == NUM_I32 && t == NUM_I64) {
+        // opcode for i64.extend_i32_s or i64.extend_i32_u
+        da_append(*bb, from_unsign ? 0xAD : 0xAC);
+    } else if (f == NUM_I64 && t == NUM_I32) {
+        da_append(*bb, 0xA7);  // opcode for i32.wrap_i64
+    } else if (f <= NUM_I64 && t == NUM_F32) {
+        // opcode for f32.convert_i32_s and its variants
+        da_append(*bb, 0xB2 + (f == NUM_I64) * 2 + from_unsign);
+    } else if (f <= NUM_I64 && t == NUM_F64) {
+        // opcode for f64.convert_i32_s and its variants
+        da_append(*bb, 0xB7 + (f == NUM_I64) * 2 + from_unsign);
+    } else if (f >= NUM_F32 && t <= NUM_I64) {
+        // opcode for i32.trunc_sat_f32_s and its variants, out of range
+        // values saturate instead of trapping
+        da_append(*bb, 0xFC);
+        da_append(*bb, (t == NUM_I64) * 4 + (f == NUM_F64) * 2 + to_unsign);
+    } else if (f == NUM_F64 && t == NUM_F32) {
+        da_append(*bb, 0xB6);  // opcode for f32.demote_f64
+    } else if (f == NUM_F32 && t == NUM_F64) {
+        da_append(*bb, 0xBB);  // opcode for f64.promote_f32
     }
+
+    if (t == NUM_I32) bb_append_applying_bitmask_i32(bb, to.props.i.bits);
+}
+
+bool get_string_constant_offset(Module* mod, size_t index, size_t* offset) {
+    if (index >= mod->string_constants.count) return false;
+    if (offset) *offset = mod->string_constants.items[index].offset;
     return true;
 }
 
@@ -293,14 +771,25 @@ bool bb_append_loading_value(ByteBuffer* e, Module* mod, ValueType vt,
                     bb_append_leb128_u(e,
                                        offset);  // offset
                     break;
+                case 64:
+                    da_append(*e, 0x29);            // opcode for i64.load
+                    bb_append_leb128_u(e, 0);       // align
+                    bb_append_leb128_u(e, offset);  // offset
+                    break;
                 default:
-                    fprintf(stderr,
+                    fprintf(diag_out(),
                             "%d-bit integers are not "
                             "supported!\n",
                             vt.props.i.bits);
                     return false;
             }
             break;
+        case VT_FLOAT:
+            // opcode for f32.load or f64.load
+            da_append(*e, vt.props.f.bits == 32 ? 0x2A : 0x2B);
+            bb_append_leb128_u(e, 0);       // align
+            bb_append_leb128_u(e, offset);  // offset
+            break;
         case VT_BOOL:
             da_append(*e, 0x2D);            // opcode for i32.load8_u
             bb_append_leb128_u(e, 0);       // align
@@ -311,13 +800,334 @@ bool bb_append_loading_value(ByteBuffer* e, Module* mod, ValueType vt,
             bb_append_leb128_u(e, 0);       // align
             bb_append_leb128_u(e, offset);  // offset
             break;
+        case VT_V128:
+            bb_append_simd_op(e, 0x00);     // opcode for v128.load
+            bb_append_leb128_u(e, 0);       // align
+            bb_append_leb128_u(e, offset);  // offset
+            break;
+        case VT_FUNCTION:
+            da_append(*e, 0x28);            // opcode for i32.load
+            bb_append_leb128_u(e, 0);       // align
+            bb_append_leb128_u(e, offset);  // offset
+            break;
+        case VT_STRUCT:  // value of struct is its address
+            if (offset) {
+                da_append(*e, 0x41);  // opcode for i32.const
+                bb_append_leb128_u(e, offset);
+                da_append(*e, 0x6A);  // opcode for i32.add
+            }
+            break;
         default:
-            fprintf(stderr, "Unsupported variable type!\n");
+            fprintf(diag_out(), "Unsupported variable type!\n");
             return false;
     }
     return true;
 }
 
+// appends length of slice in local in bytes
+static void bb_append_slice_bytes(ByteBuffer* e, size_t local,
+                                  size_t size_of_item) {
+    da_append(*e, 0x20);  // opcode for local.get
+    bb_append_leb128_u(e, local);
+    da_append(*e, 0x42);  // opcode for i64.const
+    bb_append_leb128_u(e, 32);
+    da_append(*e, 0x88);  // opcode for i64.shr_u
+    da_append(*e, 0xA7);  // opcode for i32.wrap_i64
+    if (size_of_item != 1) {
+        da_append(*e, 0x41);  // opcode for i32.const
+        bb_append_leb128_u(e, size_of_item);
+        da_append(*e, 0x6C);  // opcode for i32.mul
+    }
+}
+
+// traps when condition on the stack is true
+static void bb_append_trap_if(ByteBuffer* e) {
+    da_append(*e, 0x04);  // opcode for if
+    da_append(*e, 0x40);  // empty block type
+    da_append(*e, 0x00);  // opcode for unreachable
+    da_append(*e, 0x0B);  // opcode for end
+}
+
+// builds subslice in registers from slice, start and end (unless to_end) on
+// the stack
+static bool bb_append_subslice(ByteBuffer* e, Module* mod,
+                               ValueType slice_type, bool to_end,
+                               size_t scope) {
+    size_t end, start, slice;
+    if (!find_temp_i32_index(mod, scope, &end) ||
+        !find_temp_i64_index(mod, scope, &slice) ||
+        !find_temp2_i64_index(mod, scope, &start))
+        return false;
+    size_t size_of_item =
+        get_size_of_value_type(mod, *slice_type.props.inner_type);
+
+    if (!to_end) {
+        da_append(*e, 0x21);  // opcode for local.set
+        bb_append_leb128_u(e, end);
+    }
+    da_append(*e, 0xAD);  // opcode for i64.extend_i32_u
+    da_append(*e, 0x21);  // opcode for local.set
+    bb_append_leb128_u(e, start);
+    da_append(*e, 0x21);  // opcode for local.set
+    bb_append_leb128_u(e, slice);
+    if (to_end) {
+        bb_append_slice_bytes(e, slice, 1);
+        da_append(*e, 0x21);  // opcode for local.set
+        bb_append_leb128_u(e, end);
+    }
+
+    if (mod->bounds_checks) {  // start > end or end > len
+        da_append(*e, 0x20);  // opcode for local.get
+        bb_append_leb128_u(e, start);
+        da_append(*e, 0xA7);  // opcode for i32.wrap_i64
+        da_append(*e, 0x20);  // opcode for local.get
+        bb_append_leb128_u(e, end);
+        da_append(*e, 0x4B);  // opcode for i32.gt_u
+        da_append(*e, 0x20);  // opcode for local.get
+        bb_append_leb128_u(e, end);
+        bb_append_slice_bytes(e, slice, 1);
+        da_append(*e, 0x4B);  // opcode for i32.gt_u
+        da_append(*e, 0x72);  // opcode for i32.or
+        bb_append_trap_if(e);
+    }
+
+    // len = end - start
+    da_append(*e, 0x20);  // opcode for local.get
+    bb_append_leb128_u(e, end);
+    da_append(*e, 0x20);  // opcode for local.get
+    bb_append_leb128_u(e, start);
+    da_append(*e, 0xA7);  // opcode for i32.wrap_i64
+    da_append(*e, 0x6B);  // opcode for i32.sub
+    da_append(*e, 0xAD);  // opcode for i64.extend_i32_u
+    da_append(*e, 0x42);  // opcode for i64.const
+    bb_append_leb128_u(e, 32);
+    da_append(*e, 0x86);  // opcode for i64.shl
+
+    // ptr = ptr + start * size_of_item
+    da_append(*e, 0x20);  // opcode for local.get
+    bb_append_leb128_u(e, slice);
+    da_append(*e, 0xA7);  // opcode for i32.wrap_i64
+    da_append(*e, 0x20);  // opcode for local.get
+    bb_append_leb128_u(e, start);
+    da_append(*e, 0xA7);  // opcode for i32.wrap_i64
+    if (size_of_item != 1) {
+        da_append(*e, 0x41);  // opcode for i32.const
+        bb_append_leb128_u(e, size_of_item);
+        da_append(*e, 0x6C);  // opcode for i32.mul
+    }
+    da_append(*e, 0x6A);  // opcode for i32.add
+    da_append(*e, 0xAD);  // opcode for i64.extend_i32_u
+
+    da_append(*e, 0x84);  // opcode for i64.or
+    return true;
+}
+
+// lowers call of builtin to bulk memory instructions, arguments are on the
+// stack and slice_type is type of the first one
+static bool bb_append_inline_builtin(ByteBuffer* e, Module* mod, Builtin b,
+                                     ValueType slice_type, size_t scope) {
+    size_t temp_i32, temp_i64, temp2_i64;
+    if (!find_temp_i32_index(mod, scope, &temp_i32) ||
+        !find_temp_i64_index(mod, scope, &temp_i64) ||
+        !find_temp2_i64_index(mod, scope, &temp2_i64))
+        return false;
+    size_t size_of_item =
+        get_size_of_value_type(mod, *slice_type.props.inner_type);
+
+    switch (b) {
+        case BUILTIN_COPY:
+            // copies as many items as fit, overlapping slices are fine
+            da_append(*e, 0x21);  // opcode for local.set
+            bb_append_leb128_u(e, temp2_i64);
+            da_append(*e, 0x21);  // opcode for local.set
+            bb_append_leb128_u(e, temp_i64);
+
+            da_append(*e, 0x20);  // opcode for local.get
+            bb_append_leb128_u(e, temp_i64);
+            da_append(*e, 0xA7);  // opcode for i32.wrap_i64
+            da_append(*e, 0x20);  // opcode for local.get
+            bb_append_leb128_u(e, temp2_i64);
+            da_append(*e, 0xA7);  // opcode for i32.wrap_i64
+
+            bb_append_slice_bytes(e, temp_i64, size_of_item);
+            bb_append_slice_bytes(e, temp2_i64, size_of_item);
+            bb_append_slice_bytes(e, temp_i64, size_of_item);
+            bb_append_slice_bytes(e, temp2_i64, size_of_item);
+            da_append(*e, 0x49);  // opcode for i32.lt_u
+            da_append(*e, 0x1B);  // opcode for select
+
+            // opcode for memory.copy
+            bb_append_bytes(e, (uint8_t[]){0xFC, 0x0A, 0x00, 0x00}, 4);
+            return true;
+        case BUILTIN_FILL:
+        case BUILTIN_ZERO:
+            if (b == BUILTIN_FILL) {
+                da_append(*e, 0x21);  // opcode for local.set
+                bb_append_leb128_u(e, temp_i32);
+            }
+            da_append(*e, 0x22);  // opcode for local.tee
+            bb_append_leb128_u(e, temp_i64);
+            da_append(*e, 0xA7);  // opcode for i32.wrap_i64
+
+            if (b == BUILTIN_FILL) {
+                da_append(*e, 0x20);  // opcode for local.get
+                bb_append_leb128_u(e, temp_i32);
+            } else {
+                da_append(*e, 0x41);  // opcode for i32.const
+                bb_append_leb128_u(e, 0);
+            }
+
+            bb_append_slice_bytes(e, temp_i64, size_of_item);
+
+            // opcode for memory.fill
+            bb_append_bytes(e, (uint8_t[]){0xFC, 0x0B, 0x00}, 3);
+            return true;
+        case BUILTIN_ALLOC:
+        case BUILTIN_FREE:
+        case BUILTIN_FIND:
+        case BUILTIN_EQUAL:
+        case BUILTIN_SUM:
+        case BUILTIN_COUNT_BYTE:
+        case BUILTIN_COUNT:
+            break;
+    }
+
+    assert(false && "Unreachable");
+    return false;
+}
+
+// traps unless 16 bytes at offset in local fit in slice on the stack, which
+// is kept there, sum is computed in i64 so it can't wrap
+static bool bb_append_v128_bounds_check(ByteBuffer* e, Module* mod,
+                                        size_t offset, size_t scope) {
+    size_t slice;
+    if (!find_temp_i64_index(mod, scope, &slice)) return false;
+    da_append(*e, 0x22);  // opcode for local.tee
+    bb_append_leb128_u(e, slice);
+    da_append(*e, 0x20);  // opcode for local.get
+    bb_append_leb128_u(e, offset);
+    da_append(*e, 0xAD);  // opcode for i64.extend_i32_u
+    da_append(*e, 0x42);  // opcode for i64.const
+    bb_append_leb128_s(e, 16);
+    da_append(*e, 0x7C);  // opcode for i64.add
+    da_append(*e, 0x20);  // opcode for local.get
+    bb_append_leb128_u(e, slice);
+    da_append(*e, 0x42);  // opcode for i64.const
+    bb_append_leb128_s(e, 32);
+    da_append(*e, 0x88);  // opcode for i64.shr_u
+    da_append(*e, 0x56);  // opcode for i64.gt_u
+    bb_append_trap_if(e);
+    return true;
+}
+
+// lowers call of SIMD intrinsic, arguments are on the stack and constant
+// lane argument is dropped in favour of the immediate
+static bool bb_append_intrinsic(ByteBuffer* e, Module* mod,
+                                Intrinsic* intrinsic, uint8_t lane,
+                                size_t scope) {
+    size_t temp_i32;
+    if (!find_temp_i32_index(mod, scope, &temp_i32)) return false;
+
+    switch (intrinsic->kind) {
+        case INTRINSIC_PLAIN:
+            bb_append_simd_op(e, intrinsic->opcode);
+            return true;
+        case INTRINSIC_EXTRACT:
+            da_append(*e, 0x1A);  // opcode for drop
+            bb_append_simd_op(e, intrinsic->opcode);
+            da_append(*e, lane);
+            return true;
+        case INTRINSIC_REPLACE:
+            da_append(*e, 0x21);  // opcode for local.set
+            bb_append_leb128_u(e, temp_i32);
+            da_append(*e, 0x1A);  // opcode for drop
+            da_append(*e, 0x20);  // opcode for local.get
+            bb_append_leb128_u(e, temp_i32);
+            bb_append_simd_op(e, intrinsic->opcode);
+            da_append(*e, lane);
+            return true;
+        case INTRINSIC_LOAD:
+            da_append(*e, 0x21);  // opcode for local.set
+            bb_append_leb128_u(e, temp_i32);
+            if (mod->bounds_checks &&
+                !bb_append_v128_bounds_check(e, mod, temp_i32, scope))
+                return false;
+            da_append(*e, 0xA7);  // opcode for i32.wrap_i64
+            da_append(*e, 0x20);  // opcode for local.get
+            bb_append_leb128_u(e, temp_i32);
+            da_append(*e, 0x6A);  // opcode for i32.add
+            bb_append_simd_op(e, intrinsic->opcode);
+            bb_append_leb128_u(e, 0);  // align
+            bb_append_leb128_u(e, 0);  // offset
+            return true;
+        case INTRINSIC_STORE: {
+            size_t temp_v128;
+            if (!find_temp_v128_index(mod, scope, &temp_v128)) return false;
+            da_append(*e, 0x21);  // opcode for local.set
+            bb_append_leb128_u(e, temp_v128);
+            da_append(*e, 0x21);  // opcode for local.set
+            bb_append_leb128_u(e, temp_i32);
+            if (mod->bounds_checks &&
+                !bb_append_v128_bounds_check(e, mod, temp_i32, scope))
+                return false;
+            da_append(*e, 0xA7);  // opcode for i32.wrap_i64
+            da_append(*e, 0x20);  // opcode for local.get
+            bb_append_leb128_u(e, temp_i32);
+            da_append(*e, 0x6A);  // opcode for i32.add
+            da_append(*e, 0x20);  // opcode for local.get
+            bb_append_leb128_u(e, temp_v128);
+            bb_append_simd_op(e, intrinsic->opcode);
+            bb_append_leb128_u(e, 0);  // align
+            bb_append_leb128_u(e, 0);  // offset
+            return true;
+        }
+    }
+
+    assert(false && "Unreachable");
+    return false;
+}
+
+static ByteBuffer codegen_decided_expression(Module* mod, Expression* expr,
+                                            ExprDecisions decisions,
+                                            size_t scope);
+
+// arms of conditional are evaluated both and selected from, when they are
+// this short and can't trap or have side effects
+#define SELECT_MAX_ARM_NODES 5
+
+static bool is_cheap_pure_arm(Expression* arm) {
+    if (arm->count > SELECT_MAX_ARM_NODES) return false;
+    for (size_t i = 0; i < arm->count; i++) {
+        Expr* e = &arm->items[i];
+        switch (e->kind) {
+            case EK_INT_CONST:
+            case EK_FLOAT_CONST:
+            case EK_BOOL_CONST:
+            case EK_STRING_CONST:
+            case EK_VAR:
+            case EK_FIELD_ACCESS:
+            case EK_CASTING:  // float to int conversions saturate
+                break;
+            case EK_OPERATOR:
+                switch (e->props.op) {
+                    case OP_ADDITION:
+                    case OP_SUBTRACTION:
+                    case OP_MULTIPLICATION:
+                    case OP_EQUALITY:
+                    case OP_ALTERNATIVE:
+                    case OP_CONJUNCTION:
+                        break;
+                    default:  // division traps, indexing may trap
+                        return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
 ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
                         ExprDecisions decisions, size_t scope) {
     ByteBuffer e = {0};
@@ -329,16 +1139,40 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
                 case 8:
                 case 32:
                     da_append(e, 0x41);  // opcode for i32.const
-                    bb_append_leb128_u(
-                        &e,
-                        ex->props.i.value);  // TODO make it signed
+                    bb_append_leb128_s(&e, (int32_t)ex->props.i.value);
+                    break;
+                case 64:
+                    da_append(e, 0x42);  // opcode for i64.const
+                    bb_append_leb128_s(&e, ex->props.i.value);
                     break;
                 default:
-                    fprintf(stderr, "%d-bit integers are not supported!\n",
+                    fprintf(diag_out(), "%d-bit integers are not supported!\n",
                             ex->props.i.bits);
                     assert(false && "Unsupported int size");
             }
             break;
+        case EK_FLOAT_CONST: {
+            assert(!decision.take_reference &&
+                   "Cannot take reference to a constant");
+            // immediates are little endian IEEE 754 bits
+            uint64_t bits;
+            size_t size;
+            if (ex->props.f.bits == 32) {
+                float value = ex->props.f.value;
+                uint32_t bits32;
+                memcpy(&bits32, &value, sizeof(bits32));
+                bits = bits32;
+                size = 4;
+                da_append(e, 0x43);  // opcode for f32.const
+            } else {
+                memcpy(&bits, &ex->props.f.value, sizeof(bits));
+                size = 8;
+                da_append(e, 0x44);  // opcode for f64.const
+            }
+            for (size_t i = 0; i < size; i++) {
+                da_append(e, (bits >> (i * 8)) & 0xFF);
+            }
+        } break;
         case EK_BOOL_CONST:
             assert(!decision.take_reference &&
                    "Cannot take reference to a constant");
@@ -349,7 +1183,8 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
             assert(!decision.take_reference &&
                    "Cannot take reference to a constant");
             size_t ptr;
-            assert(get_string_constant_offset(mod, ex->props.str_index, &ptr));
+            diag_check(
+                get_string_constant_offset(mod, ex->props.str_index, &ptr));
             size_t len = mod->string_constants.items[ex->props.str_index].len;
             if (sizeof(size_t) > 4)
                 assert(ptr < (1LL << 32) && len < (1LL << 32));
@@ -363,31 +1198,63 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
             Decl* var_decl;
             if (!find_local_var(mod, scope, ex->props.var, &var_index,
                                 &var_decl)) {
-                fprintf(stderr, "Can't find `%s` used in expr\n",
+                fprintf(diag_out(), "Can't find `%s` used in expr\n",
                         ex->props.var);
-                exit(1);
+                diag_fail();
             }
             switch (var_decl->kind) {
                 case DK_FUNCTION:
-                    assert(false && "Unimplemented");
+                case DK_EXTERN_FUNCTION:  // value is its slot in table
+                    if (decision.take_reference) {
+                        fprintf(diag_out(),
+                                "Function `%s` can't be assigned!\n",
+                                ex->props.var);
+                        diag_fail();
+                    }
+                    da_append(e, 0x41);  // opcode for i32.const
+                    bb_append_leb128_u(
+                        &e, decl_function(mod, var_decl)->table_slot);
                     break;
-                case DK_EXTERN_FUNCTION:
-                    assert(false && "Unimplemented");
+                case DK_STRUCT:
+                    assert(false && "Unreachable");
                     break;
                 case DK_PARAM:
-                    assert(!decision.take_reference &&
-                           "Cannot take reference to a parameter");
+                    if (decision.take_reference) {
+                        fprintf(diag_out(),
+                                "Parameter `%s` can't be assigned!\n",
+                                ex->props.var);
+                        diag_fail();
+                    }
                     da_append(e, 0x20);  // opcode for local.get
                     bb_append_leb128_u(&e, var_index);
                     break;
                 case DK_VARIABLE: {
                     size_t stack_base_index;
-                    if (!find_stack_base_index(mod, scope, &stack_base_index)) {
-                        assert(false &&
-                               "Failed to find stack_base, likely expression "
-                               "is not in a function scope");
-                    }
-                    if (decision.take_reference) {
+                    // fails when expression is not in a function scope
+                    diag_check(
+                        find_stack_base_index(mod, scope, &stack_base_index));
+                    if (var_decl->value.vt.kind == VT_ARRAY) {
+                        if (decision.take_reference) {
+                            fprintf(diag_out(),
+                                    "Array `%s` can't be assigned!\n",
+                                    ex->props.var);
+                            diag_fail();
+                        }
+                        // decays to slice of its items
+                        da_append(e, 0x42);  // opcode for i64.const
+                        uint64_t len = var_decl->value.vt.props.array.len;
+                        bb_append_leb128_s(&e, (int64_t)(len << 32));
+                        da_append(e, 0x20);  // opcode for local.get
+                        bb_append_leb128_u(&e, stack_base_index);
+                        if (var_index) {
+                            da_append(e, 0x41);  // opcode for i32.const
+                            bb_append_leb128_u(&e, var_index);  // offset
+                            da_append(e, 0x6A);  // opcode for i32.add
+                        }
+                        da_append(e, 0xAD);  // opcode for i64.extend_i32_u
+                        da_append(e, 0x84);  // opcode for i64.or
+                    } else if (decision.take_reference ||
+                               var_decl->value.vt.kind == VT_STRUCT) {
                         da_append(e, 0x20);  // opcode for local.get
                         bb_append_leb128_u(&e, stack_base_index);
 
@@ -400,7 +1267,7 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
                         da_append(e, 0x20);  // opcode for local.get
                         bb_append_leb128_u(&e, stack_base_index);
 
-                        assert(bb_append_loading_value(
+                        diag_check(bb_append_loading_value(
                             &e, mod, var_decl->value.vt, var_index));
                     }
                 } break;
@@ -409,97 +1276,77 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
         case EK_OPERATOR: {
             switch (ex->props.op) {
                 case OP_ADDITION:
-                    assert(decision.left_type.kind == VT_INT &&
-                           compare_value_types(decision.left_type,
-                                               decision.right_type));
-                    assert(!decision.take_reference &&
-                           "Cannot take reference to a temporary");
-                    da_append(e, 0x6A);  // opcode for i32.add
-                    bb_append_applying_bitmask_i32(
-                        &e, decision.left_type.props.i.bits);
-                    break;
                 case OP_SUBTRACTION:
-                    assert(decision.left_type.kind == VT_INT &&
-                           compare_value_types(decision.left_type,
-                                               decision.right_type));
-                    assert(!decision.take_reference &&
-                           "Cannot take reference to a temporary");
-                    da_append(e, 0x6B);  // opcode for i32.sub
-                    bb_append_applying_bitmask_i32(
-                        &e, decision.left_type.props.i.bits);
-                    break;
                 case OP_MULTIPLICATION:
-                    assert(decision.left_type.kind == VT_INT &&
-                           compare_value_types(decision.left_type,
-                                               decision.right_type));
-                    assert(!decision.take_reference &&
-                           "Cannot take reference to a temporary");
-                    da_append(e, 0x6C);  // opcode for i32.mul
-                    bb_append_applying_bitmask_i32(
-                        &e, decision.left_type.props.i.bits);
-                    break;
                 case OP_REMAINDER:
-                    assert(decision.left_type.kind == VT_INT &&
-                           compare_value_types(decision.left_type,
-                                               decision.right_type));
-                    assert(!decision.take_reference &&
-                           "Cannot take reference to a temporary");
-                    if (!decision.left_type.props.i.unsign) {
-                        da_append(e, 0x6F);  // opcode for i32.rem_s
-                    } else {
-                        da_append(e, 0x70);  // opcode for i32.rem_u
-                    }
-                    bb_append_applying_bitmask_i32(
-                        &e, decision.left_type.props.i.bits);
-                    break;
                 case OP_DIVISION:
-                    assert(decision.left_type.kind == VT_INT &&
-                           compare_value_types(decision.left_type,
-                                               decision.right_type));
-                    assert(!decision.take_reference &&
-                           "Cannot take reference to a temporary");
-                    if (!decision.left_type.props.i.unsign) {
-                        da_append(e, 0x6D);  // opcode for i32.div_s
-                    } else {
-                        da_append(e, 0x6E);  // opcode for i32.div_u
-                    }
-                    bb_append_applying_bitmask_i32(
-                        &e, decision.left_type.props.i.bits);
-                    break;
                 case OP_EQUALITY:
-                    assert(decision.left_type.kind == VT_INT &&
-                           compare_value_types(decision.left_type,
-                                               decision.right_type));
+                    diag_check(is_numeric(decision.left_type) &&
+                               compare_value_types(decision.left_type,
+                                                   decision.right_type));
                     assert(!decision.take_reference &&
                            "Cannot take reference to a temporary");
-                    da_append(e, 0x46);  // opcode for i32.eq
+                    bb_append_binary_op(&e, ex->props.op,
+                                        decision.left_type);
                     break;
                 case OP_ALTERNATIVE:
-                    assert(decision.left_type.kind == VT_BOOL &&
-                           decision.right_type.kind == VT_BOOL);
+                    diag_check(decision.left_type.kind == VT_BOOL &&
+                               decision.right_type.kind == VT_BOOL);
                     assert(!decision.take_reference &&
                            "Cannot take reference to a temporary");
                     da_append(e, 0x72);  // opcode for i32.or
                     break;
                 case OP_CONJUNCTION:
-                    assert(decision.left_type.kind == VT_BOOL &&
-                           decision.right_type.kind == VT_BOOL);
+                    diag_check(decision.left_type.kind == VT_BOOL &&
+                               decision.right_type.kind == VT_BOOL);
                     assert(!decision.take_reference &&
                            "Cannot take reference to a temporary");
                     da_append(e, 0x71);  // opcode for i32.and
                     break;
                 case OP_INDEXING: {
-                    assert(decision.left_type.kind == VT_SLICE &&
-                           decision.right_type.kind == VT_INT);
+                    diag_check(decision.left_type.kind == VT_SLICE &&
+                               decision.right_type.kind == VT_INT);
 
                     ValueType item_type = *decision.left_type.props.inner_type;
 
                     size_t temp_i32_index;
-                    assert(find_temp_i32_index(mod, scope, &temp_i32_index));
+                    diag_check(
+                        find_temp_i32_index(mod, scope, &temp_i32_index));
 
                     da_append(e, 0x21);  // opcode for local.set
                     bb_append_leb128_u(&e, temp_i32_index);
 
+                    if (decision.soa_item) {  // address depends on field
+                        if (mod->bounds_checks) {
+                            size_t temp_i64_index;
+                            diag_check(find_temp_i64_index(mod, scope,
+                                                           &temp_i64_index));
+                            da_append(e, 0x22);  // opcode for local.tee
+                            bb_append_leb128_u(&e, temp_i64_index);
+                            da_append(e, 0x20);  // opcode for local.get
+                            bb_append_leb128_u(&e, temp_i32_index);
+                            bb_append_slice_bytes(&e, temp_i64_index, 1);
+                            da_append(e, 0x4F);  // opcode for i32.ge_u
+                            bb_append_trap_if(&e);
+                        }
+                        da_append(e, 0x20);  // opcode for local.get
+                        bb_append_leb128_u(&e, temp_i32_index);
+                        break;
+                    }
+
+                    if (mod->bounds_checks) {  // index >= len
+                        size_t temp_i64_index;
+                        diag_check(
+                            find_temp_i64_index(mod, scope, &temp_i64_index));
+                        da_append(e, 0x22);  // opcode for local.tee
+                        bb_append_leb128_u(&e, temp_i64_index);
+                        da_append(e, 0x20);  // opcode for local.get
+                        bb_append_leb128_u(&e, temp_i32_index);
+                        bb_append_slice_bytes(&e, temp_i64_index, 1);
+                        da_append(e, 0x4F);  // opcode for i32.ge_u
+                        bb_append_trap_if(&e);
+                    }
+
                     da_append(e, 0xA7);  // opcode for i32.wrap_i64
 
                     da_append(e, 0x20);  // opcode for local.get
@@ -517,30 +1364,48 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
                     da_append(e, 0x6A);  // opcode for i32.add
 
                     if (!decision.take_reference)
-                        assert(bb_append_loading_value(&e, mod, item_type, 0));
+                        diag_check(
+                            bb_append_loading_value(&e, mod, item_type, 0));
                 } break;
                 case OP_ASSIGNEMENT: {
-                    if (!compare_value_types(decision.left_type,
-                                             decision.right_type)) {
-                        assert(false && "Non matching types in assignement");
-                    }
+                    diag_check(compare_value_types(decision.left_type,
+                                                   decision.right_type));
 
-                    assert(decision.left_type.kind != VT_INT ||
-                           decision.left_type.props.i.bits <= 32);
                     assert(!decision.take_reference &&
                            "Cannot take reference to a temporary");
 
                     size_t temp_i32_index;
-                    assert(find_temp_i32_index(mod, scope, &temp_i32_index));
+                    diag_check(
+                        find_temp_i32_index(mod, scope, &temp_i32_index));
 
                     size_t temp_i64_index;
-                    assert(find_temp_i64_index(mod, scope, &temp_i64_index));
+                    diag_check(
+                        find_temp_i64_index(mod, scope, &temp_i64_index));
 
                     switch (decision.left_type.kind) {
                         case VT_NIL:
                             assert(false && "Cannot assing to nil value type");
                             break;
+                        case VT_ARRAY:  // arrays decay to slices
+                            assert(false && "Cannot assign to array");
+                            break;
+                        case VT_STRUCT:
+                            assert(false && "Cannot assign to struct");
+                            break;
                         case VT_INT: {
+                            if (decision.left_type.props.i.bits == 64) {
+                                da_append(e, 0x22);  // opcode for local.tee
+                                bb_append_leb128_u(&e, temp_i64_index);
+
+                                da_append(e, 0x37);  // opcode for i64.store
+                                bb_append_leb128_u(&e, 0);
+                                bb_append_leb128_u(&e, decision.offset);
+
+                                da_append(e, 0x20);  // opcode for local.get
+                                bb_append_leb128_u(&e, temp_i64_index);
+                                break;
+                            }
+
                             da_append(e, 0x22);  // opcode for local.tee
                             bb_append_leb128_u(&e, temp_i32_index);
 
@@ -549,16 +1414,16 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
                                     da_append(e,
                                               0x3A);  // opcode for i32.store8
                                     bb_append_leb128_u(&e, 0);
-                                    bb_append_leb128_u(&e, 0);
+                                    bb_append_leb128_u(&e, decision.offset);
                                     break;
                                 case 32:
                                     da_append(e, 0x36);  // opcode for i32.store
                                     bb_append_leb128_u(&e, 0);
-                                    bb_append_leb128_u(&e, 0);
+                                    bb_append_leb128_u(&e, decision.offset);
                                     break;
                                 default:
                                     fprintf(
-                                        stderr,
+                                        diag_out(),
                                         "%d-bit integers are not supported!\n",
                                         decision.left_type.props.i.bits);
                                     assert(false && "Unsupported int size");
@@ -567,13 +1432,46 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
                             da_append(e, 0x20);  // opcode for local.get
                             bb_append_leb128_u(&e, temp_i32_index);
                         } break;
+                        case VT_FLOAT: {
+                            // kept in int temp by reinterpreting its bits
+                            bool f32 = decision.left_type.props.f.bits == 32;
+                            size_t temp = f32 ? temp_i32_index : temp_i64_index;
+
+                            // opcode for i32.reinterpret_f32 or
+                            // i64.reinterpret_f64
+                            da_append(e, f32 ? 0xBC : 0xBD);
+                            da_append(e, 0x22);  // opcode for local.tee
+                            bb_append_leb128_u(&e, temp);
+
+                            // opcode for i32.store or i64.store
+                            da_append(e, f32 ? 0x36 : 0x37);
+                            bb_append_leb128_u(&e, 0);
+                            bb_append_leb128_u(&e, decision.offset);
+
+                            da_append(e, 0x20);  // opcode for local.get
+                            bb_append_leb128_u(&e, temp);
+                            // opcode for f32.reinterpret_i32 or
+                            // f64.reinterpret_i64
+                            da_append(e, f32 ? 0xBE : 0xBF);
+                        } break;
                         case VT_BOOL: {
                             da_append(e, 0x22);  // opcode for local.tee
                             bb_append_leb128_u(&e, temp_i32_index);
 
                             da_append(e, 0x3A);  // opcode for i32.store8
                             bb_append_leb128_u(&e, 0);
+                            bb_append_leb128_u(&e, decision.offset);
+
+                            da_append(e, 0x20);  // opcode for local.get
+                            bb_append_leb128_u(&e, temp_i32_index);
+                        } break;
+                        case VT_FUNCTION: {
+                            da_append(e, 0x22);  // opcode for local.tee
+                            bb_append_leb128_u(&e, temp_i32_index);
+
+                            da_append(e, 0x36);  // opcode for i32.store
                             bb_append_leb128_u(&e, 0);
+                            bb_append_leb128_u(&e, decision.offset);
 
                             da_append(e, 0x20);  // opcode for local.get
                             bb_append_leb128_u(&e, temp_i32_index);
@@ -584,11 +1482,25 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
 
                             da_append(e, 0x37);  // opcode for i64.store
                             bb_append_leb128_u(&e, 0);
-                            bb_append_leb128_u(&e, 0);
+                            bb_append_leb128_u(&e, decision.offset);
 
                             da_append(e, 0x20);  // opcode for local.get
                             bb_append_leb128_u(&e, temp_i64_index);
                         } break;
+                        case VT_V128: {
+                            size_t temp_v128_index;
+                            diag_check(find_temp_v128_index(mod, scope,
+                                                            &temp_v128_index));
+                            da_append(e, 0x22);  // opcode for local.tee
+                            bb_append_leb128_u(&e, temp_v128_index);
+
+                            bb_append_simd_op(&e, 0x0B);  // v128.store
+                            bb_append_leb128_u(&e, 0);
+                            bb_append_leb128_u(&e, decision.offset);
+
+                            da_append(e, 0x20);  // opcode for local.get
+                            bb_append_leb128_u(&e, temp_v128_index);
+                        } break;
                     }
                 } break;
 
@@ -596,6 +1508,8 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
                 case OP_FUNC_CALL:
                 case OP_FIELD_ACCESS:
                 case OP_CASTING:
+                case OP_OPEN_SQUARE:
+                case OP_SUBSLICE:
                     assert(false && "Unreachable");
             }
         } break;
@@ -603,25 +1517,66 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
             assert(!decision.take_reference &&
                    "Cannot take reference to a temporary");
 
+            Builtin builtin;
+            Decl* callee = find_function_value(mod, scope, ex->props.func);
+            if (!callee && !find_local_fn(mod, scope, ex->props.func, NULL)) {
+                // builtins don't use the shadow stack
+                Intrinsic* intrinsic = find_intrinsic(ex->props.func);
+                if (intrinsic) {
+                    diag_check(bb_append_intrinsic(&e, mod, intrinsic,
+                                                   decision.lane, scope));
+                    break;
+                }
+                diag_check(find_builtin(ex->props.func, &builtin));
+                if (builtin >= RUNTIME_BUILTINS) {
+                    diag_check(bb_append_inline_builtin(
+                        &e, mod, builtin, decision.left_type, scope));
+                    break;
+                }
+                da_append(e, 0x10);  // opcode for call
+                bb_append_leb128_u(&e, builtin_fn_index(mod, builtin));
+                break;
+            }
+
             size_t stack_base_index;
-            assert(find_stack_base_index(mod, scope, &stack_base_index));
+            diag_check(find_stack_base_index(mod, scope, &stack_base_index));
 
             size_t frame_size;
-            assert(calc_local_frame_size(mod, scope, &frame_size));
-
-            size_t fn_index;
-            assert(find_local_fn(mod, scope, ex->props.func, &fn_index));
+            diag_check(calc_local_frame_size(mod, scope, &frame_size));
+            // keeps frames aligned for v128 variables
+            if (mod->uses_v128) frame_size = align16(frame_size);
 
             da_append(e, 0x20);  // opcode for local.get
             bb_append_leb128_u(&e, stack_base_index);
             da_append(e, 0x41);  // opcode for i32.const
-            bb_append_leb128_u(&e, frame_size);
+            bb_append_leb128_s(&e, (int32_t)frame_size);
             da_append(e, 0x6A);  // opcode for i32.add
             da_append(e, 0x24);  // opcode for global.set
             bb_append_leb128_u(&e, GLOBAL_STACK_PTR);
 
-            da_append(e, 0x10);  // opcode for call
-            bb_append_leb128_u(&e, fn_index);
+            if (callee) {  // slot of function goes after arguments
+                Expr value = {.kind = EK_VAR, .props.var = ex->props.func};
+                ByteBuffer slot = codegen_expr(mod, &value, (ExprDecision){0},
+                                               decisions, scope);
+                bb_append_bb(&e, &slot);
+                free(slot.items);
+
+                da_append(e, 0x11);  // opcode for call_indirect
+                bb_append_leb128_u(&e, callee->value.vt.props.function_type);
+                bb_append_leb128_u(&e, 0);  // table
+            } else {
+                size_t fn_index;
+                diag_check(
+                    find_local_fn(mod, scope, ex->props.func, &fn_index));
+                da_append(e, 0x10);  // opcode for call
+                bb_append_leb128_u(&e, fn_index);
+            }
+
+            // restore stack pointer, so calls don't leak frames
+            da_append(e, 0x20);  // opcode for local.get
+            bb_append_leb128_u(&e, stack_base_index);
+            da_append(e, 0x24);  // opcode for global.set
+            bb_append_leb128_u(&e, GLOBAL_STACK_PTR);
         } break;
         case EK_FIELD_ACCESS: {
             if (decision.left_type.kind == VT_SLICE) {
@@ -653,17 +1608,85 @@ ByteBuffer codegen_expr(Module* mod, Expr* ex, ExprDecision decision,
                         assert(false && "Invalid field on slice");
                     }
                 }
-            } else {
-                assert("Unimplemented");
+            } else if (decision.soa_item) {
+                // field of item `i` is at `ptr + len * offset + i * size`
+                size_t temp_i32_index, temp_i64_index;
+                diag_check(find_temp_i32_index(mod, scope, &temp_i32_index));
+                diag_check(find_temp_i64_index(mod, scope, &temp_i64_index));
+                da_append(e, 0x21);  // opcode for local.set
+                bb_append_leb128_u(&e, temp_i32_index);
+                da_append(e, 0x22);  // opcode for local.tee
+                bb_append_leb128_u(&e, temp_i64_index);
+                da_append(e, 0xA7);  // opcode for i32.wrap_i64
+                if (decision.offset) {
+                    bb_append_slice_bytes(&e, temp_i64_index, decision.offset);
+                    da_append(e, 0x6A);  // opcode for i32.add
+                }
+                da_append(e, 0x20);  // opcode for local.get
+                bb_append_leb128_u(&e, temp_i32_index);
+                size_t size = get_size_of_value_type(mod, decision.right_type);
+                if (size != 1) {
+                    da_append(e, 0x41);  // opcode for i32.const
+                    bb_append_leb128_u(&e, size);
+                    da_append(e, 0x6C);  // opcode for i32.mul
+                }
+                da_append(e, 0x6A);  // opcode for i32.add
+                if (!decision.take_reference)
+                    diag_check(bb_append_loading_value(
+                        &e, mod, decision.right_type, 0));
+            } else if (!decision.take_reference) {
+                diag_check(bb_append_loading_value(
+                    &e, mod, decision.right_type, decision.offset));
+            } else if (!decision.fold_offset && decision.offset) {
+                da_append(e, 0x41);  // opcode for i32.const
+                bb_append_leb128_u(&e, decision.offset);
+                da_append(e, 0x6A);  // opcode for i32.add
             }
         } break;
         case EK_CASTING: {
             if (!decision.take_reference) {
-                assert(decision.left_type.kind == VT_INT &&
-                       decision.right_type.kind == VT_INT);
+                assert(is_numeric(decision.left_type) &&
+                       is_numeric(decision.right_type));
 
-                bb_append_applying_bitmask_i32(
-                    &e, decision.right_type.props.i.bits);
+                bb_append_cast(&e, decision.left_type, decision.right_type);
+            }
+        } break;
+        case EK_SUBSLICE:
+            assert(!decision.take_reference &&
+                   "Cannot take reference to a temporary");
+            diag_check(bb_append_subslice(&e, mod, decision.left_type,
+                                          ex->props.to_end, scope));
+            break;
+        case EK_CONDITIONAL: {
+            if (decision.take_reference) {
+                fprintf(diag_out(), "Conditional can't be assigned!\n");
+                diag_fail();
+            }
+            ByteBuffer arms[3];
+            for (size_t i = 0; i < 3; i++) {
+                arms[i] = codegen_decided_expression(
+                    mod, &ex->props.arms[i], decision.arms[i], scope);
+            }
+            if (decision.left_type.kind != VT_V128 &&
+                is_cheap_pure_arm(&ex->props.arms[1]) &&
+                is_cheap_pure_arm(&ex->props.arms[2])) {
+                bb_append_bb(&e, &arms[1]);
+                bb_append_bb(&e, &arms[2]);
+                bb_append_bb(&e, &arms[0]);
+                da_append(e, 0x1B);  // opcode for select
+            } else {
+                bb_append_bb(&e, &arms[0]);
+                da_append(e, 0x04);  // opcode for if
+                ByteBuffer result = codegen_value_type(mod, decision.left_type);
+                bb_append_bb(&e, &result);
+                free(result.items);
+                bb_append_bb(&e, &arms[1]);
+                da_append(e, 0x05);  // opcode for else
+                bb_append_bb(&e, &arms[2]);
+                da_append(e, 0x0B);  // opcode for end
+            }
+            for (size_t i = 0; i < 3; i++) {
+                free(arms[i].items);
             }
         } break;
     }
@@ -681,6 +1704,8 @@ ExprDecisions compute_expression_decisions(Module* mod, Expression* expr,
         da_list(ValueType);
     } type_stack = {0};
     ExprDecisions decisions = {0};
+    // items of soa slices and their fields, each item needs one
+    size_t soa_items = 0, soa_fields = 0;
 
     for (size_t i = 0; i < expr->count; i++) {
         ExprDecision decision = {.dependency = -1};
@@ -696,6 +1721,14 @@ ExprDecisions compute_expression_decisions(Module* mod, Expression* expr,
                 };
                 da_append(type_stack, vt);
             } break;
+            case EK_FLOAT_CONST: {
+                da_append(index_stack, i);
+                ValueType vt = {
+                    .kind = VT_FLOAT,
+                    .props.f.bits = e->props.f.bits,
+                };
+                da_append(type_stack, vt);
+            } break;
             case EK_BOOL_CONST: {
                 da_append(index_stack, i);
                 da_append(type_stack, (ValueType){.kind = VT_BOOL});
@@ -705,40 +1738,81 @@ ExprDecisions compute_expression_decisions(Module* mod, Expression* expr,
 
                 ValueType vt = {
                     .kind = VT_SLICE,
-                };
-                vt.props.inner_type = malloc(sizeof(ValueType));
-                assert(vt.props.inner_type);
-
-                *vt.props.inner_type = (ValueType){
-                    .kind = VT_INT,
-                    .props.i.bits = 8,
-                    .props.i.unsign = true,
+                    .props.inner_type = &u8_type,
                 };
 
                 da_append(type_stack, vt);
             } break;
             case EK_VAR: {
                 Decl* decl;
-                assert(find_local_var(mod, scope, e->props.var, NULL, &decl) &&
-                       "Use of undeclared variable");
+                if (!find_local_var(mod, scope, e->props.var, NULL, &decl)) {
+                    fprintf(diag_out(), "Use of undeclared variable `%s`!\n",
+                            e->props.var);
+                    diag_fail();
+                }
+                if (decl->kind == DK_STRUCT) {
+                    fprintf(diag_out(), "Struct `%s` is not a value!\n",
+                            e->props.var);
+                    diag_fail();
+                }
                 da_append(index_stack, i);
-                da_append(type_stack, decl->value.vt);
+                if (decl->kind == DK_FUNCTION ||
+                    decl->kind == DK_EXTERN_FUNCTION) {
+                    ValueType value = {
+                        .kind = VT_FUNCTION,
+                        .props.function_type =
+                            decl_function(mod, decl)->function_type,
+                    };
+                    da_append(type_stack, value);
+                } else if (decl->value.vt.kind == VT_ARRAY) {
+                    ValueType slice = {.kind = VT_SLICE};
+                    slice.props.inner_type =
+                        decl->value.vt.props.array.inner_type;
+                    da_append(type_stack, slice);
+                } else {
+                    da_append(type_stack, decl->value.vt);
+                }
             } break;
             case EK_OPERATOR: {
-                assert(index_stack.count >= 2 &&
-                       "Wrong amount of operands for binary op");
+                if (index_stack.count < 2) {
+                    fprintf(diag_out(), "Binary operator needs two values!\n");
+                    diag_fail();
+                }
                 size_t li = index_stack.items[index_stack.count - 2];
                 size_t ri = index_stack.items[index_stack.count - 1];
                 decision.left_type = type_stack.items[index_stack.count - 2];
                 decision.right_type = type_stack.items[index_stack.count - 1];
                 switch (e->props.op) {
+                    case OP_REMAINDER:
+                        if (decision.left_type.kind == VT_FLOAT) {
+                            fprintf(diag_out(),
+                                    "Remainder of floats is not supported!\n");
+                            diag_fail();
+                        }
+                        // fallthrough
                     case OP_ADDITION:
                     case OP_SUBTRACTION:
                     case OP_MULTIPLICATION:
-                    case OP_REMAINDER:
                     case OP_DIVISION:
+                        if (!is_numeric(decision.left_type) ||
+                            !compare_value_types(decision.left_type,
+                                                 decision.right_type)) {
+                            fprintf(diag_out(), "Arithmetic needs numbers of "
+                                                "the same type!\n");
+                            diag_fail();
+                        }
+                        // fallthrough
                     case OP_ALTERNATIVE:
                     case OP_CONJUNCTION: {
+                        if (e->props.op == OP_ALTERNATIVE ||
+                            e->props.op == OP_CONJUNCTION) {
+                            if (decision.left_type.kind != VT_BOOL ||
+                                decision.right_type.kind != VT_BOOL) {
+                                fprintf(diag_out(), "Operands of `and` and "
+                                                    "`or` must be booleans!\n");
+                                diag_fail();
+                            }
+                        }
                         index_stack.count -= 2;
                         type_stack.count -= 2;
 
@@ -752,14 +1826,37 @@ ExprDecisions compute_expression_decisions(Module* mod, Expression* expr,
                         index_stack.count -= 2;
                         type_stack.count -= 2;
 
-                        assert(decision.left_type.kind == VT_SLICE &&
-                               "Cannot index non slice values");
+                        if (decision.left_type.kind != VT_SLICE) {
+                            fprintf(diag_out(), "Only slices can be "
+                                                "indexed!\n");
+                            diag_fail();
+                        }
+                        if (decision.right_type.kind != VT_INT ||
+                            decision.right_type.props.i.bits > 32) {
+                            fprintf(diag_out(), "Index must be a 32-bit "
+                                                "integer!\n");
+                            diag_fail();
+                        }
+
+                        ValueType* item = decision.left_type.props.inner_type;
+                        if (item->kind == VT_STRUCT &&
+                            mod->structs.items[item->props.struct_index].soa) {
+                            decision.soa_item = true;
+                            soa_items++;
+                        }
 
                         da_append(index_stack, i);
                         da_append(type_stack,
                                   *decision.left_type.props.inner_type);
                     } break;
                     case OP_EQUALITY: {
+                        if (!is_numeric(decision.left_type) ||
+                            !compare_value_types(decision.left_type,
+                                                 decision.right_type)) {
+                            fprintf(diag_out(), "Only numbers of the same "
+                                                "type can be compared!\n");
+                            diag_fail();
+                        }
                         index_stack.count -= 2;
                         type_stack.count -= 2;
                         da_append(index_stack, i);
@@ -768,9 +1865,37 @@ ExprDecisions compute_expression_decisions(Module* mod, Expression* expr,
                     case OP_ASSIGNEMENT: {
                         index_stack.count -= 2;
                         type_stack.count -= 2;
+                        if (decision.left_type.kind == VT_STRUCT) {
+                            fprintf(diag_out(), "Structs can't be assigned, "
+                                                "only their fields!\n");
+                            diag_fail();
+                        }
+                        if (!compare_value_types(decision.left_type,
+                                                 decision.right_type)) {
+                            fprintf(diag_out(),
+                                    "Type mismatch in assignment!\n");
+                            diag_fail();
+                        }
+                        // store to field of struct adds its offset itself
+                        if (expr->items[li].kind == EK_FIELD_ACCESS &&
+                            decisions.items[li].left_type.kind == VT_STRUCT &&
+                            !decisions.items[li].soa_item) {
+                            decisions.items[li].fold_offset = true;
+                            decision.offset = decisions.items[li].offset;
+                        }
                         {
                             size_t it = li;
                             do {
+                                Expr* target = &expr->items[it];
+                                if (target->kind != EK_VAR &&
+                                    target->kind != EK_FIELD_ACCESS &&
+                                    !(target->kind == EK_OPERATOR &&
+                                      target->props.op == OP_INDEXING)) {
+                                    fprintf(diag_out(),
+                                            "Only variables, items and "
+                                            "fields can be assigned!\n");
+                                    diag_fail();
+                                }
                                 decisions.items[it].take_reference = true;
                             } while ((it = decisions.items[it].dependency) !=
                                      -1);
@@ -784,52 +1909,173 @@ ExprDecisions compute_expression_decisions(Module* mod, Expression* expr,
                     case OP_FUNC_CALL:
                     case OP_FIELD_ACCESS:
                     case OP_CASTING:
+                    case OP_OPEN_SQUARE:
+                    case OP_SUBSLICE:
                         assert(false && "Unreachable");
                         break;
                 }
             } break;
             case EK_FUNC_CALL: {
                 size_t fn_index;
-                assert(find_local_fn(mod, scope, e->props.func, &fn_index) &&
-                       "Calling undefined function");
-                Function* f;
-                if (fn_index >= mod->extern_functions.count)
-                    f = &mod->functions
-                             .items[fn_index - mod->extern_functions.count];
-                else
-                    f = &mod->extern_functions.items[fn_index];
-
-                DeclScope* param_scope = &mod->scopes.items[f->param_scope];
+                Builtin builtin;
+                Decl* callee = find_function_value(mod, scope, e->props.func);
+                if (!callee &&
+                    !find_local_fn(mod, scope, e->props.func, &fn_index)) {
+                    Intrinsic* intrinsic = find_intrinsic(e->props.func);
+                    if (!intrinsic && !find_builtin(e->props.func, &builtin)) {
+                        fprintf(diag_out(),
+                                "Calling undefined function `%s`!\n",
+                                e->props.func);
+                        diag_fail();
+                    }
+
+                    BuiltinSignature* sig =
+                        intrinsic ? &intrinsic->sig : &builtins[builtin];
+                    if (type_stack.count < sig->arity) {
+                        fprintf(diag_out(), "Too few arguments of `%s`!\n",
+                                sig->name);
+                        diag_fail();
+                    }
+
+                    ValueType* args =
+                        &type_stack.items[type_stack.count - sig->arity];
+                    bool matching = builtin_args_match(sig, args);
+                    if (matching && !intrinsic && builtin == BUILTIN_COPY) {
+                        matching = compare_value_types(args[0], args[1]);
+                        if (is_soa_slice(mod, args[0])) {
+                            fprintf(diag_out(), "Slices of soa structs can't "
+                                                "be copied!\n");
+                            diag_fail();
+                        }
+                    }
+                    if (!matching) {
+                        fprintf(diag_out(),
+                                "Type mismatch in arguments of `%s`!\n",
+                                sig->name);
+                        diag_fail();
+                    }
+                    decision.left_type = args[0];
+
+                    if (intrinsic && (intrinsic->kind == INTRINSIC_EXTRACT ||
+                                      intrinsic->kind == INTRINSIC_REPLACE)) {
+                        Expr* lane = &expr->items[index_stack.items
+                                                      [index_stack.count -
+                                                       sig->arity + 1]];
+                        if (lane->kind != EK_INT_CONST ||
+                            lane->props.i.value < 0 ||
+                            lane->props.i.value >= intrinsic->lanes) {
+                            fprintf(diag_out(),
+                                    "Lane of `%s` must be a constant below "
+                                    "%d!\n",
+                                    sig->name, intrinsic->lanes);
+                            diag_fail();
+                        }
+                        decision.lane = lane->props.i.value;
+                    }
+
+                    index_stack.count -= sig->arity;
+                    type_stack.count -= sig->arity;
+
+                    if (sig->return_type.kind != VT_NIL) {
+                        da_append(index_stack, i);
+                        da_append(type_stack, sig->return_type);
+                    }
+                    break;
+                }
+
+                FunctionType ft;
+                if (callee) {
+                    ft = mod->function_types
+                             .items[callee->value.vt.props.function_type];
+                } else {
+                    Function* f;
+                    if (fn_index >= mod->extern_functions.count)
+                        f = &mod->functions
+                                 .items[fn_index - mod->extern_functions.count];
+                    else
+                        f = &mod->extern_functions.items[fn_index];
+                    ft = (FunctionType){
+                        .param_scope = f->param_scope,
+                        .return_type = f->return_type,
+                    };
+                }
+
+                DeclScope* param_scope = &mod->scopes.items[ft.param_scope];
                 size_t arity = param_scope->count;
 
-                assert(type_stack.count >= arity);
+                if (type_stack.count < arity) {
+                    fprintf(diag_out(), "Too few arguments of `%s`!\n",
+                            e->props.func);
+                    diag_fail();
+                }
 
                 for (int i = 0; i < arity; i++) {
                     if (!compare_value_types(
                             type_stack.items[type_stack.count - arity + i],
-                            param_scope->items[i].value.vt))
-                        assert(false && "Type mismatch in function arguments");
+                            param_scope->items[i].value.vt)) {
+                        fprintf(diag_out(),
+                                "Type mismatch in arguments of `%s`!\n",
+                                e->props.func);
+                        diag_fail();
+                    }
                 }
 
                 index_stack.count -= arity;
                 type_stack.count -= arity;
 
-                if (f->return_type.kind != VT_NIL) {
+                if (ft.return_type.kind != VT_NIL) {
                     da_append(index_stack, i);
-                    da_append(type_stack, f->return_type);
+                    da_append(type_stack, ft.return_type);
                 }
             } break;
             case EK_FIELD_ACCESS: {
-                assert(type_stack.count > 0 &&
-                       "There has to be value of which a field is accessed");
+                if (type_stack.count == 0) {
+                    fprintf(diag_out(), "Field `%s` of nothing!\n",
+                            e->props.field_name);
+                    diag_fail();
+                }
                 ValueType object_type = type_stack.items[type_stack.count - 1];
+                decision.dependency = index_stack.items[index_stack.count - 1];
+
+                if (object_type.kind == VT_STRUCT) {
+                    StructType* s =
+                        &mod->structs.items[object_type.props.struct_index];
+                    StructField* field = NULL;
+                    for (size_t j = 0; j < s->count; j++) {
+                        if (strcmp(s->items[j].name, e->props.field_name) == 0)
+                            field = &s->items[j];
+                    }
+                    if (!field) {
+                        fprintf(diag_out(), "Struct `%s` has no field `%s`!\n",
+                                s->name, e->props.field_name);
+                        diag_fail();
+                    }
+                    decision.left_type = object_type;
+                    decision.right_type = field->vt;
+                    decision.offset = field->offset;
+                    decision.soa_item =
+                        decisions.items[decision.dependency].soa_item;
+                    if (decision.soa_item) soa_fields++;
+
+                    index_stack.count--;
+                    type_stack.count--;
+                    da_append(index_stack, i);
+                    da_append(type_stack, field->vt);
+                    break;
+                }
 
-                if (object_type.kind != VT_SLICE)
-                    assert(false && "Unimplemented");
+                if (object_type.kind != VT_SLICE) {
+                    fprintf(diag_out(),
+                            "Only structs and slices have fields!\n");
+                    diag_fail();
+                }
 
                 if (strcmp(e->props.field_name, "len") != 0 &&
-                    strcmp(e->props.field_name, "ptr") != 0)
-                    assert(false && "Unimplemented");
+                    strcmp(e->props.field_name, "ptr") != 0) {
+                    fprintf(diag_out(), "Slice has no field `%s`!\n",
+                            e->props.field_name);
+                    diag_fail();
+                }
 
                 ValueType vt = {
                     // u32 type
@@ -837,7 +2083,6 @@ ExprDecisions compute_expression_decisions(Module* mod, Expression* expr,
                     .props.i.bits = 32,
                     .props.i.unsign = true,
                 };
-                decision.dependency = index_stack.items[index_stack.count - 1];
 
                 decision.left_type = object_type;
                 decision.right_type = vt;
@@ -851,17 +2096,21 @@ ExprDecisions compute_expression_decisions(Module* mod, Expression* expr,
                 da_append(type_stack, vt);
             } break;
             case EK_CASTING: {
-                assert(type_stack.count > 0 &&
-                       "There has to be a value to be casted");
+                if (type_stack.count == 0) {
+                    fprintf(diag_out(), "Cast of nothing!\n");
+                    diag_fail();
+                }
 
                 ValueType from_type = type_stack.items[type_stack.count - 1];
 
                 decision.left_type = from_type;
                 decision.right_type = e->props.cast_target;
 
-                assert(from_type.kind == VT_INT &&
-                       e->props.cast_target.kind == VT_INT &&
-                       "Casting is implemeted only for ints");
+                if (!is_numeric(from_type) ||
+                    !is_numeric(e->props.cast_target)) {
+                    fprintf(diag_out(), "Only numbers can be casted!\n");
+                    diag_fail();
+                }
 
                 decision.dependency = index_stack.items[index_stack.count - 1];
 
@@ -873,23 +2122,84 @@ ExprDecisions compute_expression_decisions(Module* mod, Expression* expr,
                 da_append(index_stack, i);
                 da_append(type_stack, e->props.cast_target);
             } break;
+            case EK_SUBSLICE: {
+                size_t arity = e->props.to_end ? 2 : 3;
+                if (type_stack.count < arity) {
+                    fprintf(diag_out(),
+                            "Subslice needs a slice and its bounds!\n");
+                    diag_fail();
+                }
+
+                ValueType* operands =
+                    &type_stack.items[type_stack.count - arity];
+                if (operands[0].kind != VT_SLICE) {
+                    fprintf(diag_out(), "Only slices can be subsliced!\n");
+                    diag_fail();
+                }
+                if (is_soa_slice(mod, operands[0])) {
+                    fprintf(diag_out(),
+                            "Slices of soa structs can't be subsliced!\n");
+                    diag_fail();
+                }
+                for (size_t j = 1; j < arity; j++) {
+                    if (operands[j].kind != VT_INT ||
+                        operands[j].props.i.bits > 32) {
+                        fprintf(diag_out(), "Bounds of subslice must be "
+                                            "32-bit integers!\n");
+                        diag_fail();
+                    }
+                }
+                decision.left_type = operands[0];
+
+                index_stack.count -= arity;
+                type_stack.count -= arity;
+
+                da_append(index_stack, i);
+                da_append(type_stack, decision.left_type);
+            } break;
+            case EK_CONDITIONAL: {
+                ValueType types[3];
+                decision.arms = malloc(3 * sizeof(ExprDecisions));
+                assert(decision.arms);
+                for (size_t j = 0; j < 3; j++) {
+                    decision.arms[j] = compute_expression_decisions(
+                        mod, &e->props.arms[j], scope, &types[j]);
+                }
+                if (types[0].kind != VT_BOOL) {
+                    fprintf(diag_out(),
+                            "Condition of conditional must be a boolean!\n");
+                    diag_fail();
+                }
+                if (types[1].kind == VT_NIL ||
+                    !compare_value_types(types[1], types[2])) {
+                    fprintf(diag_out(), "Arms of conditional must have "
+                                        "values of the same type!\n");
+                    diag_fail();
+                }
+                decision.left_type = types[1];
+
+                da_append(index_stack, i);
+                da_append(type_stack, decision.left_type);
+            } break;
         }
         da_append(decisions, decision);
     }
 
+    if (soa_items != soa_fields) {
+        fprintf(diag_out(), "Items of soa slices can only be used to access "
+                            "their fields!\n");
+        diag_fail();
+    }
+
+    if (type_stack.count > 1) {
+        fprintf(diag_out(), "Expression must have at most a single value!\n");
+        diag_fail();
+    }
     if (out_remaining_value) {
-        switch (type_stack.count) {
-            case 1:
-                *out_remaining_value = *type_stack.items;
-                break;
-            case 0:
-                out_remaining_value->kind = VT_NIL;
-                break;
-            default:
-                assert(false &&
-                       "There must be a single remaining value after "
-                       "processing an expression");
-        }
+        if (type_stack.count == 1)
+            *out_remaining_value = *type_stack.items;
+        else
+            out_remaining_value->kind = VT_NIL;
     }
 
     free(index_stack.items);
@@ -899,8 +2209,18 @@ ExprDecisions compute_expression_decisions(Module* mod, Expression* expr,
 
 ByteBuffer codegen_expression(Module* mod, Expression* expr, size_t scope,
                               ValueType* out_remaining_value) {
+    uint64_t start = stats_now();
     ExprDecisions decisions =
         compute_expression_decisions(mod, expr, scope, out_remaining_value);
+    stats_end_phase(PHASE_DECISIONS, start);
+    ByteBuffer out = codegen_decided_expression(mod, expr, decisions, scope);
+    free_expression_decisions(&decisions);
+    return out;
+}
+
+static ByteBuffer codegen_decided_expression(Module* mod, Expression* expr,
+                                            ExprDecisions decisions,
+                                            size_t scope) {
     ByteBuffer out = {0};
     for (size_t i = 0; i < expr->count; i++) {
         ByteBuffer e = codegen_expr(mod, &expr->items[i], decisions.items[i],
@@ -908,7 +2228,6 @@ ByteBuffer codegen_expression(Module* mod, Expression* expr, size_t scope,
         bb_append_bb(&out, &e);
         free(e.items);
     }
-    free(decisions.items);
     return out;
 }
 
@@ -938,8 +2257,10 @@ ByteBuffer codegen_return_statement(Module* mod, ReturnStatement* st,
 ByteBuffer codegen_if_statement(Module* mod, IfStatement* st, size_t scope) {
     ValueType cond_vt;
     ByteBuffer ifs = codegen_expression(mod, &st->cond_expr, scope, &cond_vt);
-    assert(cond_vt.kind == VT_BOOL &&
-           "Condition of if statement must be a boolean");
+    if (cond_vt.kind != VT_BOOL) {
+        fprintf(diag_out(), "Condition of if statement must be a boolean!\n");
+        diag_fail();
+    }
     da_append(ifs, 0x04);  // opcode for if
     da_append(ifs, 0x40);  // opcode for nil result type
     {
@@ -959,6 +2280,172 @@ ByteBuffer codegen_if_statement(Module* mod, IfStatement* st, size_t scope) {
     return ifs;
 }
 
+// cases dispatch through a single br_table when there are enough of them
+// and the table has at most this many slots per case, otherwise through a
+// balanced tree of comparisons
+#define SWITCH_TABLE_MIN_CASES 3
+#define SWITCH_TABLE_SLOTS_PER_CASE 3
+// cases compared one after another at leaves of the tree
+#define SWITCH_LEAF_CASES 3
+
+typedef struct {
+    uint64_t key;  // orders values of both signed and unsigned types
+    int64_t value;
+    size_t branch;
+} SortedCase;
+
+static int compare_sorted_cases(const void* a, const void* b) {
+    uint64_t x = ((SortedCase*)a)->key, y = ((SortedCase*)b)->key;
+    return (x > y) - (x < y);
+}
+
+static void bb_append_switch_const(ByteBuffer* e, bool wide, int64_t value) {
+    if (wide) {
+        da_append(*e, 0x42);  // opcode for i64.const
+        bb_append_leb128_s(e, value);
+    } else {
+        da_append(*e, 0x41);  // opcode for i32.const
+        bb_append_leb128_s(e, (int32_t)value);
+    }
+}
+
+// branches to label of branch of value in local, which is `depth` blocks
+// deeper than at the start of dispatch
+static void bb_append_switch_tree(ByteBuffer* e, SortedCase* cases,
+                                  size_t count, size_t branches, size_t local,
+                                  ValueType vt, size_t depth) {
+    bool wide = vt.props.i.bits > 32;
+    if (count > SWITCH_LEAF_CASES) {  // `value < middle` goes to first half
+        size_t middle = count / 2;
+        da_append(*e, 0x20);  // opcode for local.get
+        bb_append_leb128_u(e, local);
+        bb_append_switch_const(e, wide, cases[middle].value);
+        // opcode for i32.lt_s and its variants
+        da_append(*e, (wide ? 0x53 : 0x48) + vt.props.i.unsign);
+        da_append(*e, 0x04);  // opcode for if
+        da_append(*e, 0x40);  // empty block type
+        bb_append_switch_tree(e, cases, middle, branches, local, vt,
+                              depth + 1);
+        da_append(*e, 0x0B);  // opcode for end
+        cases += middle;
+        count -= middle;
+    }
+    for (size_t i = 0; i < count; i++) {
+        da_append(*e, 0x20);  // opcode for local.get
+        bb_append_leb128_u(e, local);
+        bb_append_switch_const(e, wide, cases[i].value);
+        da_append(*e, wide ? 0x51 : 0x46);  // opcode for i64.eq or i32.eq
+        da_append(*e, 0x0D);                // opcode for br_if
+        bb_append_leb128_u(e, cases[i].branch + depth);
+    }
+    da_append(*e, 0x0C);  // opcode for br
+    bb_append_leb128_u(e, branches + depth);
+}
+
+ByteBuffer codegen_switch_statement(Module* mod, SwitchStatement* st,
+                                    size_t scope) {
+    ValueType vt;
+    ByteBuffer value = codegen_expression(mod, &st->expr, scope, &vt);
+    if (vt.kind != VT_INT) {
+        fprintf(diag_out(), "Switch value must be an integer!\n");
+        diag_fail();
+    }
+    bool wide = vt.props.i.bits > 32;
+
+    size_t count = st->cases.count;
+    SortedCase* cases = malloc(count * sizeof(SortedCase) + 1);
+    assert(cases);
+    for (size_t i = 0; i < count; i++) {
+        SwitchCase* c = &st->cases.items[i];
+        if (c->bits != vt.props.i.bits || c->unsign != vt.props.i.unsign) {
+            fprintf(diag_out(),
+                    "Case `%" PRId64 "` doesn't match type of switch value!\n",
+                    c->value);
+            diag_fail();
+        }
+        cases[i] = (SortedCase){
+            .key = c->unsign ? (uint64_t)c->value
+                             : (uint64_t)c->value ^ (1ull << 63),
+            .value = c->value,
+            .branch = c->branch,
+        };
+    }
+    qsort(cases, count, sizeof(SortedCase), compare_sorted_cases);
+
+    // blocks of end of switch, `else` and each branch, the innermost one is
+    // left to the first branch, so branch `i` is label `i` in dispatch
+    ByteBuffer sw = {0};
+    size_t branches = st->branches.count;
+    for (size_t i = 0; i < branches + 2; i++) {
+        da_append(sw, 0x02);  // opcode for block
+        da_append(sw, 0x40);  // empty block type
+    }
+    bb_append_bb(&sw, &value);
+    free(value.items);
+
+    uint64_t slots = count ? cases[count - 1].key - cases[0].key + 1 : 0;
+    if (count >= SWITCH_TABLE_MIN_CASES &&
+        slots <= count * SWITCH_TABLE_SLOTS_PER_CASE) {
+        if (wide) {  // out of range values can't be wrapped to i32 index
+            size_t temp_i64_index;
+            diag_check(find_temp_i64_index(mod, scope, &temp_i64_index));
+            bb_append_switch_const(&sw, wide, cases[0].value);
+            da_append(sw, 0x7D);  // opcode for i64.sub
+            da_append(sw, 0x22);  // opcode for local.tee
+            bb_append_leb128_u(&sw, temp_i64_index);
+            bb_append_switch_const(&sw, wide, slots - 1);
+            da_append(sw, 0x56);  // opcode for i64.gt_u
+            da_append(sw, 0x0D);  // opcode for br_if
+            bb_append_leb128_u(&sw, branches);
+            da_append(sw, 0x20);  // opcode for local.get
+            bb_append_leb128_u(&sw, temp_i64_index);
+            da_append(sw, 0xA7);  // opcode for i32.wrap_i64
+        } else if (cases[0].value) {
+            bb_append_switch_const(&sw, wide, cases[0].value);
+            da_append(sw, 0x6B);  // opcode for i32.sub
+        }
+        da_append(sw, 0x0E);  // opcode for br_table
+        bb_append_leb128_u(&sw, slots);
+        size_t next = 0;
+        for (uint64_t slot = 0; slot < slots; slot++) {
+            if (cases[next].key - cases[0].key == slot) {
+                bb_append_leb128_u(&sw, cases[next++].branch);
+            } else {
+                bb_append_leb128_u(&sw, branches);  // to `else`
+            }
+        }
+        bb_append_leb128_u(&sw, branches);
+    } else {
+        size_t local;
+        if (wide)
+            diag_check(find_temp_i64_index(mod, scope, &local));
+        else
+            diag_check(find_temp_i32_index(mod, scope, &local));
+        da_append(sw, 0x21);  // opcode for local.set
+        bb_append_leb128_u(&sw, local);
+        bb_append_switch_tree(&sw, cases, count, branches, local, vt, 0);
+    }
+    free(cases);
+
+    for (size_t i = 0; i < branches; i++) {
+        da_append(sw, 0x0B);  // opcode for end
+        ByteBuffer branch =
+            codegen_statement(mod, &st->branches.items[i], scope);
+        bb_append_bb(&sw, &branch);
+        free(branch.items);
+        da_append(sw, 0x0C);  // opcode for br
+        bb_append_leb128_u(&sw, branches - i);  // to end of switch
+    }
+    da_append(sw, 0x0B);  // opcode for end
+    if (st->default_branch) {
+        ByteBuffer branch = codegen_statement(mod, st->default_branch, scope);
+        bb_append_bb(&sw, &branch);
+        free(branch.items);
+    }
+    da_append(sw, 0x0B);  // opcode for end
+    return sw;
+}
+
 ByteBuffer codegen_expr_statement(Module* mod, ExpressionStatement* st,
                                   size_t scope) {
     ValueType drop_value;
@@ -981,7 +2468,12 @@ ByteBuffer codegen_statement(Module* mod, Statement* st, size_t scope) {
             return codegen_if_statement(mod, &st->ifs, scope);
         case SK_EXPRESSION:
             return codegen_expr_statement(mod, &st->expr, scope);
+        case SK_SWITCH:
+            return codegen_switch_statement(mod, &st->switchs, scope);
     }
+
+    assert(false && "Unreachable");
+    return (ByteBuffer){0};
 }
 
 // functions
@@ -996,13 +2488,21 @@ Vec codegen_function_locals(Module* mod, Function* f) {
         free(stack_base_local_buf.items);
     }
 
-    {  // temp_i64
+    {  // temp_i64 and temp2_i64
         ByteBuffer temp_i64_local_buf = {0};
-        bb_append_leb128_u(&temp_i64_local_buf, 1);
+        bb_append_leb128_u(&temp_i64_local_buf, 2);
         da_append(temp_i64_local_buf, 0x7E);  // i64
         vec_append_elem(&locals, &temp_i64_local_buf);
         free(temp_i64_local_buf.items);
     }
+
+    if (mod->uses_v128) {  // temp_v128
+        ByteBuffer temp_v128_local_buf = {0};
+        bb_append_leb128_u(&temp_v128_local_buf, 1);
+        da_append(temp_v128_local_buf, 0x7B);  // v128
+        vec_append_elem(&locals, &temp_v128_local_buf);
+        free(temp_v128_local_buf.items);
+    }
     return locals;
 }
 
@@ -1027,8 +2527,9 @@ ByteBuffer codegen_function(Module* mod, Function* f) {
 
     {
         size_t stack_base_index;
-        assert(find_stack_base_index(mod, f->param_scope, &stack_base_index) &&
-               "Function param scope must be a param_scope...");
+        // function param scope must be a param_scope
+        diag_check(
+            find_stack_base_index(mod, f->param_scope, &stack_base_index));
 
         da_append(code, 0x23);  // opcode for global.get
         bb_append_leb128_u(&code, GLOBAL_STACK_PTR);
@@ -1046,6 +2547,701 @@ ByteBuffer codegen_function(Module* mod, Function* f) {
     return code;
 }
 
+// runtime
+
+// calls of builtins and functions used as values, which go to the table
+
+static void find_runtime_calls_expression(Module* mod, Expression* ex,
+                                          size_t scope) {
+    for (size_t i = 0; i < ex->count; i++) {
+        Expr* e = &ex->items[i];
+        Builtin b;
+        if (e->kind == EK_CONDITIONAL) {
+            for (size_t j = 0; j < 3; j++) {
+                find_runtime_calls_expression(mod, &e->props.arms[j], scope);
+            }
+        }
+        if (e->kind == EK_VAR) {
+            Decl* decl = find_decl(mod, scope, e->props.var);
+            if (decl && (decl->kind == DK_FUNCTION ||
+                         decl->kind == DK_EXTERN_FUNCTION))
+                decl_function(mod, decl)->table_slot = 1;  // numbered later
+        }
+        if (e->kind != EK_FUNC_CALL ||
+            find_local_fn(mod, scope, e->props.func, NULL))
+            continue;
+        if (find_function_value(mod, scope, e->props.func)) {
+            mod->table_size = 1;  // indirect calls need table, even empty
+            continue;
+        }
+        if (find_builtin(e->props.func, &b) && b < RUNTIME_BUILTINS)
+            mod->used_builtins |= 1u << b;
+        if (find_intrinsic(e->props.func)) mod->uses_v128 = true;
+    }
+}
+
+static void find_runtime_calls_statement(Module* mod, Statement* st,
+                                         size_t scope) {
+    switch (st->kind) {
+        case SK_EMPTY:
+            break;
+        case SK_BLOCK:
+            for (size_t i = 0; i < st->block.count; i++) {
+                find_runtime_calls_statement(mod, &st->block.items[i],
+                                             st->block.scope);
+            }
+            break;
+        case SK_RETURN:
+            find_runtime_calls_expression(mod, &st->ret.expr, scope);
+            break;
+        case SK_IF:
+            find_runtime_calls_expression(mod, &st->ifs.cond_expr, scope);
+            find_runtime_calls_statement(mod, st->ifs.positive_branch, scope);
+            if (st->ifs.negative_branch) {
+                find_runtime_calls_statement(mod, st->ifs.negative_branch,
+                                             scope);
+            }
+            break;
+        case SK_EXPRESSION:
+            find_runtime_calls_expression(mod, &st->expr.expr, scope);
+            break;
+        case SK_SWITCH:
+            find_runtime_calls_expression(mod, &st->switchs.expr, scope);
+            for (size_t i = 0; i < st->switchs.branches.count; i++) {
+                find_runtime_calls_statement(
+                    mod, &st->switchs.branches.items[i], scope);
+            }
+            if (st->switchs.default_branch) {
+                find_runtime_calls_statement(mod, st->switchs.default_branch,
+                                             scope);
+            }
+            break;
+    }
+}
+
+// also finds out whether module uses v128 values, either in calls of
+// intrinsics or in declarations
+static void find_runtime_calls(Module* mod) {
+    mod->used_builtins = 0;
+    mod->uses_v128 = false;
+    mod->table_size = 0;
+    for (size_t i = 0; i < mod->functions.count; i++) {
+        mod->functions.items[i].table_slot = 0;
+    }
+    for (size_t i = 0; i < mod->extern_functions.count; i++) {
+        mod->extern_functions.items[i].table_slot = 0;
+    }
+    for (size_t i = 0; i < mod->functions.count; i++) {
+        Function* f = &mod->functions.items[i];
+        find_runtime_calls_statement(mod, &f->content, f->param_scope);
+        if (f->return_type.kind == VT_V128) mod->uses_v128 = true;
+    }
+    for (size_t i = 0; i < mod->extern_functions.count; i++) {
+        if (mod->extern_functions.items[i].return_type.kind == VT_V128)
+            mod->uses_v128 = true;
+    }
+
+    // slots follow order of function indices, 0 stays null, so calls of
+    // zeroed function values trap
+    size_t slots = 1;
+    for (size_t i = 0; i < mod->extern_functions.count; i++) {
+        Function* f = &mod->extern_functions.items[i];
+        if (f->table_slot) f->table_slot = slots++;
+    }
+    for (size_t i = 0; i < mod->functions.count; i++) {
+        Function* f = &mod->functions.items[i];
+        if (f->table_slot) f->table_slot = slots++;
+    }
+    if (slots > 1) mod->table_size = slots;
+    for (size_t i = 0; i < mod->scopes.count; i++) {
+        DeclScope* s = &mod->scopes.items[i];
+        for (size_t j = 0; j < s->count; j++) {
+            Decl* d = &s->items[j];
+            if ((d->kind == DK_PARAM || d->kind == DK_VARIABLE) &&
+                d->value.vt.kind == VT_V128)
+                mod->uses_v128 = true;
+        }
+    }
+    for (size_t i = 0; i < mod->inner_types.count; i++) {
+        if (mod->inner_types.items[i]->kind == VT_V128) mod->uses_v128 = true;
+    }
+    for (size_t i = 0; i < mod->structs.count; i++) {
+        StructType* s = &mod->structs.items[i];
+        for (size_t j = 0; j < s->count; j++) {
+            if (s->items[j].vt.kind == VT_V128) mod->uses_v128 = true;
+        }
+    }
+
+    if (mod->uses_v128 && mod->no_simd) {
+        fprintf(diag_out(), "v128 values can't be used without SIMD!\n");
+        diag_fail();
+    }
+}
+
+// memory layout
+
+#define FREE_LISTS 32  // one for each power of two block size
+
+static size_t constants_size(Module* mod) {
+    StringConstants* sc = &mod->string_constants;
+    if (sc->count == 0) return 0;
+    return sc->items[sc->count - 1].offset + sc->items[sc->count - 1].len;
+}
+
+// heads of free lists of the allocator are at heap base, blocks are
+// allocated after them
+static void compute_memory_layout(Module* mod, CodegenOptions options) {
+    MemoryLayout* l = &mod->layout;
+    size_t stack_size = options.stack_size;
+    if (stack_size == 0) stack_size = DEFAULT_STACK_SIZE;
+
+    l->stack_start = align16(constants_size(mod));
+    l->stack_end = align16(l->stack_start + stack_size);
+    l->heap_base = l->stack_end;
+
+    // globals hold heap base and free lists end as i32 addresses
+    if (l->heap_base + FREE_LISTS * 4 > (size_t)MAX_PAGES * PAGE_SIZE) {
+        fprintf(diag_out(),
+                "Constants and stack of %zu bytes don't fit in 4 GiB of "
+                "memory!\n",
+                l->heap_base);
+        diag_fail();
+    }
+
+    size_t used = l->heap_base;
+    if (uses_allocator(mod)) used += FREE_LISTS * 4;
+    size_t min_pages = (used + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    l->initial_pages = options.initial_memory / PAGE_SIZE;
+    if (l->initial_pages == 0) {
+        l->initial_pages = DEFAULT_PAGES;
+        if (min_pages > l->initial_pages) l->initial_pages = min_pages;
+    } else if (l->initial_pages < min_pages) {
+        fprintf(diag_out(),
+                "Initial memory of %zu bytes can't fit constants and stack, "
+                "%zu bytes are needed!\n",
+                options.initial_memory, min_pages * PAGE_SIZE);
+        diag_fail();
+    }
+
+    if (l->initial_pages > MAX_PAGES) {
+        fprintf(diag_out(),
+                "Initial memory of %zu bytes is larger than 4 GiB!\n",
+                options.initial_memory);
+        diag_fail();
+    }
+
+    l->max_pages = options.max_memory / PAGE_SIZE;
+    if (l->max_pages > MAX_PAGES) {
+        fprintf(diag_out(), "Max memory of %zu bytes is larger than 4 GiB!\n",
+                options.max_memory);
+        diag_fail();
+    }
+    if (l->max_pages && l->max_pages < l->initial_pages) {
+        fprintf(diag_out(),
+                "Max memory of %zu bytes is smaller than initial memory of "
+                "%zu bytes!\n",
+                options.max_memory, l->initial_pages * PAGE_SIZE);
+        diag_fail();
+    }
+}
+
+// allocator, blocks have power of two sizes of at least 16 bytes and start
+// with 8 byte header holding size class and next free block
+
+static ByteBuffer codegen_runtime_alloc(Module* mod) {
+    ByteBuffer code = {0};
+    // locals: 0 size, 1 class, 2 free list head, 3 block, 4 new heap top
+    bb_append_bytes(&code, (uint8_t[]){0x01, 0x04, 0x7F}, 3);
+
+    // class = max(4, bit length of size + 7), sizes which would wrap the
+    // sum can't be allocated
+    bb_append_bytes(&code,
+                    (uint8_t[]){
+                        0x20, 0x00,  // local.get size
+                        0x41, 0xF8, 0xFF, 0xFF, 0xFF, 0x07,  // i32.const 2^31-8
+                        0x4B,        // i32.gt_u
+                        0x04, 0x40,  // if
+                        0x00,        // unreachable
+                        0x0B,        // end
+                        0x41, 0x20,  // i32.const 32
+                        0x20, 0x00,  // local.get size
+                        0x41, 0x07,  // i32.const 7
+                        0x6A,        // i32.add
+                        0x67,        // i32.clz
+                        0x6B,        // i32.sub
+                        0x22, 0x01,  // local.tee class
+                        0x41, 0x04,  // i32.const 4
+                        0x20, 0x01,  // local.get class
+                        0x41, 0x04,  // i32.const 4
+                        0x4B,        // i32.gt_u
+                        0x1B,        // select
+                        0x21, 0x01,  // local.set class
+                        // blocks of 2 GiB or more can't be allocated
+                        0x20, 0x01,  // local.get class
+                        0x41, 0x1E,  // i32.const 30
+                        0x4B,        // i32.gt_u
+                        0x04, 0x40,  // if
+                        0x00,        // unreachable
+                        0x0B,        // end
+                        0x20, 0x01,  // local.get class
+                        0x41, 0x02,  // i32.const 2
+                        0x74,        // i32.shl
+                        0x41,        // i32.const
+                    },
+                    49);
+    bb_append_leb128_s(&code, (int32_t)mod->layout.heap_base);
+    bb_append_bytes(&code,
+                    (uint8_t[]){
+                        0x6A,              // i32.add
+                        0x21, 0x02,        // local.set head
+                        0x20, 0x02,        // local.get head
+                        0x28, 0x02, 0x00,  // i32.load
+                        0x22, 0x03,        // local.tee block
+                        0x04, 0x40,        // if
+                        // reuse first free block
+                        0x20, 0x02,        // local.get head
+                        0x20, 0x03,        // local.get block
+                        0x28, 0x02, 0x04,  // i32.load offset=4
+                        0x36, 0x02, 0x00,  // i32.store
+                        0x05,              // else
+                        // take new block from heap top
+                        0x23, GLOBAL_HEAP_TOP,  // global.get heap_top
+                        0x22, 0x03,             // local.tee block
+                        0x41, 0x01,             // i32.const 1
+                        0x20, 0x01,             // local.get class
+                        0x74,                   // i32.shl
+                        0x6A,                   // i32.add
+                        0x22, 0x04,             // local.tee top
+                        0x3F, 0x00,             // memory.size
+                        0x41, 0x10,             // i32.const 16
+                        0x74,                   // i32.shl
+                        0x4B,                   // i32.gt_u
+                        0x04, 0x40,             // if
+                        // grow by pages missing up to new top
+                        0x20, 0x04,        // local.get top
+                        0x3F, 0x00,        // memory.size
+                        0x41, 0x10,        // i32.const 16
+                        0x74,              // i32.shl
+                        0x6B,              // i32.sub
+                        0x41, 0xFF, 0xFF, 0x03,  // i32.const 65535
+                        0x6A,              // i32.add
+                        0x41, 0x10,        // i32.const 16
+                        0x76,              // i32.shr_u
+                        0x40, 0x00,        // memory.grow
+                        0x41, 0x7F,        // i32.const -1
+                        0x46,              // i32.eq
+                        0x04, 0x40,        // if
+                        0x00,              // unreachable
+                        0x0B,              // end
+                        0x0B,              // end
+                        0x20, 0x04,             // local.get top
+                        0x24, GLOBAL_HEAP_TOP,  // global.set heap_top
+                        0x0B,                   // end
+                        // header and slice of requested size after it
+                        0x20, 0x03,        // local.get block
+                        0x20, 0x01,        // local.get class
+                        0x36, 0x02, 0x00,  // i32.store
+                        0x20, 0x00,        // local.get size
+                        0xAD,              // i64.extend_i32_u
+                        0x42, 0x20,        // i64.const 32
+                        0x86,              // i64.shl
+                        0x20, 0x03,        // local.get block
+                        0x41, 0x08,        // i32.const 8
+                        0x6A,              // i32.add
+                        0xAD,              // i64.extend_i32_u
+                        0x84,              // i64.or
+                        0x0B,              // end
+                    },
+                    95);
+    return code;
+}
+
+static ByteBuffer codegen_runtime_free(Module* mod) {
+    ByteBuffer code = {0};
+    // locals: 0 slice, 1 block, 2 free list head
+    bb_append_bytes(&code, (uint8_t[]){0x01, 0x02, 0x7F}, 3);
+
+    bb_append_bytes(&code,
+                    (uint8_t[]){
+                        0x20, 0x00,        // local.get slice
+                        0xA7,              // i32.wrap_i64
+                        0x22, 0x01,        // local.tee block
+                        0x45,              // i32.eqz
+                        0x04, 0x40,        // if
+                        0x0F,              // return
+                        0x0B,              // end
+                        0x20, 0x01,        // local.get block
+                        0x41, 0x08,        // i32.const 8
+                        0x6B,              // i32.sub
+                        0x22, 0x01,        // local.tee block
+                        0x28, 0x02, 0x00,  // i32.load
+                        0x41, 0x02,        // i32.const 2
+                        0x74,              // i32.shl
+                        0x41,              // i32.const
+                    },
+                    24);
+    bb_append_leb128_s(&code, (int32_t)mod->layout.heap_base);
+    bb_append_bytes(&code,
+                    (uint8_t[]){
+                        0x6A,              // i32.add
+                        0x21, 0x02,        // local.set head
+                        // push block to the free list
+                        0x20, 0x01,        // local.get block
+                        0x20, 0x02,        // local.get head
+                        0x28, 0x02, 0x00,  // i32.load
+                        0x36, 0x02, 0x04,  // i32.store offset=4
+                        0x20, 0x02,        // local.get head
+                        0x20, 0x01,        // local.get block
+                        0x36, 0x02, 0x00,  // i32.store
+                        0x0B,              // end
+                    },
+                    21);
+    return code;
+}
+
+// slice kernels, they process 16 bytes at a time with SIMD and the rest in a
+// scalar loop, which does all the work when SIMD is disabled
+
+// declares i32 locals and a v128 one after them, if SIMD is used
+static void bb_append_kernel_locals(ByteBuffer* code, Module* mod,
+                                    size_t i32_count) {
+    bb_append_leb128_u(code, mod->no_simd ? 1 : 2);
+    bb_append_leb128_u(code, i32_count);
+    da_append(*code, 0x7F);  // i32
+    if (!mod->no_simd) {
+        bb_append_leb128_u(code, 1);
+        da_append(*code, 0x7B);  // v128
+    }
+}
+
+// splits slice param into its pointer and length locals
+static void bb_append_unpack_slice(ByteBuffer* code, size_t param,
+                                   size_t ptr, size_t len) {
+    uint8_t unpack[] = {
+        0x20, param,  // local.get slice
+        0xA7,         // i32.wrap_i64
+        0x21, ptr,    // local.set ptr
+        0x20, param,  // local.get slice
+        0x42, 0x20,   // i64.const 32
+        0x88,         // i64.shr_u
+        0xA7,         // i32.wrap_i64
+        0x21, len,    // local.set len
+    };
+    bb_append_bytes(code, unpack, sizeof(unpack));
+}
+
+// starts loop over i which leaves it, when fewer than step bytes are left
+static void bb_append_kernel_loop(ByteBuffer* code, size_t i, size_t len,
+                                  uint8_t step) {
+    uint8_t loop[] = {
+        0x02, 0x40,  // block
+        0x03, 0x40,  // loop
+        0x20, i,     // local.get i
+        0x41, step,  // i32.const step
+        0x6A,        // i32.add
+        0x20, len,   // local.get len
+        0x4B,        // i32.gt_u
+        0x0D, 0x01,  // br_if to block end
+    };
+    bb_append_bytes(code, loop, sizeof(loop));
+}
+
+// advances i by step and ends loop started by bb_append_kernel_loop
+static void bb_append_kernel_loop_end(ByteBuffer* code, size_t i,
+                                      uint8_t step) {
+    uint8_t end[] = {
+        0x20, i,     // local.get i
+        0x41, step,  // i32.const step
+        0x6A,        // i32.add
+        0x21, i,     // local.set i
+        0x0C, 0x00,  // br to loop start
+        0x0B,        // end of loop
+        0x0B,        // end of block
+    };
+    bb_append_bytes(code, end, sizeof(end));
+}
+
+// index of first byte equal to needle, length of slice if there is none
+static ByteBuffer codegen_runtime_find(Module* mod) {
+    ByteBuffer code = {0};
+    // locals: 0 slice, 1 needle, 2 ptr, 3 len, 4 i, 5 mask, 6 needles
+    bb_append_kernel_locals(&code, mod, 4);
+    bb_append_unpack_slice(&code, 0, 2, 3);
+
+    if (!mod->no_simd) {
+        uint8_t splat[] = {
+            0x20, 0x01,  // local.get needle
+            0xFD, 0x0F,  // i8x16.splat
+            0x21, 0x06,  // local.set needles
+        };
+        bb_append_bytes(&code, splat, sizeof(splat));
+        bb_append_kernel_loop(&code, 4, 3, 16);
+        uint8_t body[] = {
+            0x20, 0x02,              // local.get ptr
+            0x20, 0x04,              // local.get i
+            0x6A,                    // i32.add
+            0xFD, 0x00, 0x00, 0x00,  // v128.load
+            0x20, 0x06,              // local.get needles
+            0xFD, 0x23,              // i8x16.eq
+            0xFD, 0x64,              // i8x16.bitmask
+            0x22, 0x05,              // local.tee mask
+            0x04, 0x40,              // if
+            0x20, 0x04,              // local.get i
+            0x20, 0x05,              // local.get mask
+            0x68,                    // i32.ctz
+            0x6A,                    // i32.add
+            0x0F,                    // return
+            0x0B,                    // end
+        };
+        bb_append_bytes(&code, body, sizeof(body));
+        bb_append_kernel_loop_end(&code, 4, 16);
+    }
+
+    bb_append_kernel_loop(&code, 4, 3, 1);
+    uint8_t tail[] = {
+        0x20, 0x02,        // local.get ptr
+        0x20, 0x04,        // local.get i
+        0x6A,              // i32.add
+        0x2D, 0x00, 0x00,  // i32.load8_u
+        0x20, 0x01,        // local.get needle
+        0x46,              // i32.eq
+        0x04, 0x40,        // if
+        0x20, 0x04,        // local.get i
+        0x0F,              // return
+        0x0B,              // end
+    };
+    bb_append_bytes(&code, tail, sizeof(tail));
+    bb_append_kernel_loop_end(&code, 4, 1);
+
+    uint8_t end[] = {
+        0x20, 0x03,  // local.get len
+        0x0B,        // end
+    };
+    bb_append_bytes(&code, end, sizeof(end));
+    return code;
+}
+
+// number of bytes equal to needle
+static ByteBuffer codegen_runtime_count(Module* mod) {
+    ByteBuffer code = {0};
+    // locals: 0 slice, 1 needle, 2 ptr, 3 len, 4 i, 5 n, 6 needles
+    bb_append_kernel_locals(&code, mod, 4);
+    bb_append_unpack_slice(&code, 0, 2, 3);
+
+    if (!mod->no_simd) {
+        uint8_t splat[] = {
+            0x20, 0x01,  // local.get needle
+            0xFD, 0x0F,  // i8x16.splat
+            0x21, 0x06,  // local.set needles
+        };
+        bb_append_bytes(&code, splat, sizeof(splat));
+        bb_append_kernel_loop(&code, 4, 3, 16);
+        uint8_t body[] = {
+            0x20, 0x05,              // local.get n
+            0x20, 0x02,              // local.get ptr
+            0x20, 0x04,              // local.get i
+            0x6A,                    // i32.add
+            0xFD, 0x00, 0x00, 0x00,  // v128.load
+            0x20, 0x06,              // local.get needles
+            0xFD, 0x23,              // i8x16.eq
+            0xFD, 0x64,              // i8x16.bitmask
+            0x69,                    // i32.popcnt
+            0x6A,                    // i32.add
+            0x21, 0x05,              // local.set n
+        };
+        bb_append_bytes(&code, body, sizeof(body));
+        bb_append_kernel_loop_end(&code, 4, 16);
+    }
+
+    bb_append_kernel_loop(&code, 4, 3, 1);
+    uint8_t tail[] = {
+        0x20, 0x05,        // local.get n
+        0x20, 0x02,        // local.get ptr
+        0x20, 0x04,        // local.get i
+        0x6A,              // i32.add
+        0x2D, 0x00, 0x00,  // i32.load8_u
+        0x20, 0x01,        // local.get needle
+        0x46,              // i32.eq
+        0x6A,              // i32.add
+        0x21, 0x05,        // local.set n
+    };
+    bb_append_bytes(&code, tail, sizeof(tail));
+    bb_append_kernel_loop_end(&code, 4, 1);
+
+    uint8_t end[] = {
+        0x20, 0x05,  // local.get n
+        0x0B,        // end
+    };
+    bb_append_bytes(&code, end, sizeof(end));
+    return code;
+}
+
+// compares lengths and contents of two slices
+static ByteBuffer codegen_runtime_equal(Module* mod) {
+    ByteBuffer code = {0};
+    // locals: 0 a, 1 b, 2 a ptr, 3 len, 4 i, 5 b ptr
+    bb_append_kernel_locals(&code, mod, 4);
+
+    uint8_t lengths[] = {
+        0x20, 0x00,  // local.get a
+        0x20, 0x01,  // local.get b
+        0x85,        // i64.xor
+        0x42, 0x20,  // i64.const 32
+        0x88,        // i64.shr_u
+        0x50,        // i64.eqz
+        0x45,        // i32.eqz
+        0x04, 0x40,  // if
+        0x41, 0x00,  // i32.const 0
+        0x0F,        // return
+        0x0B,        // end
+        0x20, 0x01,  // local.get b
+        0xA7,        // i32.wrap_i64
+        0x21, 0x05,  // local.set b ptr
+    };
+    bb_append_bytes(&code, lengths, sizeof(lengths));
+    bb_append_unpack_slice(&code, 0, 2, 3);
+
+    if (!mod->no_simd) {
+        bb_append_kernel_loop(&code, 4, 3, 16);
+        uint8_t body[] = {
+            0x20, 0x02,              // local.get a ptr
+            0x20, 0x04,              // local.get i
+            0x6A,                    // i32.add
+            0xFD, 0x00, 0x00, 0x00,  // v128.load
+            0x20, 0x05,              // local.get b ptr
+            0x20, 0x04,              // local.get i
+            0x6A,                    // i32.add
+            0xFD, 0x00, 0x00, 0x00,  // v128.load
+            0xFD, 0x51,              // v128.xor
+            0xFD, 0x53,              // v128.any_true
+            0x04, 0x40,              // if
+            0x41, 0x00,              // i32.const 0
+            0x0F,                    // return
+            0x0B,                    // end
+        };
+        bb_append_bytes(&code, body, sizeof(body));
+        bb_append_kernel_loop_end(&code, 4, 16);
+    }
+
+    bb_append_kernel_loop(&code, 4, 3, 1);
+    uint8_t tail[] = {
+        0x20, 0x02,        // local.get a ptr
+        0x20, 0x04,        // local.get i
+        0x6A,              // i32.add
+        0x2D, 0x00, 0x00,  // i32.load8_u
+        0x20, 0x05,        // local.get b ptr
+        0x20, 0x04,        // local.get i
+        0x6A,              // i32.add
+        0x2D, 0x00, 0x00,  // i32.load8_u
+        0x47,              // i32.ne
+        0x04, 0x40,        // if
+        0x41, 0x00,        // i32.const 0
+        0x0F,              // return
+        0x0B,              // end
+    };
+    bb_append_bytes(&code, tail, sizeof(tail));
+    bb_append_kernel_loop_end(&code, 4, 1);
+
+    uint8_t end[] = {
+        0x41, 0x01,  // i32.const 1
+        0x0B,        // end
+    };
+    bb_append_bytes(&code, end, sizeof(end));
+    return code;
+}
+
+// wrapping sum of u32 items, i and len count bytes
+static ByteBuffer codegen_runtime_sum(Module* mod) {
+    ByteBuffer code = {0};
+    // locals: 0 slice, 1 ptr, 2 len, 3 i, 4 n, 5 sums
+    bb_append_kernel_locals(&code, mod, 4);
+    bb_append_unpack_slice(&code, 0, 1, 2);
+
+    uint8_t bytes[] = {
+        0x20, 0x02,  // local.get len
+        0x41, 0x02,  // i32.const 2
+        0x74,        // i32.shl
+        0x21, 0x02,  // local.set len
+    };
+    bb_append_bytes(&code, bytes, sizeof(bytes));
+
+    if (!mod->no_simd) {
+        bb_append_kernel_loop(&code, 3, 2, 16);
+        uint8_t body[] = {
+            0x20, 0x05,              // local.get sums
+            0x20, 0x01,              // local.get ptr
+            0x20, 0x03,              // local.get i
+            0x6A,                    // i32.add
+            0xFD, 0x00, 0x00, 0x00,  // v128.load
+            0xFD, 0xAE, 0x01,        // i32x4.add
+            0x21, 0x05,              // local.set sums
+        };
+        bb_append_bytes(&code, body, sizeof(body));
+        bb_append_kernel_loop_end(&code, 3, 16);
+
+        uint8_t lanes[] = {
+            0x20, 0x05,        // local.get sums
+            0xFD, 0x1B, 0x00,  // i32x4.extract_lane 0
+            0x20, 0x05,        // local.get sums
+            0xFD, 0x1B, 0x01,  // i32x4.extract_lane 1
+            0x6A,              // i32.add
+            0x20, 0x05,        // local.get sums
+            0xFD, 0x1B, 0x02,  // i32x4.extract_lane 2
+            0x6A,              // i32.add
+            0x20, 0x05,        // local.get sums
+            0xFD, 0x1B, 0x03,  // i32x4.extract_lane 3
+            0x6A,              // i32.add
+            0x21, 0x04,        // local.set n
+        };
+        bb_append_bytes(&code, lanes, sizeof(lanes));
+    }
+
+    bb_append_kernel_loop(&code, 3, 2, 4);
+    uint8_t tail[] = {
+        0x20, 0x04,        // local.get n
+        0x20, 0x01,        // local.get ptr
+        0x20, 0x03,        // local.get i
+        0x6A,              // i32.add
+        0x28, 0x00, 0x00,  // i32.load
+        0x6A,              // i32.add
+        0x21, 0x04,        // local.set n
+    };
+    bb_append_bytes(&code, tail, sizeof(tail));
+    bb_append_kernel_loop_end(&code, 3, 4);
+
+    uint8_t end[] = {
+        0x20, 0x04,  // local.get n
+        0x0B,        // end
+    };
+    bb_append_bytes(&code, end, sizeof(end));
+    return code;
+}
+
+static ByteBuffer codegen_runtime_function(Module* mod, Builtin b) {
+    switch (b) {
+        case BUILTIN_ALLOC:
+            return codegen_runtime_alloc(mod);
+        case BUILTIN_FREE:
+            return codegen_runtime_free(mod);
+        case BUILTIN_FIND:
+            return codegen_runtime_find(mod);
+        case BUILTIN_EQUAL:
+            return codegen_runtime_equal(mod);
+        case BUILTIN_SUM:
+            return codegen_runtime_sum(mod);
+        case BUILTIN_COUNT_BYTE:
+            return codegen_runtime_count(mod);
+        case BUILTIN_COPY:
+        case BUILTIN_FILL:
+        case BUILTIN_ZERO:
+        case BUILTIN_COUNT:
+            break;
+    }
+    assert(false && "Unreachable");
+    return (ByteBuffer){0};
+}
+
 // sections
 
 Section codegen_types(Module* mod) {
@@ -1097,6 +3293,34 @@ Section codegen_types(Module* mod) {
         free(ft.items);
     }
 
+    for (Builtin b = 0; b < RUNTIME_BUILTINS; b++) {
+        if (!builtin_used(mod, b)) continue;
+        BuiltinSignature* sig = &builtins[b];
+        ByteBuffer ft = {0};
+        da_append(ft, 0x60);
+
+        Vec param_types = {0};
+        for (size_t j = 0; j < sig->arity; j++) {
+            ByteBuffer param_type = codegen_value_type(mod, sig->params[j]);
+            vec_append_elem(&param_types, &param_type);
+            free(param_type.items);
+        }
+        bb_append_vec(&ft, &param_types);
+        free(param_types.content.items);
+
+        Vec result_types = {0};
+        if (sig->return_type.kind != VT_NIL) {
+            ByteBuffer result_type = codegen_value_type(mod, sig->return_type);
+            vec_append_elem(&result_types, &result_type);
+            free(result_type.items);
+        }
+        bb_append_vec(&ft, &result_types);
+        free(result_types.content.items);
+
+        vec_append_elem(&types, &ft);
+        free(ft.items);
+    }
+
     bb_append_vec(&type_section.content, &types);
     free(types.content.items);
 
@@ -1115,6 +3339,14 @@ Section codegen_funcs(Module* mod) {
         free(fn.items);
     }
 
+    for (Builtin b = 0; b < RUNTIME_BUILTINS; b++) {
+        if (!builtin_used(mod, b)) continue;
+        ByteBuffer fn = {0};
+        bb_append_leb128_u(&fn, builtin_type_index(mod, b));
+        vec_append_elem(&funcs, &fn);
+        free(fn.items);
+    }
+
     bb_append_vec(&func_section.content, &funcs);
     free(funcs.content.items);
 
@@ -1126,17 +3358,19 @@ Section codegen_import(Module* mod) {
 
     Vec imports = {0};
 
+    // names of extern functions, by their index
+    char** names = calloc(mod->extern_functions.count, sizeof(char*));
+    assert(names || mod->extern_functions.count == 0);
+    for (size_t j = 0; j < mod->scopes.items[0].count; j++) {
+        Decl* d = &mod->scopes.items[0].items[j];
+        if (d->kind == DK_EXTERN_FUNCTION) names[d->value.func_index] = d->name;
+    }
+
     for (size_t i = 0; i < mod->extern_functions.count; i++) {
         ByteBuffer imp = {0};
         // TODO make module name customizable
         bb_append_name(&imp, "env");  // module
-        char* name = NULL;
-        for (size_t j = 0; j < mod->scopes.items[0].count; j++) {
-            Decl* d = &mod->scopes.items[0].items[j];
-            if (d->kind == DK_EXTERN_FUNCTION && d->value.func_index == i) {
-                name = d->name;
-            }
-        }
+        char* name = names[i];
         if (name == NULL) {
             assert(false && "Could not find decl of extern function");
         }
@@ -1146,6 +3380,7 @@ Section codegen_import(Module* mod) {
         vec_append_elem(&imports, &imp);
         free(imp.items);
     }
+    free(names);
 
     bb_append_vec(&import_section.content, &imports);
     free(imports.content.items);
@@ -1153,6 +3388,27 @@ Section codegen_import(Module* mod) {
     return import_section;
 }
 
+Section codegen_table(Module* mod) {
+    Section table_section = {.id = SID_TABLE};
+
+    Vec tables = {0};
+
+    {
+        ByteBuffer table0 = {0};
+        da_append(table0, 0x70);  // funcref
+        da_append(table0, 0x01);  // limit: min..max
+        bb_append_leb128_u(&table0, mod->table_size);
+        bb_append_leb128_u(&table0, mod->table_size);
+        vec_append_elem(&tables, &table0);
+        free(table0.items);
+    }
+
+    bb_append_vec(&table_section.content, &tables);
+    free(tables.content.items);
+
+    return table_section;
+}
+
 Section codegen_mem(Module* mod) {
     Section mem_section = {.id = SID_MEMORY};
 
@@ -1160,8 +3416,14 @@ Section codegen_mem(Module* mod) {
 
     {
         ByteBuffer memory0 = {0};
-        da_append(memory0, 0x00);  // limit: min..
-        bb_append_leb128_u(&memory0, 2);
+        if (mod->layout.max_pages) {
+            da_append(memory0, 0x01);  // limit: min..max
+            bb_append_leb128_u(&memory0, mod->layout.initial_pages);
+            bb_append_leb128_u(&memory0, mod->layout.max_pages);
+        } else {
+            da_append(memory0, 0x00);  // limit: min..
+            bb_append_leb128_u(&memory0, mod->layout.initial_pages);
+        }
         vec_append_elem(&mems, &memory0);
         free(memory0.items);
     }
@@ -1177,24 +3439,44 @@ Section codegen_global(Module* mod) {
 
     Vec globals = {0};
 
-    size_t constants_size = 0;
-    for (size_t i = 0; i < mod->string_constants.count; i++) {
-        constants_size += mod->string_constants.items[i].len;
-    }
-
     {
         ByteBuffer stack_ptr = {0};
         da_append(stack_ptr, 0x7F);  // i32
         da_append(stack_ptr, 0x01);  // mut
         da_append(stack_ptr, 0x41);  // opcode for i32.const
-        bb_append_leb128_u(
-            &stack_ptr,
-            constants_size);        // start execution stack after constants
+        // start execution stack after constants
+        bb_append_leb128_s(&stack_ptr, (int32_t)mod->layout.stack_start);
         da_append(stack_ptr, 0xB);  // opcode for end
         vec_append_elem(&globals, &stack_ptr);
         free(stack_ptr.items);
     }
 
+    // exported for hosts, so they can place their data after the stack
+    size_t layout_globals[] = {mod->layout.heap_base, mod->layout.stack_end};
+    for (size_t i = 0; i < 2; i++) {
+        ByteBuffer global = {0};
+        da_append(global, 0x7F);  // i32
+        da_append(global, 0x00);  // const
+        da_append(global, 0x41);  // opcode for i32.const
+        bb_append_leb128_s(&global, (int32_t)layout_globals[i]);
+        da_append(global, 0xB);  // opcode for end
+        vec_append_elem(&globals, &global);
+        free(global.items);
+    }
+
+    if (uses_allocator(mod)) {
+        ByteBuffer heap_top = {0};
+        da_append(heap_top, 0x7F);  // i32
+        da_append(heap_top, 0x01);  // mut
+        da_append(heap_top, 0x41);  // opcode for i32.const
+        // blocks are allocated after free lists
+        bb_append_leb128_s(&heap_top,
+                           (int32_t)(mod->layout.heap_base + FREE_LISTS * 4));
+        da_append(heap_top, 0xB);  // opcode for end
+        vec_append_elem(&globals, &heap_top);
+        free(heap_top.items);
+    }
+
     bb_append_vec(&global_section.content, &globals);
     free(globals.content.items);
 
@@ -1215,12 +3497,32 @@ Section codegen_exports(Module* mod) {
         free(bb.items);
     }
 
+    {  // memory layout exports
+        ByteBuffer bb = {0};
+        bb_append_name(&bb, "__heap_base");
+        da_append(bb, 0x03);  // global
+        bb_append_leb128_u(&bb, GLOBAL_HEAP_BASE);
+        vec_append_elem(&exports, &bb);
+
+        bb.count = 0;
+        bb_append_name(&bb, "__stack_end");
+        da_append(bb, 0x03);  // global
+        bb_append_leb128_u(&bb, GLOBAL_STACK_END);
+        vec_append_elem(&exports, &bb);
+        free(bb.items);
+    }
+
     for (size_t i = 0; i < mod->exports.count; i++) {
         Decl* decl = find_global_decl(mod, mod->exports.items[i].decl_name);
-        assert(decl && "Cannot export undeclared function");
+        if (!decl) {
+            fprintf(diag_out(), "Cannot export undeclared `%s`!\n",
+                    mod->exports.items[i].decl_name);
+            diag_fail();
+        }
         if (decl->kind != DK_FUNCTION) {
-            fprintf(stderr, "Unsupported export decl kind %d!\n", decl->kind);
-            exit(1);
+            fprintf(diag_out(),
+                    "Unsupported export decl kind %d!\n", decl->kind);
+            diag_fail();
         }
 
         ByteBuffer ex = {0};
@@ -1240,6 +3542,46 @@ Section codegen_exports(Module* mod) {
     return export_section;
 }
 
+Section codegen_elements(Module* mod) {
+    Section element_section = {.id = SID_ELEMENT};
+
+    Vec elements = {0};
+
+    {  // functions used as values, in order of their slots
+        ByteBuffer bb = {0};
+        bb_append_leb128_u(&bb, 0);  // active elements in table 0
+        da_append(bb, 0x41);         // opcode for i32.const
+        bb_append_leb128_u(&bb, 1);  // after null slot
+        da_append(bb, 0x0B);         // opcode for end
+
+        Vec funcs = {0};
+        ByteBuffer fn = {0};
+        for (size_t i = 0; i < mod->extern_functions.count; i++) {
+            if (!mod->extern_functions.items[i].table_slot) continue;
+            bb_append_leb128_u(&fn, i);
+            vec_append_elem(&funcs, &fn);
+            fn.count = 0;
+        }
+        for (size_t i = 0; i < mod->functions.count; i++) {
+            if (!mod->functions.items[i].table_slot) continue;
+            bb_append_leb128_u(&fn, i + mod->extern_functions.count);
+            vec_append_elem(&funcs, &fn);
+            fn.count = 0;
+        }
+        free(fn.items);
+        bb_append_vec(&bb, &funcs);
+        free(funcs.content.items);
+
+        vec_append_elem(&elements, &bb);
+        free(bb.items);
+    }
+
+    bb_append_vec(&element_section.content, &elements);
+    free(elements.content.items);
+
+    return element_section;
+}
+
 Section codegen_codes(Module* mod) {
     Section code_section = {.id = SID_CODE};
 
@@ -1256,6 +3598,18 @@ Section codegen_codes(Module* mod) {
         free(code.items);
     }
 
+    for (Builtin b = 0; b < RUNTIME_BUILTINS; b++) {
+        if (!builtin_used(mod, b)) continue;
+        ByteBuffer code = {0};
+        ByteBuffer func = codegen_runtime_function(mod, b);
+        bb_append_leb128_u(&code, func.count);
+        bb_append_bb(&code, &func);
+        free(func.items);
+
+        vec_append_elem(&codes, &code);
+        free(code.items);
+    }
+
     bb_append_vec(&code_section.content, &codes);
     free(codes.content.items);
 
@@ -1290,6 +3644,7 @@ Section codegen_datas(Module* mod) {
 
             free(byte.items);
             bb_append_vec(&bb, &bytes);
+            free(bytes.content.items);
         }
 
         vec_append_elem(&datas, &bb);
@@ -1302,60 +3657,125 @@ Section codegen_datas(Module* mod) {
     return code_section;
 }
 
-ByteBuffer codegen_module(Module* mod) {
-    Generator gen = {0};
+ByteBuffer codegen_module(Module* mod, CodegenOptions options) {
+    ByteBuffer output = {0};
+    codegen_module_into(mod, options, &output);
+    return output;
+}
+
+void codegen_module_into(Module* mod, CodegenOptions options,
+                         ByteBuffer* output) {
+    output->count = 0;
+
+    // string constants are laid out in order at the start of memory
+    size_t offset = 0;
+    for (size_t i = 0; i < mod->string_constants.count; i++) {
+        mod->string_constants.items[i].offset = offset;
+        offset += mod->string_constants.items[i].len;
+    }
+    mod->no_simd = options.no_simd;
+    mod->bounds_checks = options.bounds_checks;
+    compute_struct_layouts(mod);
+    find_runtime_calls(mod);
+    compute_memory_layout(mod, options);
+
     // magic
-    bb_append_bytes(&gen.output_buffer, (uint8_t[]){0x00, 0x61, 0x73, 0x6D}, 4);
+    bb_append_bytes(output, (uint8_t[]){0x00, 0x61, 0x73, 0x6D}, 4);
     // version
-    bb_append_bytes(&gen.output_buffer, (uint8_t[]){0x01, 0x00, 0x00, 0x00}, 4);
+    bb_append_bytes(output, (uint8_t[]){0x01, 0x00, 0x00, 0x00}, 4);
 
     {  // types
+        uint64_t start = stats_now();
         Section type_section = codegen_types(mod);
-        bb_append_section(&gen.output_buffer, &type_section);
+        stats_end_phase(PHASE_CODEGEN_TYPES, start);
+        stats.section_bytes[PHASE_CODEGEN_TYPES] += type_section.content.count;
+        bb_append_section(output, &type_section);
         free(type_section.content.items);
     }
 
     {  // import
+        uint64_t start = stats_now();
         Section import_section = codegen_import(mod);
-        bb_append_section(&gen.output_buffer, &import_section);
+        stats_end_phase(PHASE_CODEGEN_IMPORT, start);
+        stats.section_bytes[PHASE_CODEGEN_IMPORT] +=
+            import_section.content.count;
+        bb_append_section(output, &import_section);
         free(import_section.content.items);
     }
 
     {  // funcs
+        uint64_t start = stats_now();
         Section funcs_section = codegen_funcs(mod);
-        bb_append_section(&gen.output_buffer, &funcs_section);
+        stats_end_phase(PHASE_CODEGEN_FUNCS, start);
+        stats.section_bytes[PHASE_CODEGEN_FUNCS] += funcs_section.content.count;
+        bb_append_section(output, &funcs_section);
         free(funcs_section.content.items);
     }
 
+    if (mod->table_size) {  // table
+        uint64_t start = stats_now();
+        Section table_section = codegen_table(mod);
+        stats_end_phase(PHASE_CODEGEN_TABLE, start);
+        stats.section_bytes[PHASE_CODEGEN_TABLE] +=
+            table_section.content.count;
+        bb_append_section(output, &table_section);
+        free(table_section.content.items);
+    }
+
     {  // mem
+        uint64_t start = stats_now();
         Section mem_section = codegen_mem(mod);
-        bb_append_section(&gen.output_buffer, &mem_section);
+        stats_end_phase(PHASE_CODEGEN_MEM, start);
+        stats.section_bytes[PHASE_CODEGEN_MEM] += mem_section.content.count;
+        bb_append_section(output, &mem_section);
         free(mem_section.content.items);
     }
 
     {  // global
+        uint64_t start = stats_now();
         Section global_section = codegen_global(mod);
-        bb_append_section(&gen.output_buffer, &global_section);
+        stats_end_phase(PHASE_CODEGEN_GLOBAL, start);
+        stats.section_bytes[PHASE_CODEGEN_GLOBAL] +=
+            global_section.content.count;
+        bb_append_section(output, &global_section);
         free(global_section.content.items);
     }
 
     {  // exports
+        uint64_t start = stats_now();
         Section export_section = codegen_exports(mod);
-        bb_append_section(&gen.output_buffer, &export_section);
+        stats_end_phase(PHASE_CODEGEN_EXPORTS, start);
+        stats.section_bytes[PHASE_CODEGEN_EXPORTS] +=
+            export_section.content.count;
+        bb_append_section(output, &export_section);
         free(export_section.content.items);
     }
 
+    if (mod->table_size > 1) {  // elements
+        uint64_t start = stats_now();
+        Section element_section = codegen_elements(mod);
+        stats_end_phase(PHASE_CODEGEN_ELEMENTS, start);
+        stats.section_bytes[PHASE_CODEGEN_ELEMENTS] +=
+            element_section.content.count;
+        bb_append_section(output, &element_section);
+        free(element_section.content.items);
+    }
+
     {  // codes
+        uint64_t start = stats_now();
         Section code_section = codegen_codes(mod);
-        bb_append_section(&gen.output_buffer, &code_section);
+        stats_end_phase(PHASE_CODEGEN_CODES, start);
+        stats.section_bytes[PHASE_CODEGEN_CODES] += code_section.content.count;
+        bb_append_section(output, &code_section);
         free(code_section.content.items);
     }
 
     {  // datas
+        uint64_t start = stats_now();
         Section data_section = codegen_datas(mod);
-        bb_append_section(&gen.output_buffer, &data_section);
+        stats_end_phase(PHASE_CODEGEN_DATAS, start);
+        stats.section_bytes[PHASE_CODEGEN_DATAS] += data_section.content.count;
+        bb_append_section(output, &data_section);
         free(data_section.content.items);
     }
-
-    return gen.output_buffer;
 }
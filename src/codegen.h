@@ -11,6 +11,20 @@ typedef struct {
     da_list(uint8_t);
 } ByteBuffer;
 
-ByteBuffer codegen_module(Module* mod);
+#define PAGE_SIZE (64 * 1024)
+
+// sizes of linear memory in bytes, 0 picks the default
+typedef struct {
+    size_t initial_memory;  // multiple of PAGE_SIZE, default fits the stack
+    size_t max_memory;      // multiple of PAGE_SIZE, no maximum by default
+    size_t stack_size;      // 64 KiB by default
+    bool no_simd;  // for engines without SIMD, builtins use scalar code
+    bool bounds_checks;  // indexing and subslices out of range trap
+} CodegenOptions;
+
+ByteBuffer codegen_module(Module* mod, CodegenOptions options);
+// same as codegen_module, but reuses output's allocation
+void codegen_module_into(Module* mod, CodegenOptions options,
+                         ByteBuffer* output);
 
 #endif
@@ -0,0 +1,68 @@
+#include "compile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "diag.h"
+
+void compile_context_reset(CompileContext* ctx) {
+    module_reset(&ctx->mod);
+    ctx->output.count = 0;
+    ctx->diagnostics.count = 0;
+}
+
+void compile_context_free(CompileContext* ctx) {
+    module_free(&ctx->mod);
+    free(ctx->lexer.window.items);
+    free(ctx->lexer.token_str.items);
+    free(ctx->output.items);
+    free(ctx->diagnostics.items);
+    *ctx = (CompileContext){0};
+}
+
+static bool compile_module(CompileContext* ctx, ParseOptions options) {
+    if (!parse_module(&ctx->lexer, options, &ctx->mod)) return false;
+    codegen_module_into(&ctx->mod, (CodegenOptions){0}, &ctx->output);
+    return true;
+}
+
+bool compile_source(CompileContext* ctx, const char* source, size_t size,
+                    ParseOptions options) {
+    compile_context_reset(ctx);
+
+    diag_capture_begin();
+
+    ctx->lexer = (Lexer){
+        .input_buffer = source,
+        .input_size = size,
+        .window = ctx->lexer.window,
+        .token_str = ctx->lexer.token_str,
+    };
+    // worker threads can't jump back here
+    options.jobs = 0;
+
+    volatile bool ok = false;
+#ifndef __wasi__
+    // after a jump, module is left as it was and gets freed on next reset,
+    // but temporary buffers of the failed phase are lost
+    jmp_buf* prev_diag_recover = diag_recover;
+    jmp_buf recover;
+    if (!setjmp(recover)) {
+        diag_recover = &recover;
+        ok = compile_module(ctx, options);
+    }
+    diag_recover = prev_diag_recover;
+#else
+    ok = compile_module(ctx, options);  // no setjmp, errors still exit
+#endif
+
+    size_t diag_len;
+    char* diag = diag_capture_end(&diag_len);
+    for (size_t i = 0; i < diag_len; i++) {
+        da_append(ctx->diagnostics, diag[i]);
+    }
+    free(diag);
+
+    if (!ok) ctx->output.count = 0;
+    return ok;
+}
@@ -0,0 +1,28 @@
+#ifndef COMPILE_H_
+#define COMPILE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "codegen.h"
+#include "lex.h"
+#include "parse.h"
+
+// state kept between compilations, buffers allocated for one are reused by
+// the next one instead of being freed
+typedef struct {
+    Lexer lexer;
+    Module mod;
+    ByteBuffer output;          // wasm module, if compilation succeeded
+    StringContent diagnostics;  // errors and warnings of last compilation
+} CompileContext;
+
+// compiles whole source held in memory, errors don't exit the process but
+// end up in diagnostics; parsing always happens on calling thread
+bool compile_source(CompileContext* ctx, const char* source, size_t size,
+                    ParseOptions options);
+
+void compile_context_reset(CompileContext* ctx);
+void compile_context_free(CompileContext* ctx);
+
+#endif
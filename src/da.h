@@ -1,6 +1,11 @@
 #ifndef DA_H_
 #define DA_H_
 
+#include <stddef.h>
+
+// bytes allocated by growing lists on this thread, see stats.h
+extern _Thread_local size_t da_allocated_bytes;
+
 #define da_append(arr, it)                                                   \
     do {                                                                     \
         if ((arr).capacity <= (arr).count) {                                 \
@@ -8,6 +13,7 @@
             (arr).items = realloc(                                           \
                 (arr).items, sizeof((arr).items[0]) * ((arr).capacity * 2)); \
             (arr).capacity *= 2;                                             \
+            da_allocated_bytes += sizeof((arr).items[0]) * (arr).capacity;   \
         }                                                                    \
         (arr).items[(arr).count++] = (it);                                   \
     } while (0)
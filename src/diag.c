@@ -0,0 +1,48 @@
+#include "diag.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+_Thread_local FILE* diag_file = NULL;
+#ifndef __wasi__
+_Thread_local jmp_buf* diag_recover = NULL;
+#endif
+
+static _Thread_local char* capture_buffer = NULL;
+static _Thread_local size_t capture_size = 0;
+
+FILE* diag_out(void) { return diag_file ? diag_file : stderr; }
+
+void diag_capture_begin(void) {
+    assert(!diag_file && "Diagnostics are already captured");
+    diag_file = open_memstream(&capture_buffer, &capture_size);
+    assert(diag_file);
+}
+
+char* diag_capture_end(size_t* out_size) {
+    fclose(diag_file);
+    diag_file = NULL;
+    char* captured = capture_buffer;
+    *out_size = capture_size;
+    capture_buffer = NULL;
+    capture_size = 0;
+    return captured;
+}
+
+_Noreturn void diag_fail(void) {
+#ifndef __wasi__
+    if (diag_recover) longjmp(*diag_recover, 1);
+#endif
+    if (diag_file) {  // captured errors would be lost with the process
+        fflush(diag_file);
+        fwrite(capture_buffer, 1, capture_size, stderr);
+    }
+    exit(-1);
+}
+
+_Noreturn void diag_check_failed(const char* expr, const char* file,
+                                 int line) {
+    fprintf(diag_out(), "%s:%d: Internal error, check `%s` failed!\n", file,
+            line, expr);
+    diag_fail();
+}
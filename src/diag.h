@@ -0,0 +1,32 @@
+#ifndef DIAG_H_
+#define DIAG_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#ifndef __wasi__
+#include <setjmp.h>
+#endif
+
+// compilation errors are written to diag_file, or to stderr when it's unset
+extern _Thread_local FILE* diag_file;
+FILE* diag_out(void);
+
+// sets diag_file to memory stream, diag_capture_end returns what was written
+// to it, which caller must free
+void diag_capture_begin(void);
+char* diag_capture_end(size_t* out_size);
+
+// errors which can't be returned to the caller abort compilation, by jumping
+// to diag_recover when current thread has set it and exiting otherwise
+#ifndef __wasi__
+extern _Thread_local jmp_buf* diag_recover;
+#endif
+_Noreturn void diag_fail(void);
+
+// checks an invariant of the compiler, unlike assert it is kept in release
+// builds, so expression may have side effects
+#define diag_check(expr) \
+    ((expr) ? (void)0 : diag_check_failed(#expr, __FILE__, __LINE__))
+_Noreturn void diag_check_failed(const char* expr, const char* file, int line);
+
+#endif
@@ -6,12 +6,59 @@
 #include <stdlib.h>
 #include <string.h>
 
-char lexer_current_char(Lexer* lexer) {
-    if (lexer->offset < lexer->input_size) {
-        return lexer->input_buffer[lexer->offset];
-    } else {
+#include "diag.h"
+#include "stats.h"
+
+// pulls chunks of input until offset `end` is available, returns false if
+// input ends before that
+bool lexer_fill(Lexer* lexer, size_t end) {
+    while (lexer->input_base + lexer->input_size < end) {
+        if (!lexer->refill) return false;
+
+        // drop consumed input, but keep previous token for undoing it,
+        // so only tokens straddling chunk boundary get copied
+        StringContent* w = &lexer->window;
+        size_t drop = lexer->prev_token_offset - lexer->input_base;
+        if (drop) {
+            memmove(w->items, w->items + drop, w->count - drop);
+            w->count -= drop;
+            lexer->input_base += drop;
+        }
+
+        if (w->capacity < w->count + LEXER_CHUNK_SIZE) {
+            w->capacity = w->count + LEXER_CHUNK_SIZE;
+            w->items = realloc(w->items, w->capacity);
+            assert(w->items);
+        }
+
+        size_t read =
+            lexer->refill(lexer->refill_data, w->items + w->count,
+                          LEXER_CHUNK_SIZE);
+        if (read == 0) lexer->refill = NULL;  // end of input
+        w->count += read;
+
+        lexer->input_buffer = w->items;
+        lexer->input_size = w->count;
+        lexer->token_text =
+            lexer->input_buffer + (lexer->token_offset - lexer->input_base);
+    }
+    return true;
+}
+
+char lexer_peek_char(Lexer* lexer, size_t ahead) {
+    size_t at = lexer->offset + ahead;
+    if (at >= lexer->input_base + lexer->input_size &&
+        !lexer_fill(lexer, at + 1)) {
         return '\0';
     }
+    return lexer->input_buffer[at - lexer->input_base];
+}
+
+char lexer_current_char(Lexer* lexer) { return lexer_peek_char(lexer, 0); }
+
+bool lexer_at_end(Lexer* lexer) {
+    return lexer->offset >= lexer->input_base + lexer->input_size &&
+           !lexer_fill(lexer, lexer->offset + 1);
 }
 
 void lexer_consume_char(Lexer* lexer) {
@@ -46,34 +93,36 @@ bool is_beginning_ident_char(char c) {
     }
 }
 
-Token lexer_next_token(Lexer* lexer) {
+static Token lex_token(Lexer* lexer) {
+    lexer->prev_token_offset = lexer->token_offset;
+    lexer->token_offset = lexer->offset;
+
     while (true) {
         bool something_was_done = false;
-        while (isspace(lexer_current_char(lexer)) &&
-               lexer->offset < lexer->input_size) {
+        while (isspace(lexer_current_char(lexer))) {
             lexer_consume_char(lexer);
             something_was_done = true;
         }
 
-        if (lexer->offset == lexer->input_size) return lexer->token = T_END;
+        if (lexer_at_end(lexer)) return lexer->token = T_END;
 
-        if (lexer->input_size - lexer->offset >= 2) {
-            if (lexer_current_char(lexer) == '/' &&
-                lexer->input_buffer[lexer->offset + 1] == '/') {
-                // comment
-                while (lexer_current_char(lexer) != '\n') {
-                    lexer_consume_char(lexer);
-                    something_was_done = true;
-                }
+        if (lexer_current_char(lexer) == '/' &&
+            lexer_peek_char(lexer, 1) == '/') {
+            // comment
+            while (lexer_current_char(lexer) != '\n' && !lexer_at_end(lexer)) {
+                lexer_consume_char(lexer);
+                something_was_done = true;
             }
         }
 
-        if (lexer->offset == lexer->input_size) return lexer->token = T_END;
+        if (lexer_at_end(lexer)) return lexer->token = T_END;
 
         if (!something_was_done) break;
     }
 
-    lexer->token_text = &lexer->input_buffer[lexer->offset];
+    lexer->token_offset = lexer->offset;
+    lexer->token_text =
+        lexer->input_buffer + (lexer->offset - lexer->input_base);
     lexer->token_len = 0;
     lexer->token_start_loc = lexer->token_end_loc;
 
@@ -95,6 +144,10 @@ Token lexer_next_token(Lexer* lexer) {
             strncmp("if", lexer->token_text, lexer->token_len) == 0) {
             return lexer->token = KW_IF;
         }
+        if (lexer->token_len == 4 &&
+            strncmp("then", lexer->token_text, lexer->token_len) == 0) {
+            return lexer->token = KW_THEN;
+        }
         if (lexer->token_len == 4 &&
             strncmp("else", lexer->token_text, lexer->token_len) == 0) {
             return lexer->token = KW_ELSE;
@@ -111,6 +164,18 @@ Token lexer_next_token(Lexer* lexer) {
             strncmp("return", lexer->token_text, lexer->token_len) == 0) {
             return lexer->token = KW_RETURN;
         }
+        if (lexer->token_len == 6 &&
+            strncmp("struct", lexer->token_text, lexer->token_len) == 0) {
+            return lexer->token = KW_STRUCT;
+        }
+        if (lexer->token_len == 6 &&
+            strncmp("switch", lexer->token_text, lexer->token_len) == 0) {
+            return lexer->token = KW_SWITCH;
+        }
+        if (lexer->token_len == 4 &&
+            strncmp("case", lexer->token_text, lexer->token_len) == 0) {
+            return lexer->token = KW_CASE;
+        }
         if (lexer->token_len == 2 &&
             strncmp("u8", lexer->token_text, lexer->token_len) == 0) {
             return lexer->token = KW_u8;
@@ -123,10 +188,30 @@ Token lexer_next_token(Lexer* lexer) {
             strncmp("u32", lexer->token_text, lexer->token_len) == 0) {
             return lexer->token = KW_u32;
         }
+        if (lexer->token_len == 3 &&
+            strncmp("i64", lexer->token_text, lexer->token_len) == 0) {
+            return lexer->token = KW_i64;
+        }
+        if (lexer->token_len == 3 &&
+            strncmp("u64", lexer->token_text, lexer->token_len) == 0) {
+            return lexer->token = KW_u64;
+        }
+        if (lexer->token_len == 3 &&
+            strncmp("f32", lexer->token_text, lexer->token_len) == 0) {
+            return lexer->token = KW_f32;
+        }
+        if (lexer->token_len == 3 &&
+            strncmp("f64", lexer->token_text, lexer->token_len) == 0) {
+            return lexer->token = KW_f64;
+        }
         if (lexer->token_len == 4 &&
             strncmp("bool", lexer->token_text, lexer->token_len) == 0) {
             return lexer->token = KW_bool;
         }
+        if (lexer->token_len == 4 &&
+            strncmp("v128", lexer->token_text, lexer->token_len) == 0) {
+            return lexer->token = KW_v128;
+        }
         if (lexer->token_len == 3 &&
             strncmp("and", lexer->token_text, lexer->token_len) == 0) {
             return lexer->token = KW_AND;
@@ -151,34 +236,68 @@ Token lexer_next_token(Lexer* lexer) {
         while (isalnum(lexer_current_char(lexer))) {
             lexer_consume_char(lexer);
         }
+        // fraction, digit is required after dot, so `1..2` stays a range
+        bool fraction = lexer_current_char(lexer) == '.' &&
+                        isdigit(lexer_peek_char(lexer, 1));
+        if (fraction) {
+            lexer_consume_char(lexer);
+            while (isalnum(lexer_current_char(lexer))) {
+                lexer_consume_char(lexer);
+            }
+        }
 
-        int64_t res = 0;
+        uint64_t res = 0;
+        char digits[64];
+        size_t digit_count = 0;
         bool parsing_bits = false;
 
-        int res_bits = 32;  // default type is i32
+        int res_bits = fraction ? 64 : 32;  // default types are f64 and i32
         bool res_unsing = false;
+        bool res_float = fraction;
 
         for (size_t i = 0; i < lexer->token_len; i++) {
             char c = lexer->token_text[i];
-            if (!isdigit(c)) {
-                if (!parsing_bits && (c == 'u' || c == 'i')) {
+            if (!isdigit(c) && !(c == '.' && !parsing_bits)) {
+                if (!parsing_bits && (c == 'u' || c == 'i' || c == 'f')) {
                     res_bits = 0;
                     res_unsing = c == 'u';
+                    res_float = c == 'f';
                     parsing_bits = true;
                     continue;
                 }
-                loc_print(stderr, lexer->token_start_loc);
-                fprintf(stderr, "Unsupported character in number: '%c'\n", c);
-                exit(-1);
+                loc_print(diag_out(), lexer->token_start_loc);
+                fprintf(diag_out(),
+                        "Unsupported character in number: '%c'\n", c);
+                diag_fail();
             }
             if (!parsing_bits) {
-                res = res * 10 + (c - '0');
+                if (digit_count + 1 == sizeof(digits)) {
+                    loc_print(diag_out(), lexer->token_start_loc);
+                    fprintf(diag_out(), "Number literal is too long\n");
+                    diag_fail();
+                }
+                digits[digit_count++] = c;
+                if (c != '.') res = res * 10 + (c - '0');
             } else {
                 res_bits = res_bits * 10 + (c - '0');
             }
         }
 
-        lexer->token_int = res;
+        if (res_float ? res_bits != 32 && res_bits != 64
+                      : fraction) {
+            loc_print(diag_out(), lexer->token_start_loc);
+            fprintf(diag_out(), "Unsupported type of number literal\n");
+            diag_fail();
+        }
+
+        if (res_float) {
+            digits[digit_count] = '\0';
+            lexer->token_float = strtod(digits, NULL);
+            lexer->token_bits = res_bits;
+            return lexer->token = T_FLOAT;
+        }
+
+        lexer->token_int = (int64_t)res;
         lexer->token_bits = res_bits;
         lexer->token_unsign = res_unsing;
 
@@ -190,10 +309,10 @@ Token lexer_next_token(Lexer* lexer) {
             escaped = false;
             lexer_consume_char(lexer);
             if (lexer_current_char(lexer) == '\0') {
-                loc_print(stderr, lexer->token_start_loc);
-                fprintf(stderr,
+                loc_print(diag_out(), lexer->token_start_loc);
+                fprintf(diag_out(),
                         "Reached end of file in before string literal end\n");
-                exit(-1);
+                diag_fail();
             }
             if (lexer_current_char(lexer) == '\\') {
                 lexer_consume_char(lexer);
@@ -280,23 +399,65 @@ Token lexer_next_token(Lexer* lexer) {
                 return lexer->token = T_EXCLAMATION;
             case '.':
                 lexer_consume_char(lexer);
+                if (lexer_current_char(lexer) == '.') {
+                    lexer_consume_char(lexer);
+                    return lexer->token = T_DOUBLE_DOT;
+                }
                 return lexer->token = T_DOT;
             default:
-                fprintf(stderr, "%d:%d: Unknown token starting with: '%c'\n",
+                fprintf(diag_out(),
+                        "%d:%d: Unknown token starting with: '%c'\n",
                         (int)lexer->token_start_loc.line,
                         (int)lexer->token_start_loc.col,
                         lexer_current_char(lexer));
-                exit(-1);
+                diag_fail();
         }
     }
     assert(false && "Unreachable");
 }
 
+Token lexer_next_token(Lexer* lexer) {
+    if (!stats_enabled) return lex_token(lexer);
+
+    uint64_t start = stats_now();
+    Token token = lex_token(lexer);
+    stats_end_phase(PHASE_LEX, start);
+    stats.tokens++;
+    return token;
+}
+
 void lexer_undo_token(Lexer* lexer) {
     lexer->token_end_loc = lexer->token_start_loc;
     lexer->offset -= lexer->token_len;
 }
 
+LexerMark lexer_mark_token(Lexer* lexer) {
+    return (LexerMark){
+        .offset = lexer->token_offset,
+        .loc = lexer->token_start_loc,
+    };
+}
+
+// with chunked input only the current and previous tokens can be rewound to
+void lexer_rewind(Lexer* lexer, LexerMark mark) {
+    assert(mark.offset >= lexer->input_base);
+    lexer->offset = mark.offset;
+    lexer->token_offset = mark.offset;
+    lexer->prev_token_offset = mark.offset;
+    lexer->token_end_loc = mark.loc;
+    lexer->token_len = 0;
+}
+
 void loc_print(FILE* fd, Location loc) {
     fprintf(fd, "%zu:%zu: ", loc.line, loc.col);
 }
+
+void lexer_print_tokens(Lexer* lexer, FILE* file) {
+    Token token;
+    while ((token = lexer_next_token(lexer)) != T_END) {
+        fprintf(file, "%d:%d: Token: %d %.*s\n",
+                (int)lexer->token_start_loc.line,
+                (int)lexer->token_start_loc.col, token, (int)lexer->token_len,
+                lexer->token_text);
+    }
+}
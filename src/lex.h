@@ -12,6 +12,7 @@ typedef enum {
     T_END = 0,
     T_IDENT,
     T_INT,
+    T_FLOAT,
     T_BOOL,
     T_STRING,
     T_COLON,
@@ -28,6 +29,7 @@ typedef enum {
     T_SLASH,
     T_EXCLAMATION,
     T_DOT,
+    T_DOUBLE_DOT,
     T_OPEN_BRACKETS,
     T_CLOSE_BRACKETS,
     T_OPEN_SQUARE,
@@ -38,17 +40,26 @@ typedef enum {
     KW_AS,
     KW_FN,
     KW_IF,
+    KW_THEN,
     KW_ELSE,
     KW_EXPORT,
     KW_EXTERN,
     KW_RETURN,
+    KW_STRUCT,
+    KW_SWITCH,
+    KW_CASE,
     KW_AND,
     KW_OR,
 
     KW_u8,
     KW_i32,
     KW_u32,
+    KW_i64,
+    KW_u64,
+    KW_f32,
+    KW_f64,
     KW_bool,
+    KW_v128,
 } Token;
 
 typedef struct {
@@ -60,14 +71,30 @@ typedef struct {
     da_list(char);
 } StringContent;
 
+// reads up to capacity bytes of input into buffer, returns 0 at the end
+typedef size_t (*LexerRefill)(void* data, char* buffer, size_t capacity);
+
+#ifndef LEXER_CHUNK_SIZE
+#define LEXER_CHUNK_SIZE (64 * 1024)
+#endif
+
 typedef struct {
-    char* input_buffer;
+    const char* input_buffer;
     size_t input_size;
+    size_t input_base;  // offset of input_buffer[0] in the whole input
+    // when set, input is pulled in chunks into window, instead of being
+    // provided whole in input_buffer
+    LexerRefill refill;
+    void* refill_data;
+    StringContent window;
     size_t offset;
+    size_t token_offset;
+    size_t prev_token_offset;  // input after it is kept for undoing tokens
     Token token;
-    char* token_text;
+    const char* token_text;
     size_t token_len;
     int64_t token_int;
+    double token_float;
     int token_bits;
     bool token_unsign;
     bool token_bool;
@@ -76,9 +103,18 @@ typedef struct {
     Location token_end_loc;
 } Lexer;
 
+typedef struct {
+    size_t offset;
+    Location loc;
+} LexerMark;
+
 Token lexer_next_token(Lexer* lexer);
 void lexer_undo_token(Lexer* lexer);
+LexerMark lexer_mark_token(Lexer* lexer);
+void lexer_rewind(Lexer* lexer, LexerMark mark);
 
 void loc_print(FILE*, Location);
+// prints remaining tokens, one per line
+void lexer_print_tokens(Lexer* lexer, FILE* file);
 
 #endif
@@ -27,25 +27,60 @@ void visualize_value_type(ValueType vt, Visualizer* v) {
             fprintf(v->file, "%c%d", vt.props.i.unsign ? 'u' : 'i',
                     vt.props.i.bits);
             break;
+        case VT_FLOAT:
+            fprintf(v->file, "f%d", vt.props.f.bits);
+            break;
         case VT_BOOL:
             fprintf(v->file, "bool");
             break;
+        case VT_V128:
+            fprintf(v->file, "v128");
+            break;
         case VT_SLICE:
             fprintf(v->file, "[");
             visualize_value_type(*vt.props.inner_type, v);
             fprintf(v->file, "]");
             break;
+        case VT_ARRAY:
+            fprintf(v->file, "[%" PRIu32 "]", vt.props.array.len);
+            visualize_value_type(*vt.props.array.inner_type, v);
+            break;
+        case VT_STRUCT:
+            fprintf(v->file, "%s",
+                    v->mod->structs.items[vt.props.struct_index].name);
+            break;
+        case VT_FUNCTION: {
+            FunctionType* ft =
+                &v->mod->function_types.items[vt.props.function_type];
+            DeclScope* ps = &v->mod->scopes.items[ft->param_scope];
+            fprintf(v->file, "fn(");
+            for (size_t i = 0; i < ps->count; i++) {
+                if (i) fprintf(v->file, ", ");
+                visualize_value_type(ps->items[i].value.vt, v);
+            }
+            fprintf(v->file, ")");
+            if (ft->return_type.kind != VT_NIL) {
+                fprintf(v->file, " -> ");
+                visualize_value_type(ft->return_type, v);
+            }
+        } break;
     }
 }
 
 // expressions
 
+void visualize_expression(Expression* e, Visualizer* v);
+
 void visualize_expr(Expr* e, Visualizer* v) {
     switch (e->kind) {
         case EK_INT_CONST:
             vis_write_indent(v);
             fprintf(v->file, "int_const %" PRId64 "\n", e->props.i.value);
             break;
+        case EK_FLOAT_CONST:
+            vis_write_indent(v);
+            fprintf(v->file, "float_const %g\n", e->props.f.value);
+            break;
         case EK_BOOL_CONST:
             vis_write_indent(v);
             fprintf(v->file, "bool_const %s\n",
@@ -100,6 +135,8 @@ void visualize_expr(Expr* e, Visualizer* v) {
                 case OP_FUNC_CALL:
                 case OP_FIELD_ACCESS:
                 case OP_CASTING:
+                case OP_OPEN_SQUARE:
+                case OP_SUBSLICE:
                     assert(false && "Unreachable");
                     break;
             }
@@ -117,6 +154,21 @@ void visualize_expr(Expr* e, Visualizer* v) {
             break;
         case EK_CASTING:
             break;
+        case EK_SUBSLICE:
+            vis_write_indent(v);
+            fprintf(v->file, "subslice%s\n", e->props.to_end ? " to end" : "");
+            break;
+        case EK_CONDITIONAL:
+            vis_write_indent(v);
+            fprintf(v->file, "conditional {\n");
+            v->indent++;
+            for (size_t i = 0; i < 3; i++) {
+                visualize_expression(&e->props.arms[i], v);
+            }
+            v->indent--;
+            vis_write_indent(v);
+            fprintf(v->file, "}\n");
+            break;
     }
 }
 
@@ -191,6 +243,39 @@ void visualize_if_statement(IfStatement* s, Visualizer* v) {
     }
 }
 
+void visualize_switch_statement(SwitchStatement* s, Visualizer* v) {
+    vis_write_indent(v);
+    fprintf(v->file, "switch (\n");
+
+    v->indent++;
+    visualize_expression(&s->expr, v);
+    v->indent--;
+
+    vis_write_indent(v);
+    fprintf(v->file, ")\n");
+
+    for (size_t i = 0; i < s->branches.count; i++) {
+        vis_write_indent(v);
+        fprintf(v->file, "case");
+        for (size_t j = 0; j < s->cases.count; j++) {
+            if (s->cases.items[j].branch == i)
+                fprintf(v->file, " %" PRId64, s->cases.items[j].value);
+        }
+        fprintf(v->file, ":\n");
+        v->indent++;
+        visualize_statement(&s->branches.items[i], v);
+        v->indent--;
+    }
+
+    if (s->default_branch) {
+        vis_write_indent(v);
+        fprintf(v->file, "else\n");
+        v->indent++;
+        visualize_statement(s->default_branch, v);
+        v->indent--;
+    }
+}
+
 void visualize_expr_statement(ReturnStatement* s, Visualizer* v) {
     vis_write_indent(v);
     fprintf(v->file, "expr {\n");
@@ -208,6 +293,7 @@ void visualize_statement(Statement* s, Visualizer* v) {
         case SK_EMPTY:
             vis_write_indent(v);
             fprintf(v->file, ";\n");
+            break;
         case SK_BLOCK:
             visualize_block_statement(&s->block, v);
             break;
@@ -220,6 +306,9 @@ void visualize_statement(Statement* s, Visualizer* v) {
         case SK_EXPRESSION:
             visualize_expr_statement(&s->ret, v);
             break;
+        case SK_SWITCH:
+            visualize_switch_statement(&s->switchs, v);
+            break;
     }
 }
 
@@ -268,6 +357,18 @@ void visualize_decl(Decl* decl, Visualizer* v) {
             fprintf(v->file, "%s := var ", decl->name);
             visualize_value_type(decl->value.vt, v);
             break;
+        case DK_STRUCT: {
+            StructType* s = &v->mod->structs.items[decl->value.struct_index];
+            fprintf(v->file, "%s := struct %s{ ", decl->name,
+                    s->soa ? "soa " : "");
+            for (size_t i = 0; i < s->count; i++) {
+                fprintf(v->file, "%s: ", s->items[i].name);
+                visualize_value_type(s->items[i].vt, v);
+                fprintf(v->file, ", ");
+            }
+            fprintf(v->file, "}");
+            break;
+        }
     }
     fprintf(v->file, "}\n");
 }
@@ -364,10 +465,14 @@ void visualize_function(Function* function, Visualizer* v) {
     fprintf(v->file, "function_type: #%zu\n", function->function_type);
 
     vis_write_indent(v);
-    fprintf(v->file, "content:\n");
-    v->indent++;
-    visualize_statement(&function->content, v);
-    v->indent--;
+    if (function->lazy) {
+        fprintf(v->file, "content: not parsed\n");
+    } else {
+        fprintf(v->file, "content:\n");
+        v->indent++;
+        visualize_statement(&function->content, v);
+        v->indent--;
+    }
 
     v->indent--;
     vis_write_indent(v);
@@ -0,0 +1,111 @@
+#include "nou.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compile.h"
+
+struct NouCtx {
+    CompileContext compile;
+    StringContent messages;  // diagnostics text split into lines
+    struct {
+        da_list(NouDiagnostic);
+    } diagnostics;
+};
+
+NouCtx* nou_ctx_new(void) {
+    NouCtx* ctx = calloc(1, sizeof(NouCtx));
+    assert(ctx);
+    return ctx;
+}
+
+void nou_ctx_free(NouCtx* ctx) {
+    if (!ctx) return;
+    compile_context_free(&ctx->compile);
+    free(ctx->messages.items);
+    free(ctx->diagnostics.items);
+    free(ctx);
+}
+
+void nou_ctx_reset(NouCtx* ctx) {
+    compile_context_reset(&ctx->compile);
+    ctx->messages.count = 0;
+    ctx->diagnostics.count = 0;
+}
+
+// reads `line:col: ` prefix written by loc_print
+static bool parse_location(const char** text, size_t* line, size_t* col) {
+    const char* c = *text;
+    size_t numbers[2] = {0};
+    for (size_t i = 0; i < 2; i++) {
+        if (!isdigit((unsigned char)*c)) return false;
+        while (isdigit((unsigned char)*c)) {
+            numbers[i] = numbers[i] * 10 + (*c++ - '0');
+        }
+        if (*c++ != ':') return false;
+    }
+    if (*c == ' ') c++;
+    *line = numbers[0];
+    *col = numbers[1];
+    *text = c;
+    return true;
+}
+
+// diagnostics are written as text, one per line, optionally prefixed with
+// location
+static void split_diagnostics(NouCtx* ctx) {
+    StringContent* diag = &ctx->compile.diagnostics;
+    ctx->messages.count = 0;
+    for (size_t i = 0; i < diag->count; i++) {
+        char c = diag->items[i];
+        da_append(ctx->messages, c == '\n' ? '\0' : c);
+    }
+    if (ctx->messages.count && ctx->messages.items[ctx->messages.count - 1])
+        da_append(ctx->messages, '\0');
+
+    // pointers into messages are taken only once it stops growing
+    size_t start = 0;
+    while (start < ctx->messages.count) {
+        const char* text = &ctx->messages.items[start];
+        start += strlen(text) + 1;
+
+        NouDiagnostic d = {.severity = NOU_ERROR};
+        d.has_location = parse_location(&text, &d.line, &d.col);
+        if (strncmp(text, "WARN:", 5) == 0) {  // `WARN:line:col: message`
+            d.severity = NOU_WARNING;
+            text += 5;
+            size_t line, col;
+            if (parse_location(&text, &line, &col) && !d.has_location) {
+                d.has_location = true;
+                d.line = line;
+                d.col = col;
+            }
+        }
+        d.message = text;
+        da_append(ctx->diagnostics, d);
+    }
+}
+
+bool nou_compile_buffer(NouCtx* ctx, const char* source, size_t size,
+                        const NouOptions* options) {
+    nou_ctx_reset(ctx);
+
+    ParseOptions parse_options = {0};
+    if (options) parse_options.lazy = options->lazy;
+
+    bool ok = compile_source(&ctx->compile, source, size, parse_options);
+    split_diagnostics(ctx);
+    return ok;
+}
+
+const uint8_t* nou_ctx_output(NouCtx* ctx, size_t* out_size) {
+    *out_size = ctx->compile.output.count;
+    return ctx->compile.output.items;
+}
+
+const NouDiagnostic* nou_ctx_diagnostics(NouCtx* ctx, size_t* out_count) {
+    *out_count = ctx->diagnostics.count;
+    return ctx->diagnostics.items;
+}
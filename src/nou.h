@@ -0,0 +1,45 @@
+#ifndef NOU_H_
+#define NOU_H_
+
+// Library interface of the compiler. Context keeps memory of previous
+// compilations for reuse, so compiling many sources in one process doesn't
+// allocate everything from scratch. Context must not be used by several
+// threads at once, but separate contexts can be used in parallel.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct NouCtx NouCtx;
+
+typedef struct {
+    bool lazy;  // compile only functions reachable from exports
+} NouOptions;
+
+typedef enum {
+    NOU_ERROR,
+    NOU_WARNING,
+} NouSeverity;
+
+typedef struct {
+    NouSeverity severity;
+    bool has_location;
+    size_t line;  // zero-based, like everything lexer reports
+    size_t col;
+    const char* message;
+} NouDiagnostic;
+
+NouCtx* nou_ctx_new(void);
+void nou_ctx_free(NouCtx* ctx);
+// drops output and diagnostics of last compilation, but keeps memory
+void nou_ctx_reset(NouCtx* ctx);
+
+// returns false if source has errors, options can be NULL
+bool nou_compile_buffer(NouCtx* ctx, const char* source, size_t size,
+                        const NouOptions* options);
+
+// results of last compilation, valid until next compilation or reset
+const uint8_t* nou_ctx_output(NouCtx* ctx, size_t* out_size);
+const NouDiagnostic* nou_ctx_diagnostics(NouCtx* ctx, size_t* out_count);
+
+#endif
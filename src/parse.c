@@ -5,8 +5,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef __wasi__
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
+#include "diag.h"
+#include "stats.h"
 
 bool parse_statement(Parser* p, Statement* st);
+void statement_free(Statement* st);
+bool parse_function_value_type(Parser* p, ValueType* vt);
 
 bool parse_value_type(Parser* p, ValueType* vt) {
     Token token = lexer_next_token(p->lex);
@@ -25,6 +34,32 @@ bool parse_value_type(Parser* p, ValueType* vt) {
                 .props.i.unsign = true,
             };
             break;
+        case KW_i64:
+            *vt = (ValueType){
+                .kind = VT_INT,
+                .props.i.bits = 64,
+                .props.i.unsign = false,
+            };
+            break;
+        case KW_u64:
+            *vt = (ValueType){
+                .kind = VT_INT,
+                .props.i.bits = 64,
+                .props.i.unsign = true,
+            };
+            break;
+        case KW_f32:
+            *vt = (ValueType){
+                .kind = VT_FLOAT,
+                .props.f.bits = 32,
+            };
+            break;
+        case KW_f64:
+            *vt = (ValueType){
+                .kind = VT_FLOAT,
+                .props.f.bits = 64,
+            };
+            break;
         case KW_u8:
             *vt = (ValueType){
                 .kind = VT_INT,
@@ -37,45 +72,166 @@ bool parse_value_type(Parser* p, ValueType* vt) {
                 .kind = VT_BOOL,
             };
             break;
+        case KW_v128:
+            *vt = (ValueType){
+                .kind = VT_V128,
+            };
+            break;
         case T_OPEN_SQUARE: {  // slice type
+            if (lexer_next_token(p->lex) == T_INT) {  // array type
+                if (p->lex->token_int <= 0 || p->lex->token_int > UINT32_MAX) {
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(), "Invalid length of array type!\n");
+                    return false;
+                }
+                *vt = (ValueType){
+                    .kind = VT_ARRAY,
+                    .props.array.len = p->lex->token_int,
+                };
+                if ((token = lexer_next_token(p->lex)) != T_CLOSE_SQUARE) {
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(),
+                            "Expected ']' after array length, got %d!\n",
+                            token);
+                    return false;
+                }
+                vt->props.array.inner_type = malloc(sizeof(ValueType));
+                assert(vt->props.array.inner_type);
+                da_append(p->mod->inner_types, vt->props.array.inner_type);
+                return parse_value_type(p, vt->props.array.inner_type);
+            }
+            lexer_undo_token(p->lex);
+
             *vt = (ValueType){
                 .kind = VT_SLICE,
             };
             vt->props.inner_type = malloc(sizeof(ValueType));
             assert(vt->props.inner_type);
+            da_append(p->mod->inner_types, vt->props.inner_type);
             parse_value_type(p, vt->props.inner_type);
             if ((token = lexer_next_token(p->lex)) != T_CLOSE_SQUARE) {
-                loc_print(stderr, p->lex->token_start_loc);
-                fprintf(stderr, "Expected ']' closing slice type, got %d!\n",
-                        token);
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(),
+                        "Expected ']' closing slice type, got %d!\n", token);
+                return false;
+            }
+        } break;
+        case KW_FN:
+            return parse_function_value_type(p, vt);
+        case T_IDENT: {  // struct type, declared before it is used
+            char* name = strndup(p->lex->token_text, p->lex->token_len);
+            Decl* d = scope_find_decl(&p->mod->scopes.items[0], name);
+            free(name);
+            if (!d || d->kind != DK_STRUCT) {
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Unknown type `%.*s`!\n",
+                        (int)p->lex->token_len, p->lex->token_text);
                 return false;
             }
+            *vt = (ValueType){
+                .kind = VT_STRUCT,
+                .props.struct_index = d->value.struct_index,
+            };
         } break;
         default:
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr, "Unexpected token in value type %d!\n", token);
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Unexpected token in value type %d!\n", token);
             return false;
     }
     return true;
 }
 
-bool check_decl_name_available(Parser* p, char* decl_name) {
-    size_t scope = p->current_scope;
-    while (true) {
-        DeclScope* s = &p->mod->scopes.items[scope];
+// indices of names and signatures, slots are kept at most half full and
+// their count is a power of two
+
+#define INDEX_MIN_CAPACITY 64
+#define DECL_INDEX_MIN_DECLS 16  // smaller scopes are scanned linearly
+
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+static uint64_t hash_name(const char* name) {
+    uint64_t h = FNV_OFFSET;
+    for (; *name; name++) h = (h ^ (uint8_t)*name) * FNV_PRIME;
+    return h;
+}
+
+static size_t index_capacity(size_t count) {
+    size_t capacity = INDEX_MIN_CAPACITY;
+    while (capacity < count * 2) capacity *= 2;
+    return capacity;
+}
+
+static void decl_index_update(DeclScope* s) {
+    DeclIndex* index = &s->index;
+    if (index->indexed == s->count) return;
+
+    if (s->count * 2 > index->capacity) {  // rehash everything
+        free(index->slots);
+        index->capacity = index_capacity(s->count);
+        index->slots = calloc(index->capacity, sizeof(size_t));
+        assert(index->slots);
+        index->indexed = 0;
+        index->variables = 0;
+    }
+
+    size_t mask = index->capacity - 1;
+    for (; index->indexed < s->count; index->indexed++) {
+        Decl* d = &s->items[index->indexed];
+        if (d->kind == DK_VARIABLE) index->variables++;
 
+        size_t slot = hash_name(d->name) & mask;
+        while (index->slots[slot] &&
+               strcmp(s->items[index->slots[slot] - 1].name, d->name) != 0) {
+            slot = (slot + 1) & mask;
+        }
+        // the first of decls with the same name wins, like in linear scan
+        if (!index->slots[slot]) index->slots[slot] = index->indexed + 1;
+    }
+}
+
+Decl* scope_find_decl(DeclScope* s, const char* name) {
+    if (s->count < DECL_INDEX_MIN_DECLS) {
         for (size_t i = 0; i < s->count; i++) {
-            if (strcmp(s->items[i].name, decl_name) == 0) {
-                return false;
-            }
+            if (strcmp(s->items[i].name, name) == 0) return &s->items[i];
         }
+        return NULL;
+    }
+
+    decl_index_update(s);
+    size_t mask = s->index.capacity - 1;
+    for (size_t slot = hash_name(name) & mask; s->index.slots[slot];
+         slot = (slot + 1) & mask) {
+        Decl* d = &s->items[s->index.slots[slot] - 1];
+        if (strcmp(d->name, name) == 0) return d;
+    }
+    return NULL;
+}
 
+bool check_decl_name_available(Parser* p, char* decl_name) {
+    size_t scope = p->current_scope;
+    while (true) {
+        DeclScope* s = &p->mod->scopes.items[scope];
+        if (scope_find_decl(s, decl_name)) return false;
         if (scope == 0) return true;
         scope = s->parent;
     }
 }
 
-bool compare_value_types(ValueType a, ValueType b) {
+// maps function types of a fragment to ones of module, types in value types
+// of fragment are mapped before they are compared, see parallel parsing
+typedef struct {
+    size_t shared;  // types below are the same in both
+    size_t* items;
+} FunctionTypeMap;
+
+static size_t map_function_type(const FunctionTypeMap* map, size_t type) {
+    if (!map || type < map->shared) return type;
+    return map->items[type - map->shared];
+}
+
+static bool compare_mapped_value_types(ValueType a, ValueType b,
+                                       const FunctionTypeMap* map) {
     if (a.kind != b.kind) return false;
     switch (a.kind) {
         case VT_INT:
@@ -83,45 +239,160 @@ bool compare_value_types(ValueType a, ValueType b) {
                 a.props.i.unsign != b.props.i.unsign)
                 return false;
             break;
+        case VT_FLOAT:
+            if (a.props.f.bits != b.props.f.bits) return false;
+            break;
         case VT_SLICE:
-            if (!compare_value_types(*a.props.inner_type, *b.props.inner_type))
+            if (!compare_mapped_value_types(*a.props.inner_type,
+                                            *b.props.inner_type, map))
+                return false;
+            break;
+        case VT_STRUCT:
+            if (a.props.struct_index != b.props.struct_index) return false;
+            break;
+        case VT_FUNCTION:
+            if (map_function_type(map, a.props.function_type) !=
+                b.props.function_type)
+                return false;
+            break;
+        case VT_ARRAY:
+            if (a.props.array.len != b.props.array.len ||
+                !compare_mapped_value_types(*a.props.array.inner_type,
+                                            *b.props.array.inner_type, map))
                 return false;
             break;
         case VT_NIL:
         case VT_BOOL:
+        case VT_V128:
             break;
     }
     return true;
 }
 
-bool find_function_type_idx(Parser* p, FunctionType ft, size_t* out_index) {
-    DeclScope* ps = &p->mod->scopes.items[ft.param_scope];
-    for (size_t i = 0; i < p->mod->function_types.count; i++) {
-        FunctionType ft2 = p->mod->function_types.items[i];
-        if (!compare_value_types(ft.return_type, ft2.return_type))
-            continue;  // non-matching return types
-
-        DeclScope* ps2 = &p->mod->scopes.items[ft2.param_scope];
-        if (ps->count != ps2->count) continue;  // arity mismatch
-
-        bool matching_args = true;
-        for (size_t j = 0; j < ps->count; j++) {
-            if (!compare_value_types(ps->items[j].value.vt,
-                                     ps2->items[j].value.vt)) {
-                matching_args = false;
-                break;
-            }
+bool compare_value_types(ValueType a, ValueType b) {
+    return compare_mapped_value_types(a, b, NULL);
+}
+
+static uint64_t hash_value_type(uint64_t h, ValueType vt,
+                                const FunctionTypeMap* map) {
+    h = (h ^ vt.kind) * FNV_PRIME;
+    switch (vt.kind) {
+        case VT_INT:
+            h = (h ^ (vt.props.i.bits * 2 + vt.props.i.unsign)) * FNV_PRIME;
+            break;
+        case VT_FLOAT:
+            h = (h ^ vt.props.f.bits) * FNV_PRIME;
+            break;
+        case VT_SLICE:
+            h = hash_value_type(h, *vt.props.inner_type, map);
+            break;
+        case VT_STRUCT:
+            h = (h ^ vt.props.struct_index) * FNV_PRIME;
+            break;
+        case VT_FUNCTION:
+            h = (h ^ map_function_type(map, vt.props.function_type)) *
+                FNV_PRIME;
+            break;
+        case VT_ARRAY:
+            h = (h ^ vt.props.array.len) * FNV_PRIME;
+            h = hash_value_type(h, *vt.props.array.inner_type, map);
+            break;
+        case VT_NIL:
+        case VT_BOOL:
+        case VT_V128:
+            break;
+    }
+    return h;
+}
+
+// params of function type are in scopes of its module
+static uint64_t hash_function_type(Module* mod, FunctionType ft,
+                                   const FunctionTypeMap* map) {
+    uint64_t h = hash_value_type(FNV_OFFSET, ft.return_type, map);
+    DeclScope* ps = &mod->scopes.items[ft.param_scope];
+    for (size_t i = 0; i < ps->count; i++) {
+        h = hash_value_type(h, ps->items[i].value.vt, map);
+    }
+    return h;
+}
+
+// type a is from module mod_a and its types are mapped, b is from mod
+static bool compare_function_types(Module* mod_a, FunctionType a,
+                                   Module* mod, FunctionType b,
+                                   const FunctionTypeMap* map) {
+    if (!compare_mapped_value_types(a.return_type, b.return_type, map))
+        return false;  // non-matching return types
+
+    DeclScope* ps = &mod_a->scopes.items[a.param_scope];
+    DeclScope* ps2 = &mod->scopes.items[b.param_scope];
+    if (ps->count != ps2->count) return false;  // arity mismatch
+
+    for (size_t j = 0; j < ps->count; j++) {
+        if (!compare_mapped_value_types(ps->items[j].value.vt,
+                                        ps2->items[j].value.vt, map)) {
+            return false;
         }
+    }
+    return true;
+}
+
+static void function_type_index_update(Module* mod) {
+    FunctionTypeIndex* index = &mod->function_type_index;
+    FunctionTypes* types = &mod->function_types;
+    if (index->slots && index->indexed == types->count) return;
+
+    if (!index->slots || types->count * 2 > index->capacity) {  // rehash
+        free(index->slots);
+        index->capacity = index_capacity(types->count);
+        index->slots = calloc(index->capacity, sizeof(size_t));
+        assert(index->slots);
+        index->indexed = 0;
+    }
 
-        if (!matching_args) continue;
+    size_t mask = index->capacity - 1;
+    for (; index->indexed < types->count; index->indexed++) {
+        FunctionType ft = types->items[index->indexed];
+        size_t slot = hash_function_type(mod, ft, NULL) & mask;
+        while (index->slots[slot] &&
+               !compare_function_types(mod,
+                                       types->items[index->slots[slot] - 1],
+                                       mod, ft, NULL)) {
+            slot = (slot + 1) & mask;
+        }
+        // the first of matching types wins, like in linear scan
+        if (!index->slots[slot]) index->slots[slot] = index->indexed + 1;
+    }
+}
 
-        if (out_index) *out_index = i;
-        return true;  // function types match
+// finds type of mod matching ft of module from, whose types are mapped
+static bool find_mapped_function_type(Module* mod, Module* from,
+                                      FunctionType ft,
+                                      const FunctionTypeMap* map,
+                                      size_t* out_index) {
+    function_type_index_update(mod);
+
+    FunctionTypeIndex* index = &mod->function_type_index;
+    size_t mask = index->capacity - 1;
+    for (size_t slot = hash_function_type(from, ft, map) & mask;
+         index->slots[slot]; slot = (slot + 1) & mask) {
+        size_t i = index->slots[slot] - 1;
+        if (compare_function_types(from, ft, mod,
+                                   mod->function_types.items[i], map)) {
+            if (out_index) *out_index = i;
+            return true;  // function types match
+        }
     }
-    if (out_index) *out_index = p->mod->function_types.count;
+    if (out_index) *out_index = mod->function_types.count;
     return false;
 }
 
+bool find_function_type_idx(Parser* p, FunctionType ft, size_t* out_index) {
+    bool found =
+        find_mapped_function_type(p->mod, p->mod, ft, NULL, out_index);
+    if (p->trace) da_append(p->trace->type_uses, *out_index);
+    return found;
+}
+
 bool parse_function_type(Parser* p, Function* f) {
     assert(p->lex->token == KW_FN);
 
@@ -141,15 +412,17 @@ bool parse_function_type(Parser* p, Function* f) {
     while ((token = lexer_next_token(p->lex)) != T_ARROW &&
            token != T_OPEN_BRACKETS) {
         if (token != T_IDENT) {
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr, "Expected param name identifier, got %d!\n", token);
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(),
+                    "Expected param name identifier, got %d!\n", token);
             return false;
         }
         Decl param = {0};
         param.name = strndup(p->lex->token_text, p->lex->token_len);
         if (!check_decl_name_available(p, param.name)) {
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr, "Redeclaration of `%s` in param!\n", param.name);
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(),
+                    "Redeclaration of `%s` in param!\n", param.name);
             return false;
         }
         param.kind = DK_PARAM;
@@ -157,14 +430,14 @@ bool parse_function_type(Parser* p, Function* f) {
         token = lexer_next_token(p->lex);
 
         if (token != T_COLON) {
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr, "Expected colon, got %d!\n", token);
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Expected colon, got %d!\n", token);
             return false;
         }
 
         if (!parse_value_type(p, (ValueType*)&param.value)) {
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr, "Failed to parse param type!\n");
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Failed to parse param type!\n");
             return false;
         }
 
@@ -177,8 +450,8 @@ bool parse_function_type(Parser* p, Function* f) {
                 token == T_SEMICOLON)
                 break;
 
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr,
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(),
                     "Expected comma, arrow, semicolon or '{', got %d!\n",
                     token);
             return false;
@@ -189,8 +462,8 @@ bool parse_function_type(Parser* p, Function* f) {
 
     if (token == T_ARROW) {
         if (!parse_value_type(p, &f->return_type)) {
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr, "Failed to parse return type!\n");
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Failed to parse return type!\n");
             return false;
         }
     }
@@ -209,12 +482,78 @@ bool parse_function_type(Parser* p, Function* f) {
     return true;
 }
 
+// parses `fn(T, ...) -> R` after `fn`, params of its signature are nameless
+bool parse_function_value_type(Parser* p, ValueType* vt) {
+    Token token = lexer_next_token(p->lex);
+    if (token != T_OPEN_PARENS) {
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected `(` of function type, got %d!\n",
+                token);
+        return false;
+    }
+
+    FunctionType ft = {.param_scope = p->mod->scopes.count};
+    {
+        DeclScope scope = {
+            .parent = p->current_scope,
+            .param_scope = true,
+        };
+        da_append(p->mod->scopes, scope);
+    }
+
+    if ((token = lexer_next_token(p->lex)) != T_CLOSE_PARENS) {
+        lexer_undo_token(p->lex);
+        while (true) {
+            Decl param = {.name = strdup(""), .kind = DK_PARAM};
+            da_append(p->mod->scopes.items[ft.param_scope], param);
+            DeclScope* ps = &p->mod->scopes.items[ft.param_scope];
+            if (!parse_value_type(p, &ps->items[ps->count - 1].value.vt)) {
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Failed to parse param type!\n");
+                return false;
+            }
+
+            token = lexer_next_token(p->lex);
+            if (token == T_CLOSE_PARENS) break;
+            if (token != T_COMMA) {
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(),
+                        "Expected comma or `)` in function type, got %d!\n",
+                        token);
+                return false;
+            }
+        }
+    }
+
+    if (lexer_next_token(p->lex) == T_ARROW) {
+        if (!parse_value_type(p, &ft.return_type)) {
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Failed to parse return type!\n");
+            return false;
+        }
+    } else {
+        lexer_undo_token(p->lex);
+    }
+
+    *vt = (ValueType){.kind = VT_FUNCTION};
+    if (!find_function_type_idx(p, ft, &vt->props.function_type)) {
+        da_append(p->mod->function_types, ft);
+    } else if (ft.param_scope == p->mod->scopes.count - 1) {
+        // signature is known, so its scope is dropped
+        DeclScope* ps = &p->mod->scopes.items[ft.param_scope];
+        for (size_t i = 0; i < ps->count; i++) free(ps->items[i].name);
+        free(ps->items);
+        free(ps->index.slots);
+        p->mod->scopes.count--;
+    }
+    return true;
+}
+
 size_t operator_precedence(OperatorKind op) {
     switch (op) {
+        // postfix operators apply from left to right, as in `a!i.x as u32`
         case OP_INDEXING:
         case OP_CASTING:
-            return 8;
-
         case OP_FIELD_ACCESS:
             return 7;
 
@@ -241,9 +580,12 @@ size_t operator_precedence(OperatorKind op) {
 
         case OP_OPEN_PAREN:
         case OP_FUNC_CALL:
+        case OP_OPEN_SQUARE:
+        case OP_SUBSLICE:
             assert(false && "Unreachable");
             break;
     }
+    return 0;
 }
 
 typedef enum {
@@ -271,8 +613,11 @@ size_t operator_associativity(OperatorKind op) {
 
         case OP_OPEN_PAREN:
         case OP_FUNC_CALL:
+        case OP_OPEN_SQUARE:
+        case OP_SUBSLICE:
             assert(false && "Unreachable");
     }
+    return OPA_LEFT;
 }
 
 OperatorKind operator_of_token(Token tok) {
@@ -305,6 +650,8 @@ OperatorKind operator_of_token(Token tok) {
 typedef enum {
     EPTM_DEFAULT = 0,
     EPTM_ON_MISMATCHED_PAREN,
+    EPTM_CONDITIONAL_ARM,  // on tokens which can follow an operand of outer
+                           // expression, outside of brackets
 } ExpressionParsingTerminationMode;
 
 typedef struct {
@@ -317,6 +664,11 @@ typedef struct {
     da_list(ValueType);
 } ValueTypes;
 
+// operators emitting stops at, until they are closed
+static bool is_bracket_operator(OperatorKind op) {
+    return op == OP_OPEN_PAREN || op == OP_OPEN_SQUARE || op == OP_SUBSLICE;
+}
+
 bool emit_operator(OperatorKinds* op_stack, Names* name_stack,
                    ValueTypes* cast_type_stack, Expression* ex) {
     OperatorKind op = op_stack->items[op_stack->count - 1];
@@ -354,6 +706,25 @@ bool emit_operator(OperatorKinds* op_stack, Names* name_stack,
     return true;
 }
 
+static bool ends_conditional_arm(Token token, OperatorKinds* op_stack) {
+    for (size_t i = 0; i < op_stack->count; i++) {
+        if (is_bracket_operator(op_stack->items[i])) return false;
+    }
+    switch (token) {
+        case T_SEMICOLON:
+        case T_COMMA:
+        case T_DOUBLE_DOT:
+        case T_CLOSE_PARENS:
+        case T_CLOSE_SQUARE:
+        case T_CLOSE_BRACKETS:
+        case KW_THEN:
+        case KW_ELSE:
+            return true;
+        default:
+            return false;
+    }
+}
+
 bool parse_expression(Parser* p, Expression* ex,
                       ExpressionParsingTerminationMode termination_mode) {
     OperatorKinds op_stack = {0};
@@ -369,37 +740,45 @@ bool parse_expression(Parser* p, Expression* ex,
             parsing = false;
             break;
         }
+        if (termination_mode == EPTM_CONDITIONAL_ARM &&
+            ends_conditional_arm(token, &op_stack)) {
+            lexer_undo_token(p->lex);
+            parsing = false;
+            break;
+        }
 
         {  // parse potential ops
             OperatorKind new_op = operator_of_token(token);
+            // operand of new operator, pushed after pending operators are
+            // emitted, so chained `a.b.c` don't take each other's names
+            char* name = NULL;
+            ValueType target_type;
 
             if (token == T_DOT) {  // special handling for field access operator
                 if (lexer_next_token(p->lex) != T_IDENT) {
-                    loc_print(stderr, p->lex->token_start_loc);
-                    fprintf(stderr, "Expected identifier after `.`\n");
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(), "Expected identifier after `.`\n");
                     return false;
                 }
-                char* name = strndup(p->lex->token_text, p->lex->token_len);
-                da_append(name_stack, name);
+                name = strndup(p->lex->token_text, p->lex->token_len);
                 new_op = OP_FIELD_ACCESS;
             }
 
             if (token == KW_AS) {  // special handling for casting operator
-                ValueType target_type;
                 if (!parse_value_type(p, &target_type)) {
-                    loc_print(stderr, p->lex->token_start_loc);
-                    fprintf(stderr, "Failed to parse type in `as` operator\n");
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(),
+                            "Failed to parse type in `as` operator\n");
                     return false;
                 }
-                da_append(cast_type_stack, target_type);
                 new_op = OP_CASTING;
             }
 
             if (new_op != -1) {
                 OperatorKind top_op;
                 while (op_stack.count &&
-                       (top_op = op_stack.items[op_stack.count - 1]) !=
-                           OP_OPEN_PAREN &&
+                       !is_bracket_operator(
+                           top_op = op_stack.items[op_stack.count - 1]) &&
                        (operator_precedence(top_op) >
                             operator_precedence(new_op) ||
                         (operator_precedence(top_op) ==
@@ -407,6 +786,9 @@ bool parse_expression(Parser* p, Expression* ex,
                          operator_associativity(new_op) == OPA_LEFT))) {
                     emit_operator(&op_stack, &name_stack, &cast_type_stack, ex);
                 }
+                if (new_op == OP_FIELD_ACCESS) da_append(name_stack, name);
+                if (new_op == OP_CASTING)
+                    da_append(cast_type_stack, target_type);
                 da_append(op_stack, new_op);
                 continue;
             }
@@ -421,13 +803,17 @@ bool parse_expression(Parser* p, Expression* ex,
                 if (op_stack.count == 0) mismatched_paren = true;
 
                 while (!mismatched_paren && op_stack.count > 0 &&
-                       op_stack.items[op_stack.count - 1] != OP_OPEN_PAREN) {
+                       !is_bracket_operator(
+                           op_stack.items[op_stack.count - 1])) {
                     emit_operator(&op_stack, &name_stack, &cast_type_stack, ex);
                     if (op_stack.count == 0) {
                         mismatched_paren = true;
                         break;
                     }
                 }
+                if (op_stack.count &&
+                    op_stack.items[op_stack.count - 1] != OP_OPEN_PAREN)
+                    mismatched_paren = true;
 
                 if (mismatched_paren) {
                     if (termination_mode == EPTM_ON_MISMATCHED_PAREN) {
@@ -435,8 +821,8 @@ bool parse_expression(Parser* p, Expression* ex,
                         parsing = false;
                         break;
                     } else {
-                        loc_print(stderr, p->lex->token_start_loc);
-                        fprintf(stderr, "Mismatched parenthesis!\n");
+                        loc_print(diag_out(), p->lex->token_start_loc);
+                        fprintf(diag_out(), "Mismatched parenthesis!\n");
                         return false;
                     }
                 }
@@ -480,6 +866,14 @@ bool parse_expression(Parser* p, Expression* ex,
                 };
                 da_append(*ex, e);
             } break;
+            case T_FLOAT: {
+                Expr e = {
+                    .kind = EK_FLOAT_CONST,
+                    .props.f.value = p->lex->token_float,
+                    .props.f.bits = p->lex->token_bits,
+                };
+                da_append(*ex, e);
+            } break;
             case T_BOOL: {
                 Expr e = {
                     .kind = EK_BOOL_CONST,
@@ -502,93 +896,343 @@ bool parse_expression(Parser* p, Expression* ex,
                 da_append(p->mod->string_constants, s);
                 da_append(*ex, e);
             } break;
+            case KW_IF: {  // `if c then a else b`, an operand
+                Expr e = {
+                    .kind = EK_CONDITIONAL,
+                    .props.arms = calloc(3, sizeof(Expression)),
+                };
+                assert(e.props.arms);
+                da_append(*ex, e);
+
+                Token separators[] = {KW_THEN, KW_ELSE};
+                for (size_t i = 0; i < 3; i++) {
+                    if (!parse_expression(p, &e.props.arms[i],
+                                          EPTM_CONDITIONAL_ARM))
+                        return false;
+                    if (i < 2 && lexer_next_token(p->lex) != separators[i]) {
+                        loc_print(diag_out(), p->lex->token_start_loc);
+                        fprintf(diag_out(), "Expected `%s` in conditional!\n",
+                                i == 0 ? "then" : "else");
+                        return false;
+                    }
+                }
+            } break;
             case T_COMMA: {
                 while (op_stack.count &&
-                       op_stack.items[op_stack.count - 1] != OP_OPEN_PAREN) {
+                       !is_bracket_operator(
+                           op_stack.items[op_stack.count - 1])) {
+                    emit_operator(&op_stack, &name_stack, &cast_type_stack, ex);
+                }
+            } break;
+            case T_OPEN_SQUARE: {  // subslice `s[a..b]`, bounds are optional
+                // binds to the whole operand before it, like field access
+                while (op_stack.count &&
+                       !is_bracket_operator(
+                           op_stack.items[op_stack.count - 1]) &&
+                       operator_precedence(
+                           op_stack.items[op_stack.count - 1]) >=
+                           operator_precedence(OP_FIELD_ACCESS)) {
+                    emit_operator(&op_stack, &name_stack, &cast_type_stack, ex);
+                }
+                da_append(op_stack, OP_OPEN_SQUARE);
+
+                if (lexer_next_token(p->lex) == T_DOUBLE_DOT) {
+                    Expr e = {
+                        .kind = EK_INT_CONST,
+                        .props.i.bits = 32,
+                        .props.i.unsign = true,
+                    };
+                    da_append(*ex, e);
+                }
+                lexer_undo_token(p->lex);
+            } break;
+            case T_DOUBLE_DOT: {
+                while (op_stack.count &&
+                       !is_bracket_operator(
+                           op_stack.items[op_stack.count - 1])) {
+                    emit_operator(&op_stack, &name_stack, &cast_type_stack, ex);
+                }
+                if (!op_stack.count ||
+                    op_stack.items[op_stack.count - 1] != OP_OPEN_SQUARE) {
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(), "Unexpected `..` outside of `[]`!\n");
+                    return false;
+                }
+                op_stack.items[op_stack.count - 1] = OP_SUBSLICE;
+
+                if (lexer_next_token(p->lex) == T_CLOSE_SQUARE) {
+                    op_stack.count--;
+                    Expr e = {
+                        .kind = EK_SUBSLICE,
+                        .props.to_end = true,
+                    };
+                    da_append(*ex, e);
+                } else {
+                    lexer_undo_token(p->lex);
+                }
+            } break;
+            case T_CLOSE_SQUARE: {
+                while (op_stack.count &&
+                       !is_bracket_operator(
+                           op_stack.items[op_stack.count - 1])) {
                     emit_operator(&op_stack, &name_stack, &cast_type_stack, ex);
                 }
+                if (!op_stack.count ||
+                    op_stack.items[op_stack.count - 1] != OP_SUBSLICE) {
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(), "Expected `[a..b]` subslice!\n");
+                    return false;
+                }
+                op_stack.count--;
+                Expr e = {
+                    .kind = EK_SUBSLICE,
+                    .props.to_end = false,
+                };
+                da_append(*ex, e);
             } break;
             default:
-                loc_print(stderr, p->lex->token_start_loc);
-                fprintf(stderr, "Unexpected token in expression %d: `%.*s`!\n",
-                        token, (int)p->lex->token_len, p->lex->token_text);
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(),
+                        "Unexpected token in expression %d: `%.*s`!\n", token,
+                        (int)p->lex->token_len, p->lex->token_text);
                 return false;
         }
     }
 
     while (op_stack.count) {
+        if (op_stack.items[op_stack.count - 1] == OP_OPEN_SQUARE ||
+            op_stack.items[op_stack.count - 1] == OP_SUBSLICE) {
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Unclosed `[` of subslice!\n");
+            return false;
+        }
         emit_operator(&op_stack, &name_stack, &cast_type_stack, ex);
     }
     free(op_stack.items);
     free(name_stack.items);
+    free(cast_type_stack.items);
 
     return true;
 }
 
-bool parse_decl_statement(Parser* p, ExpressionStatement* st, char* decl_name) {
-    if (!check_decl_name_available(p, decl_name)) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Redeclaration of `%s`!\n", decl_name);
-        return false;
+// skips block by matching brackets, without building any statements
+bool skip_block_statement(Parser* p) {
+    size_t depth = 0;
+    do {
+        Token token = lexer_next_token(p->lex);
+        switch (token) {
+            case T_OPEN_BRACKETS:
+                depth++;
+                break;
+            case T_CLOSE_BRACKETS:
+                depth--;
+                break;
+            case T_END:
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Reached end of file in block!\n");
+                return false;
+            default:
+                break;
+        }
+    } while (depth);
+    return true;
+}
+
+bool parse_function_content(Parser* p, Function* f) {
+    size_t old_scope = p->current_scope;
+    p->current_scope = f->param_scope;
+
+    if (p->lazy) {
+        if (lexer_next_token(p->lex) == T_OPEN_BRACKETS) {
+            f->lazy = true;
+            f->body = lexer_mark_token(p->lex);
+            if (p->trace) {
+                ParseSkip skip = {
+                    .type_uses = p->trace->type_uses.count,
+                    .strings = p->mod->string_constants.count,
+                };
+                da_append(p->trace->skips, skip);
+            }
+            lexer_undo_token(p->lex);
+            if (!skip_block_statement(p)) return false;
+            p->current_scope = old_scope;
+            return true;
+        }
+        lexer_undo_token(p->lex);
     }
-    da_append(p->mod->scopes.items[p->current_scope], (Decl){0});
-    Decl* d = &p->mod->scopes.items[p->current_scope]
-                   .items[p->mod->scopes.items[p->current_scope].count - 1];
-    d->name = decl_name;
 
-    Token token = lexer_next_token(p->lex);
+    if (!parse_statement(p, &f->content)) return false;
 
-    if (token != T_DECLARE) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Expected declare operator, got %d!\n", token);
+    p->current_scope = old_scope;
+    return true;
+}
+
+// parses `struct [soa] { name: type, ... }` after its keyword
+bool parse_struct_type(Parser* p, StructType* s, char* name) {
+    s->name = strdup(name);
+
+    Token token = lexer_next_token(p->lex);
+    if (token == T_IDENT && p->lex->token_len == 3 &&
+        strncmp("soa", p->lex->token_text, 3) == 0) {
+        s->soa = true;
+        token = lexer_next_token(p->lex);
+    }
+    if (token != T_OPEN_BRACKETS) {
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected `{` of struct `%s`!\n", name);
         return false;
     }
 
-    token = lexer_next_token(p->lex);
-    switch (token) {
-        case KW_FN: {
-            d->kind = DK_FUNCTION;
-            Function f = {0};
-            size_t old_scope = p->current_scope;
-            if (!parse_function_type(p, &f)) {
-                loc_print(stderr, p->lex->token_start_loc);
-                fprintf(stderr, "Failed to parse function type!\n");
-                return false;
-            }
-            p->current_scope = f.param_scope;
-            if (!parse_statement(p, &f.content)) {
-                loc_print(stderr, p->lex->token_start_loc);
-                fprintf(stderr, "Failed to parse function content!\n");
-                return false;
+    while ((token = lexer_next_token(p->lex)) != T_CLOSE_BRACKETS) {
+        if (token != T_IDENT) {
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Expected field name in struct `%s`!\n",
+                    name);
+            return false;
+        }
+        StructField field = {
+            .name = strndup(p->lex->token_text, p->lex->token_len),
+        };
+        for (size_t i = 0; i < s->count; i++) {
+            if (strcmp(s->items[i].name, field.name) == 0) {
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Redeclaration of field `%s`!\n",
+                        field.name);
+                free(field.name);
+                return false;
             }
-            p->current_scope = old_scope;
+        }
+        da_append(*s, field);
+
+        if (lexer_next_token(p->lex) != T_COLON) {
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Expected `:` after field name!\n");
+            return false;
+        }
+        ValueType* vt = &s->items[s->count - 1].vt;
+        if (!parse_value_type(p, vt)) return false;
+        if (vt->kind == VT_ARRAY || (s->soa && vt->kind == VT_STRUCT)) {
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Unsupported type of field `%s`!\n",
+                    s->items[s->count - 1].name);
+            return false;
+        }
+
+        token = lexer_next_token(p->lex);
+        if (token == T_CLOSE_BRACKETS) break;
+        if (token != T_COMMA) {
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Expected `,` or `}` after field!\n");
+            return false;
+        }
+    }
+
+    if (s->count == 0) {
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Struct `%s` has no fields!\n", name);
+        return false;
+    }
+    return true;
+}
 
-            d->value.func_index = p->mod->functions.count;
-            da_append(p->mod->functions, f);
+bool parse_decl_statement(Parser* p, ExpressionStatement* st, char* decl_name) {
+    if (!check_decl_name_available(p, decl_name)) {
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Redeclaration of `%s`!\n", decl_name);
+        return false;
+    }
+    da_append(p->mod->scopes.items[p->current_scope], (Decl){0});
+    Decl* d = &p->mod->scopes.items[p->current_scope]
+                   .items[p->mod->scopes.items[p->current_scope].count - 1];
+    d->name = decl_name;
+
+    Token token = lexer_next_token(p->lex);
+
+    if (token != T_DECLARE) {
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected declare operator, got %d!\n", token);
+        return false;
+    }
+
+    token = lexer_next_token(p->lex);
+    switch (token) {
+        case KW_STRUCT: {
+            if (p->current_scope != 0) {
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(),
+                        "Structs can only be declared in global scope!\n");
+                return false;
+            }
+            // declared before fields, so they can be slices of it
+            d->kind = DK_STRUCT;
+            d->value.struct_index = p->mod->structs.count;
+            da_append(p->mod->structs, (StructType){0});
+            if (!parse_struct_type(
+                    p, &p->mod->structs.items[p->mod->structs.count - 1],
+                    decl_name))
+                return false;
         } break;
+        case KW_FN: {
+            // `fn(` starts type of function value instead, parsed from `fn`
+            LexerMark mark = lexer_mark_token(p->lex);
+            bool value_type = lexer_next_token(p->lex) == T_OPEN_PARENS;
+            lexer_rewind(p->lex, mark);
+            lexer_next_token(p->lex);
+            if (!value_type) {
+                d->kind = DK_FUNCTION;
+                Function f = {0};
+                if (!parse_function_type(p, &f)) {
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(), "Failed to parse function type!\n");
+                    return false;
+                }
+                if (!parse_function_content(p, &f)) {
+                    statement_free(&f.content);
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(),
+                            "Failed to parse function content!\n");
+                    return false;
+                }
+
+                d->value.func_index = p->mod->functions.count;
+                da_append(p->mod->functions, f);
+                break;
+            }
+        }
+            // fallthrough
         default: {  // try to parse variable type
             lexer_undo_token(p->lex);
             d->kind = DK_VARIABLE;
             if (!parse_value_type(p, (ValueType*)&d->value)) {
-                loc_print(stderr, p->lex->token_start_loc);
-                fprintf(stderr, "Failed to parse variable type!\n");
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Failed to parse variable type!\n");
                 return false;
             }
+            bool in_place = d->value.vt.kind == VT_ARRAY ||
+                            d->value.vt.kind == VT_STRUCT;
             if (st) {  // initialization expression
                 st->kind = SK_EXPRESSION;
                 {
                     Expr e = {
                         .kind = EK_VAR,
-                        .props.var = decl_name,
+                        .props.var = strdup(decl_name),
                     };
                     da_append(st->expr, e);
                 }
                 if (!parse_expression(p, &st->expr, EPTM_DEFAULT)) {
-                    loc_print(stderr, p->lex->token_start_loc);
-                    fprintf(stderr,
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(),
                             "Failed to parse initialization expression!\n");
                     return false;
                 }
+                if (st->expr.count > 1 && in_place) {
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(),
+                            "`%s` can't be initialized, only its items or "
+                            "fields!\n",
+                            decl_name);
+                    return false;
+                }
                 if (st->expr.count > 1) {
                     Expr e = {
                         .kind = EK_OPERATOR,
@@ -596,6 +1240,7 @@ bool parse_decl_statement(Parser* p, ExpressionStatement* st, char* decl_name) {
                     };
                     da_append(st->expr, e);
                 } else {
+                    free(st->expr.items[0].props.var);
                     free(st->expr.items);
                     st->expr = (Expression){0};
                 }
@@ -605,8 +1250,8 @@ bool parse_decl_statement(Parser* p, ExpressionStatement* st, char* decl_name) {
 
     token = lexer_next_token(p->lex);
     if (token != T_SEMICOLON) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Expected semicolon after decl, got %d!\n", token);
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected semicolon after decl, got %d!\n", token);
         return false;
     }
 
@@ -625,16 +1270,17 @@ bool parse_export_statement(Parser* p) {
             da_append(p->mod->exports, ex);
         } break;
         default:
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr, "Unexpected token export statement %d!\n", token);
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(),
+                    "Unexpected token export statement %d!\n", token);
             return false;
     }
 
     token = lexer_next_token(p->lex);
 
     if (token != T_SEMICOLON) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Expected semicolon after export statement %d!\n",
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected semicolon after export statement %d!\n",
                 token);
         return false;
     }
@@ -654,15 +1300,15 @@ bool parse_extern_statement(Parser* p) {
             name = strndup(p->lex->token_text, p->lex->token_len);
             break;
         default:
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr, "Unexpected token extern statement, got %d!\n",
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Unexpected token extern statement, got %d!\n",
                     token);
             return false;
     }
 
     if (!check_decl_name_available(p, name)) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Redeclaration of `%s` in extern!\n", name);
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Redeclaration of `%s` in extern!\n", name);
         return false;
     }
     da_append(p->mod->scopes.items[0], (Decl){0});
@@ -673,8 +1319,8 @@ bool parse_extern_statement(Parser* p) {
     token = lexer_next_token(p->lex);
 
     if (token != T_DECLARE) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Expected `:=` after extern statement, got %d!\n",
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected `:=` after extern statement, got %d!\n",
                 token);
         return false;
     }
@@ -682,24 +1328,24 @@ bool parse_extern_statement(Parser* p) {
     token = lexer_next_token(p->lex);
 
     if (token != KW_FN) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Extern supports only function, got %d!\n", token);
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Extern supports only function, got %d!\n", token);
         return false;
     }
 
     Function f = {0};
 
     if (!parse_function_type(p, &f)) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Failed to parse function type in extern!\n");
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Failed to parse function type in extern!\n");
         return false;
     }
 
     token = lexer_next_token(p->lex);
 
     if (token != T_SEMICOLON) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Expected semicolon after extern statement %d!\n",
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected semicolon after extern statement %d!\n",
                 token);
         return false;
     }
@@ -722,8 +1368,8 @@ bool parse_block_statement(Parser* p, BlockStatement* st) {
         lexer_undo_token(p->lex);
         da_append(*st, (Statement){0});
         if (!parse_statement(p, &st->items[st->count - 1])) {
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr, "Failed to parse statement in block!\n");
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Failed to parse statement in block!\n");
             return false;
         }
     }
@@ -736,16 +1382,16 @@ bool parse_block_statement(Parser* p, BlockStatement* st) {
 bool parse_return_statement(Parser* p, ReturnStatement* st) {
     st->kind = SK_RETURN;
     if (!parse_expression(p, &st->expr, EPTM_DEFAULT)) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Failed to expression in return statement!\n");
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Failed to expression in return statement!\n");
         return false;
     }
 
     Token token = lexer_next_token(p->lex);
     if (token != T_SEMICOLON) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Expected semicolon after return statement, got %d!\n",
-                token);
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(),
+                "Expected semicolon after return statement, got %d!\n", token);
         return false;
     }
 
@@ -756,20 +1402,20 @@ bool parse_if_statement(Parser* p, IfStatement* st) {
     st->kind = SK_IF;
 
     if (lexer_next_token(p->lex) != T_OPEN_PARENS) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Expected `(` after `if`!\n");
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected `(` after `if`!\n");
         return false;
     }
 
     if (!parse_expression(p, &st->cond_expr, EPTM_ON_MISMATCHED_PAREN)) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Failed to parse condition in if statement!\n");
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Failed to parse condition in if statement!\n");
         return false;
     }
 
     if (lexer_next_token(p->lex) != T_CLOSE_PARENS) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Expected `)` after `if` condition!\n");
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected `)` after `if` condition!\n");
         return false;
     }
 
@@ -778,8 +1424,9 @@ bool parse_if_statement(Parser* p, IfStatement* st) {
     assert(st->positive_branch);
 
     if (!parse_statement(p, st->positive_branch)) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr, "Failed to parse positive branch of if statement!\n");
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(),
+                "Failed to parse positive branch of if statement!\n");
         return false;
     }
 
@@ -789,8 +1436,8 @@ bool parse_if_statement(Parser* p, IfStatement* st) {
         assert(st->negative_branch);
 
         if (!parse_statement(p, st->negative_branch)) {
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr,
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(),
                     "Failed to parse negative branch of if statement!\n");
             return false;
         }
@@ -801,19 +1448,105 @@ bool parse_if_statement(Parser* p, IfStatement* st) {
     return true;
 }
 
+// parses `switch (x) { case 1, 2: statement ... else statement }`, without
+// falling through cases
+bool parse_switch_statement(Parser* p, SwitchStatement* st) {
+    st->kind = SK_SWITCH;
+
+    if (lexer_next_token(p->lex) != T_OPEN_PARENS) {
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected `(` after `switch`!\n");
+        return false;
+    }
+
+    if (!parse_expression(p, &st->expr, EPTM_ON_MISMATCHED_PAREN)) {
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Failed to parse value of switch statement!\n");
+        return false;
+    }
+
+    if (lexer_next_token(p->lex) != T_CLOSE_PARENS) {
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected `)` after `switch` value!\n");
+        return false;
+    }
+
+    if (lexer_next_token(p->lex) != T_OPEN_BRACKETS) {
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(), "Expected `{` of switch statement!\n");
+        return false;
+    }
+
+    Token token;
+    while ((token = lexer_next_token(p->lex)) != T_CLOSE_BRACKETS) {
+        Statement* branch;
+        if (token == KW_CASE) {
+            do {
+                if (lexer_next_token(p->lex) != T_INT) {
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(),
+                            "Expected integer literal after `case`!\n");
+                    return false;
+                }
+                SwitchCase c = {
+                    .value = p->lex->token_int,
+                    .bits = p->lex->token_bits,
+                    .unsign = p->lex->token_unsign,
+                    .branch = st->branches.count,
+                };
+                for (size_t i = 0; i < st->cases.count; i++) {
+                    if (st->cases.items[i].value == c.value) {
+                        loc_print(diag_out(), p->lex->token_start_loc);
+                        fprintf(diag_out(), "Duplicate case `%.*s`!\n",
+                                (int)p->lex->token_len, p->lex->token_text);
+                        return false;
+                    }
+                }
+                da_append(st->cases, c);
+            } while ((token = lexer_next_token(p->lex)) == T_COMMA);
+
+            if (token != T_COLON) {
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Expected `:` after cases!\n");
+                return false;
+            }
+            da_append(st->branches, (Statement){0});
+            branch = &st->branches.items[st->branches.count - 1];
+        } else if (token == KW_ELSE && !st->default_branch) {
+            st->default_branch = malloc(sizeof(Statement));
+            assert(st->default_branch);
+            memset(st->default_branch, 0, sizeof(Statement));
+            branch = st->default_branch;
+        } else {
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Expected `case` or single `else` in "
+                                "switch statement!\n");
+            return false;
+        }
+
+        if (!parse_statement(p, branch)) {
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "Failed to parse branch of switch!\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
 bool parse_expr_statement(Parser* p, ExpressionStatement* st) {
     st->kind = SK_EXPRESSION;
     if (!parse_expression(p, &st->expr, EPTM_DEFAULT)) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr,
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(),
                 "Failed to parse expression in expression statement!\n");
         return false;
     }
 
     Token token = lexer_next_token(p->lex);
     if (token != T_SEMICOLON) {
-        loc_print(stderr, p->lex->token_start_loc);
-        fprintf(stderr,
+        loc_print(diag_out(), p->lex->token_start_loc);
+        fprintf(diag_out(),
                 "Expected semicolon after expression statement, got %d!\n",
                 token);
         return false;
@@ -829,55 +1562,63 @@ bool parse_statement(Parser* p, Statement* st) {
     switch (token) {
         case T_OPEN_BRACKETS:
             if (!parse_block_statement(p, &st->block)) {
-                loc_print(stderr, p->lex->token_start_loc);
-                fprintf(stderr, "Failed to parse block statement!\n");
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Failed to parse block statement!\n");
                 return false;
             }
             break;
         case KW_RETURN:
             if (!parse_return_statement(p, &st->ret)) {
-                loc_print(stderr, p->lex->token_start_loc);
-                fprintf(stderr, "Failed to parse return statement!\n");
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Failed to parse return statement!\n");
                 return false;
             }
             break;
         case KW_IF:
             if (!parse_if_statement(p, &st->ifs)) {
-                loc_print(stderr, p->lex->token_start_loc);
-                fprintf(stderr, "Failed to parse return statement!\n");
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Failed to parse return statement!\n");
+                return false;
+            }
+            break;
+        case KW_SWITCH:
+            if (!parse_switch_statement(p, &st->switchs)) {
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Failed to parse switch statement!\n");
                 return false;
             }
             break;
         case T_SEMICOLON:
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr, "WARN:%zu:%zu: Extreanous semicolon!\n",
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(), "WARN:%zu:%zu: Extreanous semicolon!\n",
                     p->lex->token_start_loc.line, p->lex->token_start_loc.col);
             break;
         case T_IDENT: {
-            Lexer backup = *p->lex;
+            LexerMark ident = lexer_mark_token(p->lex);
             char* name = strndup(p->lex->token_text, p->lex->token_len);
             if (lexer_next_token(p->lex) == T_DECLARE) {
-                *p->lex = backup;
+                lexer_undo_token(p->lex);
                 if (!parse_decl_statement(p, &st->expr, name)) {
-                    loc_print(stderr, p->lex->token_start_loc);
-                    fprintf(stderr, "Failed to parse local decl statement!\n");
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(),
+                            "Failed to parse local decl statement!\n");
                     return false;
                 }
             } else {
                 free(name);
-                *p->lex = backup;
-                lexer_undo_token(p->lex);
+                lexer_rewind(p->lex, ident);
                 if (!parse_expr_statement(p, &st->expr)) {
-                    loc_print(stderr, p->lex->token_start_loc);
-                    fprintf(stderr, "Failed to parse expr statement!\n");
+                    loc_print(diag_out(), p->lex->token_start_loc);
+                    fprintf(diag_out(), "Failed to parse expr statement!\n");
                     return false;
                 }
             }
         } break;
         default:
-            loc_print(stderr, p->lex->token_start_loc);
-            fprintf(stderr, "Unexpected at beginning of statement %d: %.*s!\n",
-                    token, (int)p->lex->token_len, p->lex->token_text);
+            loc_print(diag_out(), p->lex->token_start_loc);
+            fprintf(diag_out(),
+                    "Unexpected at beginning of statement %d: %.*s!\n", token,
+                    (int)p->lex->token_len, p->lex->token_text);
             return false;
     }
 
@@ -903,26 +1644,893 @@ bool parse_global_scope(Parser* p) {
                     return false;
                 break;
             default:
-                loc_print(stderr, p->lex->token_start_loc);
-                fprintf(stderr, "Unexpected token in global scope %d!\n",
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Unexpected token in global scope %d!\n",
                         token);
                 return false;
         }
     }
 }
 
-Module parse(Lexer* lexer) {
-    Module mod = {0};
+// lazy parsing
+
+typedef struct {
+    da_list(size_t);
+} FunctionIndices;
+
+// resolves name the same way codegen does, starting from the global scope
+Decl* find_decl(Module* mod, size_t scope, char* name) {
+    DeclScope* s = &mod->scopes.items[scope];
+
+    if (scope != 0) {
+        Decl* d = find_decl(mod, s->parent, name);
+        if (d) return d;
+    }
+
+    return scope_find_decl(s, name);
+}
+
+void mark_function_reachable(Module* mod, size_t scope, char* name,
+                             FunctionIndices* worklist) {
+    Decl* d = find_decl(mod, scope, name);
+    if (d && d->kind == DK_FUNCTION) da_append(*worklist, d->value.func_index);
+}
+
+void mark_expression_reachable(Module* mod, Expression* ex, size_t scope,
+                               FunctionIndices* worklist) {
+    for (size_t i = 0; i < ex->count; i++) {
+        switch (ex->items[i].kind) {
+            case EK_VAR:
+                mark_function_reachable(mod, scope, ex->items[i].props.var,
+                                        worklist);
+                break;
+            case EK_FUNC_CALL:
+                mark_function_reachable(mod, scope, ex->items[i].props.func,
+                                        worklist);
+                break;
+            case EK_CONDITIONAL:
+                for (size_t j = 0; j < 3; j++) {
+                    mark_expression_reachable(
+                        mod, &ex->items[i].props.arms[j], scope, worklist);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void mark_statement_reachable(Module* mod, Statement* st, size_t scope,
+                              FunctionIndices* worklist) {
+    switch (st->kind) {
+        case SK_EMPTY:
+            break;
+        case SK_BLOCK:
+            for (size_t i = 0; i < st->block.count; i++) {
+                mark_statement_reachable(mod, &st->block.items[i],
+                                         st->block.scope, worklist);
+            }
+            break;
+        case SK_RETURN:
+            mark_expression_reachable(mod, &st->ret.expr, scope, worklist);
+            break;
+        case SK_IF:
+            mark_expression_reachable(mod, &st->ifs.cond_expr, scope,
+                                      worklist);
+            mark_statement_reachable(mod, st->ifs.positive_branch, scope,
+                                     worklist);
+            if (st->ifs.negative_branch)
+                mark_statement_reachable(mod, st->ifs.negative_branch, scope,
+                                         worklist);
+            break;
+        case SK_EXPRESSION:
+            mark_expression_reachable(mod, &st->expr.expr, scope, worklist);
+            break;
+        case SK_SWITCH:
+            mark_expression_reachable(mod, &st->switchs.expr, scope,
+                                      worklist);
+            for (size_t i = 0; i < st->switchs.branches.count; i++) {
+                mark_statement_reachable(mod, &st->switchs.branches.items[i],
+                                         scope, worklist);
+            }
+            if (st->switchs.default_branch)
+                mark_statement_reachable(mod, st->switchs.default_branch,
+                                         scope, worklist);
+            break;
+    }
+}
+
+// parses content of lazy functions reachable from exports, others are left
+// with empty content
+bool parse_reachable_functions(Parser* p) {
+    Module* mod = p->mod;
+    FunctionIndices worklist = {0};
+    struct {
+        da_list(bool);
+    } visited = {0};
+
+    for (size_t i = 0; i < mod->exports.count; i++) {
+        mark_function_reachable(mod, 0, mod->exports.items[i].decl_name,
+                                &worklist);
+    }
+
+    while (worklist.count) {
+        size_t fi = worklist.items[--worklist.count];
+        while (visited.count < mod->functions.count) da_append(visited, false);
+        if (visited.items[fi]) continue;
+        visited.items[fi] = true;
+
+        if (mod->functions.items[fi].lazy) {
+            Function f = mod->functions.items[fi];
+            lexer_rewind(p->lex, f.body);
+            p->current_scope = f.param_scope;
+            if (!parse_statement(p, &f.content)) {
+                loc_print(diag_out(), p->lex->token_start_loc);
+                fprintf(diag_out(), "Failed to parse function content!\n");
+                return false;
+            }
+            p->current_scope = 0;
+            f.lazy = false;
+            // parsing could have appended nested functions
+            mod->functions.items[fi] = f;
+        }
+
+        Function* f = &mod->functions.items[fi];
+        mark_statement_reachable(mod, &f->content, f->param_scope, &worklist);
+    }
+
+    free(worklist.items);
+    free(visited.items);
+    return true;
+}
+
+// parallel parsing
+//
+// Global scope is parsed first with function bodies skipped, like in lazy
+// mode. Then bodies are parsed by workers, each into its own fragment module,
+// which starts with copies of global scopes and function types, so names and
+// signatures can be resolved against them. Everything a body adds to
+// fragment is then merged into module in order of functions. At last,
+// functions, strings and function types are renumbered to the order in which
+// serial parsing adds them, so the module doesn't depend on the number of
+// threads either.
+
+typedef struct {
+    Module frag;
+    size_t shared_scopes;          // scopes copied from module
+    size_t shared_function_types;  // function types copied from module
+    struct {
+        da_list(size_t);
+    } type_map;  // fragment function type -> module function type
+    ParseTrace trace;
+    Stats stats;  // thread local stats of worker thread
+} ParseWorker;
+
+typedef struct {
+    Statement content;
+    size_t worker;
+    size_t scopes_start, scopes_end;
+    size_t functions_start, functions_end;
+    size_t strings_start, strings_end;
+    size_t types_start, types_end;
+    size_t inner_start, inner_end;
+    size_t uses_start, uses_end;  // in trace of worker
+    // where it was merged into module
+    size_t merged_functions, merged_strings;
+    bool ok;
+} ParsedBody;
+
+typedef struct {
+    Module* mod;
+    Lexer* lex;
+    ParseTrace* trace;        // of global scope
+    FunctionIndices pending;  // lazy functions, in order
+    size_t global_functions;  // counts before bodies are merged
+    size_t global_strings;
+    ParsedBody* bodies;
+    ParseWorker* workers;
+#ifndef __wasi__
+    atomic_size_t next;
+#else
+    size_t next;
+#endif
+} ParallelParse;
+
+typedef struct {
+    ParallelParse* pp;
+    size_t worker;
+} ParseWorkerArgs;
+
+void* parse_worker_run(void* arg) {
+    ParallelParse* pp = ((ParseWorkerArgs*)arg)->pp;
+    size_t wi = ((ParseWorkerArgs*)arg)->worker;
+    ParseWorker* w = &pp->workers[wi];
+
+    Lexer lex = {
+        .input_buffer = pp->lex->input_buffer,
+        .input_size = pp->lex->input_size,
+    };
+    Parser p = {.lex = &lex, .mod = &w->frag, .trace = &w->trace};
+
+    while (true) {
+#ifndef __wasi__
+        size_t i = atomic_fetch_add(&pp->next, 1);
+#else
+        size_t i = pp->next++;
+#endif
+        if (i >= pp->pending.count) break;
+
+        Function* f = &pp->mod->functions.items[pp->pending.items[i]];
+        ParsedBody* b = &pp->bodies[i];
+        b->worker = wi;
+        b->scopes_start = w->frag.scopes.count;
+        b->functions_start = w->frag.functions.count;
+        b->strings_start = w->frag.string_constants.count;
+        b->types_start = w->frag.function_types.count;
+        b->inner_start = w->frag.inner_types.count;
+        b->uses_start = w->trace.type_uses.count;
+
+        lexer_rewind(&lex, f->body);
+        p.current_scope = f->param_scope;
+        b->ok = parse_statement(&p, &b->content);
+        if (!b->ok) {
+            loc_print(diag_out(), lex.token_start_loc);
+            fprintf(diag_out(), "Failed to parse function content!\n");
+        }
+
+        b->scopes_end = w->frag.scopes.count;
+        b->functions_end = w->frag.functions.count;
+        b->strings_end = w->frag.string_constants.count;
+        b->types_end = w->frag.function_types.count;
+        b->inner_end = w->frag.inner_types.count;
+        b->uses_end = w->trace.type_uses.count;
+    }
+
+    free(lex.token_str.items);
+    w->stats = stats;
+    w->stats.allocated_bytes += da_allocated_bytes;
+    return NULL;
+}
+
+typedef struct {
+    Module* mod;
+    ParseWorker* w;
+    ParsedBody* b;
+    size_t scopes_base;
+    size_t functions_base;
+    size_t strings_base;
+} FragmentMerge;
+
+size_t merge_scope_index(FragmentMerge* m, size_t scope) {
+    if (scope < m->w->shared_scopes) return scope;
+    return m->scopes_base + (scope - m->b->scopes_start);
+}
+
+size_t merge_function_type_index(FragmentMerge* m, size_t type) {
+    if (type < m->w->shared_function_types) return type;
+    return m->w->type_map.items[type - m->w->shared_function_types];
+}
+
+// inner types are merged on their own, each of them once
+void merge_value_type(FragmentMerge* m, ValueType* vt) {
+    if (vt->kind == VT_FUNCTION) {
+        vt->props.function_type =
+            merge_function_type_index(m, vt->props.function_type);
+    }
+}
+
+// maps function types added by body, in order, so types in their signatures
+// are mapped first; new ones are appended only after all are mapped, so
+// module types they are compared with are all in terms of module
+void merge_function_types(FragmentMerge* m) {
+    Module* mod = m->mod;
+    ParseWorker* w = m->w;
+    FunctionTypeMap map = {
+        .shared = w->shared_function_types,
+        .items = w->type_map.items,
+    };
+    size_t added = 0;
+    for (size_t t = m->b->types_start; t < m->b->types_end; t++) {
+        size_t* mapped = &w->type_map.items[t - w->shared_function_types];
+        if (!find_mapped_function_type(mod, &w->frag,
+                                       w->frag.function_types.items[t],
+                                       &map, mapped))
+            *mapped = mod->function_types.count + added++;
+    }
+    for (size_t t = m->b->types_start; t < m->b->types_end; t++) {
+        if (merge_function_type_index(m, t) < mod->function_types.count)
+            continue;
+        FunctionType ft = w->frag.function_types.items[t];
+        ft.param_scope = merge_scope_index(m, ft.param_scope);
+        merge_value_type(m, &ft.return_type);
+        da_append(mod->function_types, ft);
+    }
+}
+
+void merge_expression(FragmentMerge* m, Expression* ex) {
+    for (size_t i = 0; i < ex->count; i++) {
+        if (ex->items[i].kind == EK_STRING_CONST) {
+            ex->items[i].props.str_index +=
+                m->strings_base - m->b->strings_start;
+        }
+        if (ex->items[i].kind == EK_CASTING) {
+            merge_value_type(m, &ex->items[i].props.cast_target);
+        }
+        if (ex->items[i].kind == EK_CONDITIONAL) {
+            for (size_t j = 0; j < 3; j++) {
+                merge_expression(m, &ex->items[i].props.arms[j]);
+            }
+        }
+    }
+}
+
+void merge_statement(FragmentMerge* m, Statement* st) {
+    switch (st->kind) {
+        case SK_EMPTY:
+            break;
+        case SK_BLOCK:
+            st->block.scope = merge_scope_index(m, st->block.scope);
+            for (size_t i = 0; i < st->block.count; i++) {
+                merge_statement(m, &st->block.items[i]);
+            }
+            break;
+        case SK_RETURN:
+            merge_expression(m, &st->ret.expr);
+            break;
+        case SK_IF:
+            merge_expression(m, &st->ifs.cond_expr);
+            merge_statement(m, st->ifs.positive_branch);
+            if (st->ifs.negative_branch)
+                merge_statement(m, st->ifs.negative_branch);
+            break;
+        case SK_EXPRESSION:
+            merge_expression(m, &st->expr.expr);
+            break;
+        case SK_SWITCH:
+            merge_expression(m, &st->switchs.expr);
+            for (size_t i = 0; i < st->switchs.branches.count; i++) {
+                merge_statement(m, &st->switchs.branches.items[i]);
+            }
+            if (st->switchs.default_branch)
+                merge_statement(m, st->switchs.default_branch);
+            break;
+    }
+}
+
+// moves everything parsed for body into module
+void merge_parsed_body(ParallelParse* pp, size_t i) {
+    Module* mod = pp->mod;
+    ParsedBody* b = &pp->bodies[i];
+    ParseWorker* w = &pp->workers[b->worker];
+    FragmentMerge m = {
+        .mod = mod,
+        .w = w,
+        .b = b,
+        .scopes_base = mod->scopes.count,
+        .functions_base = mod->functions.count,
+        .strings_base = mod->string_constants.count,
+    };
+    b->merged_functions = m.functions_base;
+    b->merged_strings = m.strings_base;
+
+    for (size_t j = b->scopes_start; j < b->scopes_end; j++) {
+        DeclScope s = w->frag.scopes.items[j];
+        s.parent = merge_scope_index(&m, s.parent);
+        for (size_t k = 0; k < s.count; k++) {
+            if (s.items[k].kind == DK_FUNCTION) {
+                s.items[k].value.func_index +=
+                    m.functions_base - b->functions_start;
+            }
+        }
+        da_append(mod->scopes, s);
+    }
+
+    for (size_t j = b->strings_start; j < b->strings_end; j++) {
+        da_append(mod->string_constants, w->frag.string_constants.items[j]);
+    }
+
+    merge_function_types(&m);
+    for (size_t j = m.scopes_base; j < mod->scopes.count; j++) {
+        DeclScope* s = &mod->scopes.items[j];
+        for (size_t k = 0; k < s->count; k++) {
+            if (s->items[k].kind == DK_PARAM ||
+                s->items[k].kind == DK_VARIABLE)
+                merge_value_type(&m, &s->items[k].value.vt);
+        }
+    }
+    for (size_t j = b->inner_start; j < b->inner_end; j++) {
+        merge_value_type(&m, w->frag.inner_types.items[j]);
+    }
+
+    for (size_t j = b->functions_start; j < b->functions_end; j++) {
+        Function f = w->frag.functions.items[j];
+        f.param_scope = merge_scope_index(&m, f.param_scope);
+        f.function_type = merge_function_type_index(&m, f.function_type);
+        merge_value_type(&m, &f.return_type);
+        merge_statement(&m, &f.content);
+        da_append(mod->functions, f);
+    }
+
+    Function* f = &mod->functions.items[pp->pending.items[i]];
+    merge_statement(&m, &b->content);
+    f->content = b->content;
+    f->lazy = false;
+}
+
+// new indices of functions, strings and function types
+typedef struct {
+    size_t* functions;
+    size_t* strings;
+    size_t* types;
+} SerialOrder;
+
+void order_value_type(SerialOrder* o, ValueType* vt) {
+    if (vt->kind == VT_FUNCTION) {
+        vt->props.function_type = o->types[vt->props.function_type];
+    }
+}
+
+void order_expression(SerialOrder* o, Expression* ex) {
+    for (size_t i = 0; i < ex->count; i++) {
+        if (ex->items[i].kind == EK_STRING_CONST) {
+            ex->items[i].props.str_index =
+                o->strings[ex->items[i].props.str_index];
+        }
+        if (ex->items[i].kind == EK_CASTING) {
+            order_value_type(o, &ex->items[i].props.cast_target);
+        }
+        if (ex->items[i].kind == EK_CONDITIONAL) {
+            for (size_t j = 0; j < 3; j++) {
+                order_expression(o, &ex->items[i].props.arms[j]);
+            }
+        }
+    }
+}
+
+void order_statement(SerialOrder* o, Statement* st) {
+    switch (st->kind) {
+        case SK_EMPTY:
+            break;
+        case SK_BLOCK:
+            for (size_t i = 0; i < st->block.count; i++) {
+                order_statement(o, &st->block.items[i]);
+            }
+            break;
+        case SK_RETURN:
+            order_expression(o, &st->ret.expr);
+            break;
+        case SK_IF:
+            order_expression(o, &st->ifs.cond_expr);
+            order_statement(o, st->ifs.positive_branch);
+            if (st->ifs.negative_branch)
+                order_statement(o, st->ifs.negative_branch);
+            break;
+        case SK_EXPRESSION:
+            order_expression(o, &st->expr.expr);
+            break;
+        case SK_SWITCH:
+            order_expression(o, &st->switchs.expr);
+            for (size_t i = 0; i < st->switchs.branches.count; i++) {
+                order_statement(o, &st->switchs.branches.items[i]);
+            }
+            if (st->switchs.default_branch)
+                order_statement(o, st->switchs.default_branch);
+            break;
+    }
+}
+
+// serial parsing adds function type when it's first used
+static void order_type_use(SerialOrder* o, size_t type, size_t* next) {
+    if (o->types[type] == (size_t)-1) o->types[type] = (*next)++;
+}
+
+// serial parsing adds what body of function has when it reaches the body,
+// in the middle of global scope; its nested functions come before function
+void compute_serial_order(ParallelParse* pp, SerialOrder* o) {
+    Module* mod = pp->mod;
+    ParseTrace* trace = pp->trace;
+    size_t next_function = 0, next_string = 0, next_type = 0;
+    size_t string = 0, use = 0;
+
+    for (size_t i = 0; i < mod->function_types.count; i++) {
+        o->types[i] = (size_t)-1;
+    }
+
+    for (size_t k = 0, i = 0; i < pp->global_functions; i++) {
+        if (k == pp->pending.count || pp->pending.items[k] != i) {
+            o->functions[i] = next_function++;
+            continue;
+        }
+        ParsedBody* b = &pp->bodies[k];
+        ParseWorker* w = &pp->workers[b->worker];
+        ParseSkip* skip = &trace->skips.items[k++];
+
+        for (; string < skip->strings; string++) {
+            o->strings[string] = next_string++;
+        }
+        for (; use < skip->type_uses; use++) {
+            order_type_use(o, trace->type_uses.items[use], &next_type);
+        }
+
+        for (size_t j = 0; j < b->functions_end - b->functions_start; j++) {
+            o->functions[b->merged_functions + j] = next_function++;
+        }
+        o->functions[i] = next_function++;
+        for (size_t j = 0; j < b->strings_end - b->strings_start; j++) {
+            o->strings[b->merged_strings + j] = next_string++;
+        }
+        FragmentMerge m = {.w = w};
+        for (size_t j = b->uses_start; j < b->uses_end; j++) {
+            order_type_use(
+                o, merge_function_type_index(&m, w->trace.type_uses.items[j]),
+                &next_type);
+        }
+    }
+    for (; string < pp->global_strings; string++) {
+        o->strings[string] = next_string++;
+    }
+    for (; use < trace->type_uses.count; use++) {
+        order_type_use(o, trace->type_uses.items[use], &next_type);
+    }
+
+    // every function type is added by its first use
+    diag_check(next_type == mod->function_types.count);
+}
+
+// moves items of list to their new indices
+static void permute_items(void* items, size_t count, size_t size,
+                          size_t* order) {
+    if (count == 0) return;
+    char* old = malloc(count * size);
+    assert(old);
+    memcpy(old, items, count * size);
+    for (size_t i = 0; i < count; i++) {
+        memcpy((char*)items + order[i] * size, old + i * size, size);
+    }
+    free(old);
+}
+
+void apply_serial_order(Module* mod, SerialOrder* o) {
+    for (size_t i = 0; i < mod->scopes.count; i++) {
+        DeclScope* s = &mod->scopes.items[i];
+        for (size_t k = 0; k < s->count; k++) {
+            if (s->items[k].kind == DK_FUNCTION) {
+                s->items[k].value.func_index =
+                    o->functions[s->items[k].value.func_index];
+            } else if (s->items[k].kind == DK_PARAM ||
+                       s->items[k].kind == DK_VARIABLE) {
+                order_value_type(o, &s->items[k].value.vt);
+            }
+        }
+    }
+    for (size_t i = 0; i < mod->extern_functions.count; i++) {
+        Function* f = &mod->extern_functions.items[i];
+        f->function_type = o->types[f->function_type];
+        order_value_type(o, &f->return_type);
+    }
+    for (size_t i = 0; i < mod->functions.count; i++) {
+        Function* f = &mod->functions.items[i];
+        f->function_type = o->types[f->function_type];
+        order_value_type(o, &f->return_type);
+        order_statement(o, &f->content);
+    }
+    for (size_t i = 0; i < mod->function_types.count; i++) {
+        order_value_type(o, &mod->function_types.items[i].return_type);
+    }
+    for (size_t i = 0; i < mod->structs.count; i++) {
+        StructType* s = &mod->structs.items[i];
+        for (size_t j = 0; j < s->count; j++) {
+            order_value_type(o, &s->items[j].vt);
+        }
+    }
+    for (size_t i = 0; i < mod->inner_types.count; i++) {
+        order_value_type(o, mod->inner_types.items[i]);
+    }
+
+    permute_items(mod->functions.items, mod->functions.count,
+                  sizeof(Function), o->functions);
+    permute_items(mod->string_constants.items, mod->string_constants.count,
+                  sizeof(StringConstant), o->strings);
+    permute_items(mod->function_types.items, mod->function_types.count,
+                  sizeof(FunctionType), o->types);
+    // built again on next lookup
+    free(mod->function_type_index.slots);
+    mod->function_type_index = (FunctionTypeIndex){0};
+}
+
+void restore_serial_order(ParallelParse* pp) {
+    Module* mod = pp->mod;
+    SerialOrder o = {
+        .functions = malloc(mod->functions.count * sizeof(size_t)),
+        .strings = malloc(mod->string_constants.count * sizeof(size_t)),
+        .types = malloc(mod->function_types.count * sizeof(size_t)),
+    };
+    assert((o.functions || mod->functions.count == 0) &&
+           (o.strings || mod->string_constants.count == 0) &&
+           (o.types || mod->function_types.count == 0));
+    compute_serial_order(pp, &o);
+    apply_serial_order(mod, &o);
+    free(o.functions);
+    free(o.strings);
+    free(o.types);
+}
+
+bool parse_functions_parallel(Parser* p, size_t jobs) {
+    ParallelParse pp = {
+        .mod = p->mod,
+        .lex = p->lex,
+        .trace = p->trace,
+        .global_functions = p->mod->functions.count,
+        .global_strings = p->mod->string_constants.count,
+    };
+
+    for (size_t i = 0; i < p->mod->functions.count; i++) {
+        if (p->mod->functions.items[i].lazy) da_append(pp.pending, i);
+    }
+    if (jobs > pp.pending.count) jobs = pp.pending.count;
+
+    pp.bodies = calloc(pp.pending.count, sizeof(ParsedBody));
+    pp.workers = calloc(jobs, sizeof(ParseWorker));
+    ParseWorkerArgs* args = calloc(jobs, sizeof(ParseWorkerArgs));
+    assert((pp.bodies && pp.workers && args) || jobs == 0);
+
+    for (size_t wi = 0; wi < jobs; wi++) {
+        ParseWorker* w = &pp.workers[wi];
+        w->shared_scopes = p->mod->scopes.count;
+        w->shared_function_types = p->mod->function_types.count;
+        for (size_t i = 0; i < p->mod->scopes.count; i++) {
+            // fragment builds its own index of shared scopes
+            DeclScope s = p->mod->scopes.items[i];
+            s.index = (DeclIndex){0};
+            da_append(w->frag.scopes, s);
+        }
+        for (size_t i = 0; i < p->mod->function_types.count; i++) {
+            da_append(w->frag.function_types, p->mod->function_types.items[i]);
+        }
+        args[wi] = (ParseWorkerArgs){.pp = &pp, .worker = wi};
+    }
+
+#ifndef __wasi__
+    pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+    assert(threads || jobs == 0);
+    for (size_t wi = 1; wi < jobs; wi++) {
+        if (pthread_create(&threads[wi], NULL, parse_worker_run, &args[wi])) {
+            fprintf(diag_out(), "Failed to start parsing thread!\n");
+            diag_fail();
+        }
+    }
+    if (jobs) parse_worker_run(&args[0]);
+    for (size_t wi = 1; wi < jobs; wi++) {
+        pthread_join(threads[wi], NULL);
+        stats_merge(&stats, &pp.workers[wi].stats);
+    }
+    free(threads);
+#else
+    if (jobs) parse_worker_run(&args[0]);
+#endif
+
+    bool ok = true;
+    for (size_t i = 0; i < pp.pending.count; i++) {
+        if (!pp.bodies[i].ok) ok = false;
+    }
 
-    Parser parser = {.mod = &mod, .lex = lexer};
+    if (ok) {
+        for (size_t wi = 0; wi < jobs; wi++) {
+            ParseWorker* w = &pp.workers[wi];
+            size_t new_types =
+                w->frag.function_types.count - w->shared_function_types;
+            for (size_t i = 0; i < new_types; i++) {
+                da_append(w->type_map, (size_t)-1);
+            }
+        }
+        for (size_t i = 0; i < pp.pending.count; i++) {
+            merge_parsed_body(&pp, i);
+        }
+        restore_serial_order(&pp);
+    }
 
-    da_append(mod.scopes, (DeclScope){0});
+    for (size_t wi = 0; wi < jobs; wi++) {
+        ParseWorker* w = &pp.workers[wi];
+        for (size_t i = 0; i < w->frag.inner_types.count; i++) {
+            da_append(p->mod->inner_types, w->frag.inner_types.items[i]);
+        }
+        free(w->frag.inner_types.items);
+        for (size_t i = 0; i < w->shared_scopes; i++) {
+            free(w->frag.scopes.items[i].index.slots);
+        }
+        free(w->frag.scopes.items);
+        free(w->frag.function_type_index.slots);
+        free(w->frag.function_types.items);
+        free(w->frag.functions.items);
+        free(w->frag.string_constants.items);
+        free(w->type_map.items);
+        free(w->trace.type_uses.items);
+        free(w->trace.skips.items);
+    }
+    free(args);
+    free(pp.workers);
+    free(pp.bodies);
+    free(pp.pending.items);
+    return ok;
+}
 
-    if (!parse_global_scope(&parser)) {
-        loc_print(stderr, lexer->token_start_loc);
-        fprintf(stderr, "Failed to parse global scope!\n");
-        exit(-1);
+static bool parse_module_content(Lexer* lexer, ParseOptions options,
+                                 Module* mod) {
+    bool parallel = options.jobs > 1 && !options.lazy;
+    ParseTrace trace = {0};
+    Parser parser = {
+        .mod = mod,
+        .lex = lexer,
+        .lazy = options.lazy || parallel,
+        .trace = parallel ? &trace : NULL,
+    };
+
+    da_append(mod->scopes, (DeclScope){0});
+
+    bool ok = parse_global_scope(&parser);
+    if (!ok) {
+        loc_print(diag_out(), lexer->token_start_loc);
+        fprintf(diag_out(), "Failed to parse global scope!\n");
+    } else if (parallel && !parse_functions_parallel(&parser, options.jobs)) {
+        fprintf(diag_out(), "Failed to parse functions!\n");
+        ok = false;
+    }
+    free(trace.type_uses.items);
+    free(trace.skips.items);
+    if (!ok) return false;
+
+    if (options.lazy && !parse_reachable_functions(&parser)) {
+        loc_print(diag_out(), lexer->token_start_loc);
+        fprintf(diag_out(), "Failed to parse reachable functions!\n");
+        return false;
     }
 
+    return true;
+}
+
+bool parse_module(Lexer* lexer, ParseOptions options, Module* mod) {
+    uint64_t start = stats_now();
+    bool ok = parse_module_content(lexer, options, mod);
+    stats_end_phase(PHASE_PARSE, start);
+    return ok;
+}
+
+Module parse(Lexer* lexer, ParseOptions options) {
+    Module mod = {0};
+    if (!parse_module(lexer, options, &mod)) exit(-1);
     return mod;
 }
+
+// freeing
+
+void expression_free(Expression* ex) {
+    for (size_t i = 0; i < ex->count; i++) {
+        Expr* e = &ex->items[i];
+        switch (e->kind) {
+            case EK_VAR:
+                free(e->props.var);
+                break;
+            case EK_FUNC_CALL:
+                free(e->props.func);
+                break;
+            case EK_FIELD_ACCESS:
+                free(e->props.field_name);
+                break;
+            case EK_CONDITIONAL:
+                for (size_t j = 0; j < 3; j++) {
+                    expression_free(&e->props.arms[j]);
+                }
+                free(e->props.arms);
+                break;
+            default:
+                break;
+        }
+    }
+    free(ex->items);
+}
+
+void statement_free(Statement* st) {
+    switch (st->kind) {
+        case SK_EMPTY:
+            break;
+        case SK_BLOCK:
+            for (size_t i = 0; i < st->block.count; i++) {
+                statement_free(&st->block.items[i]);
+            }
+            free(st->block.items);
+            break;
+        case SK_RETURN:
+            expression_free(&st->ret.expr);
+            break;
+        case SK_IF:
+            expression_free(&st->ifs.cond_expr);
+            if (st->ifs.positive_branch) {  // unset if parsing failed early
+                statement_free(st->ifs.positive_branch);
+                free(st->ifs.positive_branch);
+            }
+            if (st->ifs.negative_branch) {
+                statement_free(st->ifs.negative_branch);
+                free(st->ifs.negative_branch);
+            }
+            break;
+        case SK_EXPRESSION:
+            expression_free(&st->expr.expr);
+            break;
+        case SK_SWITCH:
+            expression_free(&st->switchs.expr);
+            free(st->switchs.cases.items);
+            for (size_t i = 0; i < st->switchs.branches.count; i++) {
+                statement_free(&st->switchs.branches.items[i]);
+            }
+            free(st->switchs.branches.items);
+            if (st->switchs.default_branch) {
+                statement_free(st->switchs.default_branch);
+                free(st->switchs.default_branch);
+            }
+            break;
+    }
+}
+
+void module_reset(Module* mod) {
+    for (size_t i = 0; i < mod->exports.count; i++) {
+        free(mod->exports.items[i].decl_name);
+    }
+    mod->exports.count = 0;
+
+    for (size_t i = 0; i < mod->scopes.count; i++) {
+        DeclScope* s = &mod->scopes.items[i];
+        for (size_t j = 0; j < s->count; j++) {
+            free(s->items[j].name);
+        }
+        free(s->items);
+        free(s->index.slots);
+    }
+    mod->scopes.count = 0;
+
+    mod->function_types.count = 0;
+    free(mod->function_type_index.slots);
+    mod->function_type_index = (FunctionTypeIndex){0};
+
+    for (size_t i = 0; i < mod->extern_functions.count; i++) {
+        statement_free(&mod->extern_functions.items[i].content);
+    }
+    mod->extern_functions.count = 0;
+
+    for (size_t i = 0; i < mod->functions.count; i++) {
+        statement_free(&mod->functions.items[i].content);
+    }
+    mod->functions.count = 0;
+
+    for (size_t i = 0; i < mod->string_constants.count; i++) {
+        free(mod->string_constants.items[i].chars);
+    }
+    mod->string_constants.count = 0;
+
+    for (size_t i = 0; i < mod->inner_types.count; i++) {
+        free(mod->inner_types.items[i]);
+    }
+    mod->inner_types.count = 0;
+
+    for (size_t i = 0; i < mod->structs.count; i++) {
+        StructType* s = &mod->structs.items[i];
+        for (size_t j = 0; j < s->count; j++) {
+            free(s->items[j].name);
+        }
+        free(s->items);
+        free(s->name);
+    }
+    mod->structs.count = 0;
+}
+
+void module_free(Module* mod) {
+    module_reset(mod);
+    free(mod->exports.items);
+    free(mod->scopes.items);
+    free(mod->function_types.items);
+    free(mod->extern_functions.items);
+    free(mod->functions.items);
+    free(mod->string_constants.items);
+    free(mod->inner_types.items);
+    free(mod->structs.items);
+    *mod = (Module){0};
+}
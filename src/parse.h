@@ -23,13 +23,19 @@ typedef enum {
     DK_EXTERN_FUNCTION,
     DK_PARAM,
     DK_VARIABLE,
+    DK_STRUCT,
 } DeclKind;
 
 typedef enum {
     VT_NIL,
     VT_INT,
+    VT_FLOAT,
     VT_BOOL,
     VT_SLICE,
+    VT_V128,  // 16 bytes of SIMD lanes, their type is given by intrinsics
+    VT_ARRAY,  // fixed size, in frame of a function, used as a slice
+    VT_STRUCT,  // in memory, its value is the address
+    VT_FUNCTION,  // slot in table of functions used as values
 } ValueTypeKind;
 
 typedef struct ValueType {
@@ -39,7 +45,16 @@ typedef struct ValueType {
             int bits;
             bool unsign;
         } i;
+        struct {
+            int bits;
+        } f;
         struct ValueType* inner_type;
+        struct {
+            struct ValueType* inner_type;
+            uint32_t len;
+        } array;
+        size_t struct_index;
+        size_t function_type;  // signature of function value
     } props;
 } ValueType;
 
@@ -49,13 +64,24 @@ typedef struct {
     union {
         ValueType vt;
         size_t func_index;
+        size_t struct_index;
     } value;
 } Decl;
 
+// hash index of decl names, built lazily once scope gets big, so lookups in
+// scopes with many decls don't scan them all, see `scope_find_decl`
+typedef struct {
+    size_t* slots;  // decl index + 1, 0 is an empty slot
+    size_t capacity;
+    size_t indexed;    // decls already in slots
+    size_t variables;  // variables among indexed decls
+} DeclIndex;
+
 typedef struct {
     da_list(Decl);
     size_t parent;
     bool param_scope;
+    DeclIndex index;
 } DeclScope;
 
 typedef struct {
@@ -66,6 +92,7 @@ typedef struct {
 
 typedef enum {
     EK_INT_CONST,
+    EK_FLOAT_CONST,
     EK_BOOL_CONST,
     EK_STRING_CONST,
     EK_VAR,
@@ -73,6 +100,8 @@ typedef enum {
     EK_FUNC_CALL,
     EK_FIELD_ACCESS,
     EK_CASTING,
+    EK_SUBSLICE,
+    EK_CONDITIONAL,
 } ExprKind;
 
 typedef enum {
@@ -91,6 +120,8 @@ typedef enum {
     OP_FUNC_CALL,
     OP_FIELD_ACCESS,
     OP_CASTING,
+    OP_OPEN_SQUARE,
+    OP_SUBSLICE,  // `[` after its `..`
 } OperatorKind;
 
 typedef struct {
@@ -101,6 +132,10 @@ typedef struct {
             int bits;
             bool unsign;
         } i;
+        struct {
+            double value;
+            int bits;
+        } f;
         bool boolean;
         char* var;
         OperatorKind op;
@@ -108,11 +143,15 @@ typedef struct {
         size_t str_index;
         char* field_name;
         ValueType cast_target;
+        bool to_end;  // subslice without end bound
+        // condition, then and else arm of `if c then a else b`, which are
+        // separate expressions, so arms can be evaluated lazily
+        struct Expression* arms;
     } props;
 } Expr;
 
 // expressions are stored as list of Expr which describe exression in RPN
-typedef struct {
+typedef struct Expression {
     da_list(Expr);
 } Expression;
 
@@ -124,6 +163,7 @@ typedef enum {
     SK_RETURN,
     SK_IF,
     SK_EXPRESSION,
+    SK_SWITCH,
 } StatementKind;
 
 typedef struct {
@@ -136,6 +176,18 @@ typedef struct {
     Expression expr;
 } ExpressionStatement;
 
+// integer literal of `case`, several can share a branch
+typedef struct {
+    int64_t value;
+    int bits;
+    bool unsign;
+    size_t branch;
+} SwitchCase;
+
+typedef struct {
+    da_list(SwitchCase);
+} SwitchCases;
+
 typedef union Statement {
     StatementKind kind;
     struct BlockStatement {
@@ -151,12 +203,23 @@ typedef union Statement {
         union Statement* negative_branch;
     } ifs;
     ExpressionStatement expr;
+    struct SwitchStatement {
+        StatementKind kind;
+        Expression expr;
+        SwitchCases cases;
+        struct {
+            da_list(union Statement);
+        } branches;
+        union Statement* default_branch;  // `else`, NULL when there is none
+    } switchs;
 } Statement;
 
 typedef struct BlockStatement BlockStatement;
 
 typedef struct IfStatement IfStatement;
 
+typedef struct SwitchStatement SwitchStatement;
+
 // function types
 
 typedef struct {
@@ -168,6 +231,46 @@ typedef struct {
     da_list(FunctionType);
 } FunctionTypes;
 
+// hash index of function types by signature, built lazily
+typedef struct {
+    size_t* slots;  // function type index + 1, 0 is an empty slot
+    size_t capacity;
+    size_t indexed;  // function types already in slots
+} FunctionTypeIndex;
+
+// linear memory, in bytes, starts with string constants followed by shadow
+// stack growing upwards and heap
+typedef struct {
+    size_t stack_start;
+    size_t stack_end;
+    size_t heap_base;
+    size_t initial_pages;
+    size_t max_pages;  // no maximum when 0
+} MemoryLayout;
+
+// structs, fields are laid out in order of declaration, each aligned to
+// its size, unless struct is `soa`, then slices of it store each field in
+// its own array
+
+typedef struct {
+    char* name;
+    ValueType vt;
+    size_t offset;  // set by codegen, in array of fields for soa
+} StructField;
+
+typedef struct {
+    char* name;
+    bool soa;
+    da_list(StructField);
+    // set by codegen
+    size_t size;  // sum of sizes of fields for soa
+    size_t align;
+} StructType;
+
+typedef struct {
+    da_list(StructType);
+} Structs;
+
 // functions
 
 typedef struct {
@@ -175,6 +278,9 @@ typedef struct {
     ValueType return_type;
     Statement content;
     size_t function_type;
+    bool lazy;        // content is not parsed yet, it starts at body
+    LexerMark body;
+    size_t table_slot;  // set by codegen, 0 when not used as value
 } Function;
 
 typedef struct {
@@ -186,31 +292,85 @@ typedef struct {
 typedef struct {
     char* chars;
     size_t len;
+    size_t offset;  // in memory, assigned by codegen
 } StringConstant;
 
 typedef struct {
     da_list(StringConstant);
 } StringConstants;
 
+// inner types of slices, value types are copied freely so these are owned
+// by module instead
+
+typedef struct {
+    da_list(ValueType*);
+} InnerTypes;
+
 // module
 
 typedef struct {
     Exports exports;
     DeclScopes scopes;
     FunctionTypes function_types;
+    FunctionTypeIndex function_type_index;
     Functions extern_functions;
     Functions functions;
     StringConstants string_constants;
+    InnerTypes inner_types;
+    Structs structs;
+    // set by codegen
+    uint32_t used_builtins;  // bit set of called runtime builtins
+    bool no_simd;            // runtime builtins use only scalar instructions
+    bool uses_v128;          // has v128 values, functions get a v128 temp
+    bool bounds_checks;      // indexing and subslices check their bounds
+    size_t table_size;       // slots of functions used as values
+    MemoryLayout layout;
 } Module;
 
+// what order of things in module depends on, recorded so parallel parsing
+// can put them in the order of serial parsing
+
+typedef struct {
+    size_t type_uses;  // counts when body was skipped
+    size_t strings;
+} ParseSkip;
+
+typedef struct {
+    struct {
+        da_list(size_t);
+    } type_uses;  // function types found or added, in order
+    struct {
+        da_list(ParseSkip);
+    } skips;  // bodies of functions skipped by lazy parsing, in order
+} ParseTrace;
+
 typedef struct {
     Lexer* lex;
     Module* mod;
     size_t current_scope;  // 0 is global scope
+    // skip block bodies of functions and parse only ones reachable from
+    // exports, requires whole input to be available to the lexer
+    bool lazy;
+    ParseTrace* trace;  // recorded when set
 } Parser;
 
 bool compare_value_types(ValueType a, ValueType b);
+// finds decl declared directly in scope, NULL if there is none
+Decl* scope_find_decl(DeclScope* s, const char* name);
+// finds decl visible from scope, NULL if there is none
+Decl* find_decl(Module* mod, size_t scope, char* name);
+
+typedef struct {
+    bool lazy;    // see Parser.lazy
+    size_t jobs;  // threads parsing function bodies, ignored in lazy mode
+} ParseOptions;
+
+Module parse(Lexer* lexer, ParseOptions options);
+// parses into mod, which must be empty, returns false on error
+bool parse_module(Lexer* lexer, ParseOptions options, Module* mod);
 
-Module parse(Lexer* lexer);
+// frees everything module owns, but keeps its lists for reuse
+void module_reset(Module* mod);
+void module_free(Module* mod);
 
 #endif
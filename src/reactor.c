@@ -0,0 +1,78 @@
+// Entry points of the reactor build, which is instantiated once and then
+// compiles sources already placed in its memory, instead of running main on
+// files for every compilation.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "compile.h"
+#include "lex.h"
+#include "mod_vis.h"
+
+#define NOU_EXPORT(name) __attribute__((export_name(name)))
+
+enum {
+    NOU_LAZY = 1 << 0,       // same as `-l`
+    NOU_TOKENS = 1 << 1,     // same as `-t`, tokens are written to listing
+    NOU_VISUALIZE = 1 << 2,  // same as `-v`, module is written to listing
+};
+
+static CompileContext ctx;
+static StringContent source;
+static char* listing;
+static size_t listing_size;
+
+// returns buffer of given size for the source, valid until next call
+NOU_EXPORT("nou_source_buffer")
+char* nou_source_buffer(size_t size) {
+    if (source.capacity < size) {
+        source.capacity = size;
+        source.items = realloc(source.items, size);
+    }
+    source.count = size;
+    return source.items;
+}
+
+NOU_EXPORT("nou_compile")
+bool nou_compile(const char* src, size_t size, uint32_t flags) {
+    free(listing);
+    listing = NULL;
+    listing_size = 0;
+    FILE* listing_file = open_memstream(&listing, &listing_size);
+
+    if (flags & NOU_TOKENS) {
+        Lexer lexer = {.input_buffer = src, .input_size = size};
+        lexer_print_tokens(&lexer, listing_file);
+        free(lexer.token_str.items);
+    }
+
+    ParseOptions options = {.lazy = flags & NOU_LAZY};
+    bool ok = compile_source(&ctx, src, size, options);
+
+    if (ok && (flags & NOU_VISUALIZE)) {
+        visualize_module(&ctx.mod, listing_file);
+    }
+
+    fclose(listing_file);
+    return ok;
+}
+
+NOU_EXPORT("nou_output")
+const uint8_t* nou_output(void) { return ctx.output.items; }
+
+NOU_EXPORT("nou_output_size")
+size_t nou_output_size(void) { return ctx.output.count; }
+
+NOU_EXPORT("nou_diagnostics")
+const char* nou_diagnostics(void) { return ctx.diagnostics.items; }
+
+NOU_EXPORT("nou_diagnostics_size")
+size_t nou_diagnostics_size(void) { return ctx.diagnostics.count; }
+
+NOU_EXPORT("nou_listing")
+const char* nou_listing(void) { return listing; }
+
+NOU_EXPORT("nou_listing_size")
+size_t nou_listing_size(void) { return listing_size; }
@@ -0,0 +1,157 @@
+#include "serve.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compile.h"
+
+// Each request is a header line followed by payload of given size:
+//
+//   source <size> [flags]\n<source>
+//   file <size> [flags]\n<path to source>
+//
+// Flags are the ones command line accepts, but only `-l` is supported. Every
+// request is answered with a header line followed by wasm module (empty if
+// compilation failed) and diagnostics:
+//
+//   ok <wasm size> <diagnostics size>\n<wasm><diagnostics>
+//   error 0 <diagnostics size>\n<diagnostics>
+
+typedef struct {
+    CompileContext ctx;
+    StringContent line;
+    StringContent payload;
+    StringContent source;  // contents of file requests
+    StringContent error;   // errors found before compilation
+} Server;
+
+static bool read_line(FILE* in, StringContent* line) {
+    line->count = 0;
+    int c;
+    while ((c = fgetc(in)) != EOF && c != '\n') {
+        da_append(*line, c);
+    }
+    da_append(*line, '\0');
+    return c != EOF;
+}
+
+static bool read_payload(FILE* in, StringContent* payload, size_t size) {
+    payload->count = 0;
+    if (payload->capacity < size + 1) {
+        payload->capacity = size + 1;
+        payload->items = realloc(payload->items, payload->capacity);
+    }
+    if (fread(payload->items, 1, size, in) != size) return false;
+    payload->items[size] = '\0';
+    payload->count = size;
+    return true;
+}
+
+static void append_str(StringContent* sc, const char* str) {
+    for (size_t i = 0; str[i]; i++) {
+        da_append(*sc, str[i]);
+    }
+}
+
+static bool read_source_file(Server* s, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        append_str(&s->error, "Failed to open file `");
+        append_str(&s->error, path);
+        append_str(&s->error, "`: ");
+        append_str(&s->error, strerror(errno));
+        append_str(&s->error, "\n");
+        return false;
+    }
+
+    s->source.count = 0;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            da_append(s->source, chunk[i]);
+        }
+    }
+    da_append(s->source, '\0');  // so empty files still have a buffer
+    s->source.count--;
+    fclose(file);
+    return true;
+}
+
+static bool parse_flags(Server* s, const char* flags, ParseOptions* out) {
+    for (const char* c = flags; *c; c++) {
+        if (*c == ' ' || *c == '-') continue;
+        if (*c == 'l') {
+            out->lazy = true;
+            continue;
+        }
+        append_str(&s->error, "Unsupported flag `");
+        da_append(s->error, *c);
+        append_str(&s->error, "` in request\n");
+        return false;
+    }
+    return true;
+}
+
+static bool reply(FILE* out, bool ok, ByteBuffer* wasm, StringContent* diag) {
+    size_t wasm_size = ok ? wasm->count : 0;
+    fprintf(out, "%s %zu %zu\n", ok ? "ok" : "error", wasm_size, diag->count);
+    if (wasm_size) fwrite(wasm->items, 1, wasm_size, out);
+    if (diag->count) fwrite(diag->items, 1, diag->count, out);
+    return fflush(out) == 0;
+}
+
+bool serve(FILE* in, FILE* out) {
+    Server s = {0};
+    bool ok = true;
+
+    while (read_line(in, &s.line)) {
+        char kind[16];
+        size_t size;
+        int flags_start = 0;
+        if (sscanf(s.line.items, "%15s %zu%n", kind, &size, &flags_start) !=
+                2 ||
+            (strcmp(kind, "source") != 0 && strcmp(kind, "file") != 0)) {
+            fprintf(stderr, "Malformed request `%s`\n", s.line.items);
+            ok = false;
+            break;
+        }
+        if (!read_payload(in, &s.payload, size)) {
+            fprintf(stderr, "Request ended before its payload\n");
+            ok = false;
+            break;
+        }
+
+        ParseOptions options = {0};
+        bool compiled = false;
+        StringContent* diag = &s.error;
+        s.error.count = 0;
+
+        if (!parse_flags(&s, s.line.items + flags_start, &options)) {
+            // reported in error
+        } else if (strcmp(kind, "file") == 0) {
+            if (read_source_file(&s, s.payload.items)) {
+                compiled = compile_source(&s.ctx, s.source.items,
+                                          s.source.count, options);
+                diag = &s.ctx.diagnostics;
+            }
+        } else {
+            compiled = compile_source(&s.ctx, s.payload.items, s.payload.count,
+                                      options);
+            diag = &s.ctx.diagnostics;
+        }
+
+        if (!reply(out, compiled, &s.ctx.output, diag)) {
+            ok = false;
+            break;
+        }
+    }
+
+    compile_context_free(&s.ctx);
+    free(s.line.items);
+    free(s.payload.items);
+    free(s.source.items);
+    free(s.error.items);
+    return ok;
+}
@@ -0,0 +1,11 @@
+#ifndef SERVE_H_
+#define SERVE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// compiles requests read from in until it ends, see serve.c for the format;
+// returns false if a request is malformed or replying fails
+bool serve(FILE* in, FILE* out);
+
+#endif
@@ -0,0 +1,147 @@
+#include "stats.h"
+
+#include <time.h>
+
+bool stats_enabled = false;
+_Thread_local Stats stats = {0};
+_Thread_local size_t da_allocated_bytes = 0;
+
+static const char* phase_names[PHASE_COUNT] = {
+    [PHASE_LEX] = "lex",
+    [PHASE_PARSE] = "parse",
+    [PHASE_DECISIONS] = "decisions",
+    [PHASE_CODEGEN_TYPES] = "codegen_types",
+    [PHASE_CODEGEN_IMPORT] = "codegen_import",
+    [PHASE_CODEGEN_FUNCS] = "codegen_funcs",
+    [PHASE_CODEGEN_TABLE] = "codegen_table",
+    [PHASE_CODEGEN_MEM] = "codegen_mem",
+    [PHASE_CODEGEN_GLOBAL] = "codegen_global",
+    [PHASE_CODEGEN_EXPORTS] = "codegen_exports",
+    [PHASE_CODEGEN_ELEMENTS] = "codegen_elements",
+    [PHASE_CODEGEN_CODES] = "codegen_codes",
+    [PHASE_CODEGEN_DATAS] = "codegen_datas",
+};
+
+uint64_t stats_now(void) {
+    if (!stats_enabled) return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_end_phase(Phase phase, uint64_t start) {
+    if (!stats_enabled) return;
+    stats.phase_ns[phase] += stats_now() - start;
+    stats.phase_calls[phase]++;
+}
+
+void stats_merge(Stats* into, Stats* from) {
+    for (size_t i = 0; i < PHASE_COUNT; i++) {
+        into->phase_ns[i] += from->phase_ns[i];
+        into->phase_calls[i] += from->phase_calls[i];
+        into->section_bytes[i] += from->section_bytes[i];
+    }
+    into->tokens += from->tokens;
+    into->allocated_bytes += from->allocated_bytes;
+}
+
+// module counts
+
+static void count_statement(Statement* st) {
+    switch (st->kind) {
+        case SK_EMPTY:
+            break;
+        case SK_BLOCK:
+            for (size_t i = 0; i < st->block.count; i++) {
+                count_statement(&st->block.items[i]);
+            }
+            break;
+        case SK_RETURN:
+            stats.rpn_nodes += st->ret.expr.count;
+            break;
+        case SK_IF:
+            stats.rpn_nodes += st->ifs.cond_expr.count;
+            count_statement(st->ifs.positive_branch);
+            if (st->ifs.negative_branch) {
+                count_statement(st->ifs.negative_branch);
+            }
+            break;
+        case SK_EXPRESSION:
+            stats.rpn_nodes += st->expr.expr.count;
+            break;
+        case SK_SWITCH:
+            stats.rpn_nodes += st->switchs.expr.count;
+            for (size_t i = 0; i < st->switchs.branches.count; i++) {
+                count_statement(&st->switchs.branches.items[i]);
+            }
+            if (st->switchs.default_branch) {
+                count_statement(st->switchs.default_branch);
+            }
+            break;
+    }
+}
+
+void stats_count_module(Module* mod) {
+    stats.scopes = mod->scopes.count;
+    stats.decls = 0;
+    for (size_t i = 0; i < mod->scopes.count; i++) {
+        stats.decls += mod->scopes.items[i].count;
+    }
+    stats.functions = mod->functions.count;
+    stats.rpn_nodes = 0;
+    for (size_t i = 0; i < mod->functions.count; i++) {
+        Function* f = &mod->functions.items[i];
+        if (!f->lazy) count_statement(&f->content);
+    }
+}
+
+// printing
+
+void stats_print(FILE* file, bool json) {
+    size_t allocated = stats.allocated_bytes + da_allocated_bytes;
+    size_t total_bytes = 0;
+    for (size_t i = 0; i < PHASE_COUNT; i++) {
+        total_bytes += stats.section_bytes[i];
+    }
+
+    if (json) {
+        fprintf(file, "{\n  \"phases\": {\n");
+        for (size_t i = 0; i < PHASE_COUNT; i++) {
+            fprintf(file,
+                    "    \"%s\": {\"ns\": %llu, \"calls\": %zu, \"bytes\": "
+                    "%zu}%s\n",
+                    phase_names[i], (unsigned long long)stats.phase_ns[i],
+                    stats.phase_calls[i], stats.section_bytes[i],
+                    i + 1 < PHASE_COUNT ? "," : "");
+        }
+        fprintf(file, "  },\n");
+        fprintf(file, "  \"tokens\": %zu,\n", stats.tokens);
+        fprintf(file, "  \"scopes\": %zu,\n", stats.scopes);
+        fprintf(file, "  \"decls\": %zu,\n", stats.decls);
+        fprintf(file, "  \"functions\": %zu,\n", stats.functions);
+        fprintf(file, "  \"rpn_nodes\": %zu,\n", stats.rpn_nodes);
+        fprintf(file, "  \"emitted_bytes\": %zu,\n", total_bytes);
+        fprintf(file, "  \"allocated_bytes\": %zu\n", allocated);
+        fprintf(file, "}\n");
+        return;
+    }
+
+    fprintf(file, "%-16s %12s %10s %10s\n", "phase", "time [ms]", "calls",
+            "bytes");
+    for (size_t i = 0; i < PHASE_COUNT; i++) {
+        fprintf(file, "%-16s %12.3f %10zu", phase_names[i],
+                stats.phase_ns[i] / 1e6, stats.phase_calls[i]);
+        if (i >= PHASE_CODEGEN_TYPES) {
+            fprintf(file, " %10zu", stats.section_bytes[i]);
+        }
+        fprintf(file, "\n");
+    }
+    fprintf(file, "\n");
+    fprintf(file, "%-16s %12zu\n", "tokens", stats.tokens);
+    fprintf(file, "%-16s %12zu\n", "scopes", stats.scopes);
+    fprintf(file, "%-16s %12zu\n", "decls", stats.decls);
+    fprintf(file, "%-16s %12zu\n", "functions", stats.functions);
+    fprintf(file, "%-16s %12zu\n", "rpn nodes", stats.rpn_nodes);
+    fprintf(file, "%-16s %12zu\n", "emitted bytes", total_bytes);
+    fprintf(file, "%-16s %12zu\n", "allocated bytes", allocated);
+}
@@ -0,0 +1,54 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "parse.h"
+
+// times of phases are inclusive, so parsing includes lexing and codes
+// section includes computing decisions; with multiple threads times of all
+// of them are summed
+typedef enum {
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_DECISIONS,
+    PHASE_CODEGEN_TYPES,
+    PHASE_CODEGEN_IMPORT,
+    PHASE_CODEGEN_FUNCS,
+    PHASE_CODEGEN_TABLE,
+    PHASE_CODEGEN_MEM,
+    PHASE_CODEGEN_GLOBAL,
+    PHASE_CODEGEN_EXPORTS,
+    PHASE_CODEGEN_ELEMENTS,
+    PHASE_CODEGEN_CODES,
+    PHASE_CODEGEN_DATAS,
+    PHASE_COUNT,
+} Phase;
+
+typedef struct {
+    uint64_t phase_ns[PHASE_COUNT];
+    size_t phase_calls[PHASE_COUNT];
+    size_t section_bytes[PHASE_COUNT];  // set for codegen phases
+    size_t tokens;
+    size_t scopes;
+    size_t decls;
+    size_t functions;
+    size_t rpn_nodes;
+    size_t allocated_bytes;  // by growing lists, see da.h
+} Stats;
+
+extern bool stats_enabled;
+extern _Thread_local Stats stats;
+
+// monotonic time in nanoseconds, 0 when stats are disabled
+uint64_t stats_now(void);
+void stats_end_phase(Phase phase, uint64_t start);
+
+void stats_merge(Stats* into, Stats* from);
+void stats_count_module(Module* mod);
+void stats_print(FILE* file, bool json);
+
+#endif
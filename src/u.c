@@ -1,33 +1,229 @@
+#include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef __wasi__
+#include <sys/mman.h>
+#endif
 
+#include "cache.h"
 #include "codegen.h"
 #include "lex.h"
 #include "mod_vis.h"
 #include "parse.h"
+#include "serve.h"
+#include "stats.h"
+
+typedef struct {
+    const char* data;
+    size_t size;
+    bool mapped;
+} InputFile;
+
+// maps input file read-only, so lexer can work directly on its contents
+bool open_input_file(const char* file_name, InputFile* out) {
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open file `%s`: %s\n", file_name,
+                strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "Failed to stat file `%s`: %s\n", file_name,
+                strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    *out = (InputFile){.data = "", .size = st.st_size};
+    if (out->size == 0) {  // empty files can't be mapped
+        close(fd);
+        return true;
+    }
+
+#ifndef __wasi__
+    void* map = mmap(NULL, out->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+        close(fd);
+        out->data = map;
+        out->mapped = true;
+        return true;
+    }
+#endif
+
+    // fallback for targets and files which don't support mapping
+    char* buffer = malloc(out->size);
+    assert(buffer);
+    size_t done = 0;
+    while (done < out->size) {
+        ssize_t n = read(fd, buffer + done, out->size - done);
+        if (n <= 0) {
+            fprintf(stderr, "Failed to read file `%s`: %s\n", file_name,
+                    n < 0 ? strerror(errno) : "unexpected end of file");
+            free(buffer);
+            close(fd);
+            return false;
+        }
+        done += n;
+    }
+    close(fd);
+    out->data = buffer;
+    return true;
+}
+
+void close_input_file(InputFile* file) {
+    if (file->size == 0) return;
+#ifndef __wasi__
+    if (file->mapped) {
+        munmap((void*)file->data, file->size);
+        return;
+    }
+#endif
+    free((void*)file->data);
+}
+
+// writes whole buffer in one go, without staging it in stdio
+bool write_output_file(const char* file_name, ByteBuffer* bb) {
+    int fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open file `%s`: %s\n", file_name,
+                strerror(errno));
+        return false;
+    }
+
+    size_t done = 0;
+    while (done < bb->count) {
+        ssize_t n = write(fd, bb->items + done, bb->count - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Failed to write file `%s`: %s\n", file_name,
+                    strerror(errno));
+            close(fd);
+            return false;
+        }
+        done += n;
+    }
+
+    close(fd);
+    return true;
+}
+
+size_t read_stdin_chunk(void* data, char* buffer, size_t capacity) {
+    (void)data;
+    return fread(buffer, 1, capacity, stdin);
+}
+
+// parses size in bytes given to option, memory sizes must be whole pages
+bool parse_size_option(const char* option, const char* arg, bool pages,
+                       size_t* out) {
+    char* end;
+    errno = 0;
+    unsigned long long size = arg ? strtoull(arg, &end, 10) : 0;
+    if (!arg || *arg == '\0' || *end != '\0' || errno || size == 0 ||
+        size > 4ull * 1024 * 1024 * 1024) {
+        fprintf(stderr, "Option `%s` requires a size in bytes up to 4 GiB\n",
+                option);
+        return false;
+    }
+    if (pages && size % PAGE_SIZE != 0) {
+        fprintf(stderr, "Option `%s` requires a multiple of %d bytes\n",
+                option, PAGE_SIZE);
+        return false;
+    }
+    *out = size;
+    return true;
+}
 
 int main(int argc, char** argv) {
     char* input_file_name = NULL;
+    char* output_file_name = "a.out";
+    char* cache_dir = NULL;
+    bool serve_requests = false;
     bool show_visualization = false;
     bool show_tokens = false;
+    bool stats_json = false;
+    ParseOptions parse_options = {0};
+    CodegenOptions codegen_options = {0};
     argv++;
     argc--;
 
     while (argc) {
-        if ((*argv)[0] == '-') {
-            size_t len = strlen(*argv);
+        if (strcmp(*argv, "--serve") == 0) {
+            serve_requests = true;
+        } else if (strcmp(*argv, "--cache-dir") == 0) {
+            if (argc < 2) {
+                fprintf(stderr, "Option `--cache-dir` requires a directory\n");
+                return -1;
+            }
+            cache_dir = argv[1];
+            argv++;
+            argc--;
+        } else if (strcmp(*argv, "--initial-memory") == 0 ||
+                   strcmp(*argv, "--max-memory") == 0 ||
+                   strcmp(*argv, "--stack-size") == 0) {
+            size_t* size = &codegen_options.stack_size;
+            if (strcmp(*argv, "--initial-memory") == 0)
+                size = &codegen_options.initial_memory;
+            else if (strcmp(*argv, "--max-memory") == 0)
+                size = &codegen_options.max_memory;
+            if (!parse_size_option(*argv, argc < 2 ? NULL : argv[1],
+                                   size != &codegen_options.stack_size, size))
+                return -1;
+            argv++;
+            argc--;
+        } else if (strcmp(*argv, "--no-simd") == 0) {
+            codegen_options.no_simd = true;
+        } else if (strcmp(*argv, "--bounds-checks") == 0) {
+            codegen_options.bounds_checks = true;
+        } else if (strcmp(*argv, "--stats") == 0) {
+            stats_enabled = true;
+        } else if (strcmp(*argv, "--stats=json") == 0) {
+            stats_enabled = true;
+            stats_json = true;
+        } else if ((*argv)[0] == '-' && (*argv)[1] == '-') {
+            fprintf(stderr, "Unknown option `%s`\n", *argv);
+            return -1;
+        } else if ((*argv)[0] == '-' && (*argv)[1] != '\0') {
+            char* flags = *argv;
+            size_t len = strlen(flags);
             for (size_t i = 1; i < len; i++) {
-                switch ((*argv)[i]) {
+                switch (flags[i]) {
                     case 'v':
                         show_visualization = true;
                         break;
                     case 't':
                         show_tokens = true;
                         break;
+                    case 'l':
+                        parse_options.lazy = true;
+                        break;
+                    case 'j':
+                        if (argc < 2 || atoi(argv[1]) < 1) {
+                            fprintf(stderr,
+                                    "Flag `j` requires a number of threads\n");
+                            return -1;
+                        }
+                        parse_options.jobs = atoi(argv[1]);
+                        argv++;
+                        argc--;
+                        break;
+                    case 'o':
+                        if (argc < 2) {
+                            fprintf(stderr, "Flag `o` requires a file name\n");
+                            return -1;
+                        }
+                        output_file_name = argv[1];
+                        argv++;
+                        argc--;
+                        break;
                     default:
-                        fprintf(stderr, "Unknown flag `%c`", (*argv)[i]);
+                        fprintf(stderr, "Unknown flag `%c`", flags[i]);
                         return -1;
                 }
             }
@@ -38,58 +234,79 @@ int main(int argc, char** argv) {
         argc--;
     }
 
+    // compiles requests from stdin, until it's closed
+    if (serve_requests) return serve(stdin, stdout) ? 0 : -1;
+
     if (!input_file_name) {
         fprintf(stderr, "Input file name must be provided");
         return -1;
     }
 
-    FILE* input_file = fopen(input_file_name, "r");
-    if (!input_file) {
-        fprintf(stderr, "Failed to open file `%s`: %s", input_file_name,
-                strerror(errno));
+    // `-` reads source from stdin in chunks, instead of loading it whole
+    bool read_stdin = strcmp(input_file_name, "-") == 0;
+
+    if (read_stdin && show_tokens) {
+        fprintf(stderr, "Flag `t` can't be used when reading from stdin\n");
         return -1;
     }
-    fseek(input_file, 0, SEEK_END);
-    size_t input_file_size = ftell(input_file);
-    fseek(input_file, 0, SEEK_SET);
-    char* input_file_buffer = malloc(input_file_size + 1);
-    fread(input_file_buffer, input_file_size, 1, input_file);
-    fclose(input_file);
+
+    if (read_stdin && parse_options.lazy) {
+        fprintf(stderr, "Flag `l` can't be used when reading from stdin\n");
+        return -1;
+    }
+
+    if (read_stdin && parse_options.jobs > 1) {
+        fprintf(stderr, "Flag `j` can't be used when reading from stdin\n");
+        return -1;
+    }
+
+    InputFile input_file = {0};
+    if (!read_stdin && !open_input_file(input_file_name, &input_file))
+        return -1;
 
     if (show_tokens) {
         Lexer lexer = {
-            .input_buffer = input_file_buffer,
-            .input_size = input_file_size,
+            .input_buffer = input_file.data,
+            .input_size = input_file.size,
         };
 
-        Token token;
-        while ((token = lexer_next_token(&lexer)) != T_END) {
-            printf("%d:%d: Token: %d %.*s\n", (int)lexer.token_start_loc.line,
-                   (int)lexer.token_start_loc.col, token, (int)lexer.token_len,
-                   lexer.token_text);
-        }
+        lexer_print_tokens(&lexer, stdout);
     }
 
     {
         Lexer lexer = {
-            .input_buffer = input_file_buffer,
-            .input_size = input_file_size,
+            .input_buffer = input_file.data,
+            .input_size = input_file.size,
         };
+        if (read_stdin) lexer.refill = read_stdin_chunk;
 
-        Module mod = parse(&lexer);
+        // stdin can't be hashed before it is parsed, so it is never cached
+        bool use_cache = cache_dir && !read_stdin;
+        uint64_t key = 0;
+        if (use_cache)
+            key = cache_key(input_file.data, input_file.size, parse_options);
+
+        Module mod;
+        if (!use_cache || !cache_load_module(cache_dir, key, &mod)) {
+            mod = parse(&lexer, parse_options);
+            if (use_cache) cache_store_module(cache_dir, key, &mod);
+        }
+        free(lexer.window.items);
+        if (stats_enabled) stats_count_module(&mod);
 
         if (show_visualization) {
             visualize_module(&mod, stdout);
         }
 
-        ByteBuffer output = codegen_module(&mod);
+        ByteBuffer output = codegen_module(&mod, codegen_options);
 
-        fprintf(stderr, "INFO: Writing to a.out\n");
-        FILE* output_file = fopen("a.out", "w");
-        fwrite(output.items, sizeof(uint8_t), output.count, output_file);
-        fclose(output_file);
+        fprintf(stderr, "INFO: Writing to %s\n", output_file_name);
+        if (!write_output_file(output_file_name, &output)) return -1;
+        free(output.items);
     }
 
-    free(input_file_buffer);
+    if (stats_enabled) stats_print(stdout, stats_json);
+
+    close_input_file(&input_file);
     return 0;
 }
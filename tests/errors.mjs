@@ -0,0 +1,57 @@
+// Compiles invalid programs and fails unless each of them is rejected with
+// its diagnostic. Meant to be run with a build without asserts, which must
+// report type errors instead of crashing or emitting an invalid module.
+//
+// usage: node tests/errors.mjs [u binary]
+
+import { spawnSync } from 'child_process';
+
+const [compiler = './u'] = process.argv.slice(2);
+
+const programs = {
+    'Type mismatch in assignment':
+        'f := fn a: i32 { x := u8 a; };',
+    'Type mismatch in arguments of `g`':
+        'g := fn x: i32 {}; f := fn a: u8 { g(a); };',
+    'Condition of if statement must be a boolean':
+        'f := fn a: i32 { if (a) {} };',
+    'Only slices can be indexed':
+        'f := fn a: i32 -> i32 { return a!1; };',
+    'Index must be a 32-bit integer':
+        'f := fn a: [u8] -> u8 { return a!a; };',
+    'Arithmetic needs numbers of the same type':
+        'f := fn a: i32, b: u8 -> i32 { return a + b; };',
+    'Only numbers of the same type can be compared':
+        'f := fn a: bool -> bool { return a == a; };',
+    'Operands of `and` and `or` must be booleans':
+        'f := fn a: i32 -> i32 { return a and a; };',
+    'Only structs and slices have fields':
+        'f := fn a: i32 -> u32 { return a.len; };',
+    'Slice has no field `foo`':
+        'f := fn a: [u8] -> u32 { return a.foo; };',
+    'Parameter `a` can\'t be assigned':
+        'f := fn a: i32 { a = 1; };',
+    'Only variables, items and fields can be assigned':
+        'f := fn { b := i32 0; b + 1 = 2; };',
+    'Expression must have at most a single value':
+        'f := fn a: i32 { a + 1 2; };',
+    'Number literal is too long':
+        `f := fn -> f64 { return 1.${'1'.repeat(70)}; };`,
+};
+
+let failed = 0;
+for (const [error, source] of Object.entries(programs)) {
+    console.log(`Compiling "${source}"...`);
+    const res = spawnSync(compiler, ['-', '-o', '/dev/null'],
+        { input: source });
+    const stderr = res.stderr.toString();
+    if (res.status !== 0 && res.signal === null && stderr.includes(error)) {
+        console.log(`Passed!`);
+    } else {
+        console.log(`Failed: expected "${error}"; got status ${res.status}`,
+            res.signal ?? '', stderr);
+        failed++;
+    }
+}
+
+if (failed) process.exit(1);
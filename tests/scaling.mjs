@@ -0,0 +1,117 @@
+// Compiles programs from `bench/gen.mjs` at sizes N, 2N, 4N and 8N along
+// each axis and fails when compile time or allocated memory grows faster
+// than linearly. Growth is the slope of log(cost) against log(size), so 1
+// is linear and 2 quadratic. Also fails when parsing on multiple threads
+// gives different output than serial parsing.
+//
+// usage: node tests/scaling.mjs [u binary] [tolerance]
+
+import { spawnSync } from 'child_process';
+import { mkdtempSync, readFileSync, rmSync, writeFileSync } from 'fs';
+import { tmpdir } from 'os';
+import { basename, join } from 'path';
+import { generators } from '../bench/gen.mjs';
+
+// N of each axis, big enough for timings to be above noise
+const sizes = {
+    functions: 1000,
+    nesting: 500,
+    expressions: 5000,
+    strings: 4000,
+    signatures: 1000,
+    externs: 1000,
+};
+const STEPS = [1, 2, 4, 8];
+const RUNS = 3;
+
+const [compiler = './u', tolerance = '0.3'] = process.argv.slice(2);
+const maxSlope = 1 + Number(tolerance);
+
+function measure(file) {
+    let best = null;
+    for (let i = 0; i < RUNS; i++) {
+        const res = spawnSync(compiler,
+            ['--stats=json', file, '-o', '/dev/null']);
+        if (res.status !== 0) {
+            throw new Error(`${file}: ${res.stderr.toString()}`);
+        }
+        const stats = JSON.parse(res.stdout.toString());
+        const ns = Object.entries(stats.phases)
+            .filter(([name]) => name === 'parse' || name.startsWith('codegen_'))
+            .reduce((sum, [, p]) => sum + p.ns, 0);
+        // allocations don't depend on timing, so any run will do
+        if (!best || ns < best.ns) {
+            best = { ns, bytes: stats.allocated_bytes };
+        }
+    }
+    return best;
+}
+
+function compile(file, flags) {
+    const out = `${file}.${flags.join('')}.wasm`;
+    const res = spawnSync(compiler, [...flags, file, '-o', out]);
+    if (res.status !== 0) {
+        throw new Error(`${file}: ${res.stderr.toString()}`);
+    }
+    return readFileSync(out);
+}
+
+// -j must not change output
+function sameInParallel(file) {
+    const same = compile(file, []).equals(compile(file, ['-j', '4']));
+    console.log(`${same ? 'Passed' : 'Failed'}: ${basename(file)} with -j 4`);
+    return same;
+}
+
+// least squares slope of log(y) against log(x)
+function slope(xs, ys) {
+    const lx = xs.map(Math.log), ly = ys.map(Math.log);
+    const mx = lx.reduce((a, b) => a + b) / lx.length;
+    const my = ly.reduce((a, b) => a + b) / ly.length;
+    let num = 0, den = 0;
+    for (let i = 0; i < lx.length; i++) {
+        num += (lx[i] - mx) * (ly[i] - my);
+        den += (lx[i] - mx) ** 2;
+    }
+    return num / den;
+}
+
+const dir = mkdtempSync(join(tmpdir(), 'nou-scaling-'));
+let failed = false;
+try {
+    for (const [name, generate] of Object.entries(generators)) {
+        const ns = [], times = [], bytes = [];
+        for (const step of STEPS) {
+            const n = sizes[name] * step;
+            const file = join(dir, `${name}-${n}.u`);
+            writeFileSync(file, generate(n));
+            const m = measure(file);
+            ns.push(n);
+            times.push(m.ns);
+            bytes.push(m.bytes);
+        }
+
+        const timeSlope = slope(ns, times);
+        const memSlope = slope(ns, bytes);
+        const ok = timeSlope <= maxSlope && memSlope <= maxSlope;
+        console.log(`${ok ? 'Passed' : 'Failed'}: ${name}` +
+            ` (time ^${timeSlope.toFixed(2)}, memory ^${memSlope.toFixed(2)},` +
+            ` ${(times[0] / 1e6).toFixed(1)}ms..` +
+            `${(times[times.length - 1] / 1e6).toFixed(1)}ms)`);
+        if (!ok) failed = true;
+        if (!sameInParallel(join(dir, `${name}-${sizes[name]}.u`))) {
+            failed = true;
+        }
+    }
+    for (const file of ['tests/test.u', 'demo/src/example.u']) {
+        writeFileSync(join(dir, basename(file)), readFileSync(file));
+        if (!sameInParallel(join(dir, basename(file)))) failed = true;
+    }
+} finally {
+    rmSync(dir, { recursive: true, force: true });
+}
+
+if (failed) {
+    console.log(`Cost grows faster than size^${maxSlope} or -j changes output`);
+    process.exit(1);
+}
@@ -34,6 +34,18 @@ const {
     slice_indexing,
     slice_mutation,
     integer_casting,
+    allocation,
+    bulk_memory,
+    slice_kernels,
+    simd_values,
+    wide_numbers,
+    subslices,
+    stack_arrays,
+    structs,
+    switches,
+    conditionals,
+    function_values,
+    huge_allocation,
 } = module.instance.exports;
 
 /** @type {(n: BigInt)} **/
@@ -160,4 +172,60 @@ runTests({
         expr: () => integer_casting(),
         expected: 42,
     },
+    allocation: {
+        expr: () => allocation(),
+        expected: 1,
+    },
+    huge_allocation: {
+        expr: () => [0x40000000, 0x7FFFFFF9, 0xFFFFFFF9, 0xFFFFFFFF]
+            .every(size => {
+                try {
+                    huge_allocation(size);
+                    return false;
+                } catch (e) {
+                    return e instanceof WebAssembly.RuntimeError;
+                }
+            }),
+        expected: true,
+    },
+    bulk_memory: {
+        expr: () => decodeStringFromU8Slice(decodeSliceFromI64(bulk_memory())),
+        expected: "Hello\0World",
+    },
+    slice_kernels: {
+        expr: () => slice_kernels(),
+        expected: 1,
+    },
+    simd_values: {
+        expr: () => simd_values(),
+        expected: 56,
+    },
+    wide_numbers: {
+        expr: () => wide_numbers(5000000n, 10.5),
+        expected: 23.25,
+    },
+    subslices: {
+        expr: () => decodeStringFromU8Slice(decodeSliceFromI64(subslices())),
+        expected: "World",
+    },
+    stack_arrays: {
+        expr: () => stack_arrays(),
+        expected: 67,
+    },
+    structs: {
+        expr: () => structs(),
+        expected: 141,
+    },
+    switches: {
+        expr: () => switches(2),
+        expected: 6376,
+    },
+    conditionals: {
+        expr: () => conditionals(0),
+        expected: 34,
+    },
+    function_values: {
+        expr: () => function_values(2),
+        expected: 27,
+    },
 });
@@ -4,13 +4,14 @@ highligh link NOUString String
 " syntax region NOUChar start=/\v'/ skip=/\v\\./ end=/\v'/
 " highligh link NOUChar Character
 
-syn match NOUNumber /\<[0-9]\+\([ui][0-9]\+\)\?\>/
+syn match NOUNumber /\<[0-9]\+\(\.[0-9]\+\)\?\([uif][0-9]\+\)\?\>/
 highligh link NOUNumber Number
 
-syn keyword NOUKeyword export extern fn return if else
+syn keyword NOUKeyword export extern fn return if then else switch case
+syn keyword NOUKeyword struct soa
 highligh link NOUKeyword Keyword
 
-syn keyword NOUType u8 i32 u32 bool
+syn keyword NOUType u8 i32 u32 i64 u64 f32 f64 bool v128
 syn match NOUType "\["
 syn match NOUType "]"
 highligh link NOUType Type